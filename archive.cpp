@@ -0,0 +1,500 @@
+#include <algorithm>
+#include <cstring>
+#include <QFile>
+
+#include "archive.h"
+
+#ifdef FINDER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef FINDER_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+const size_t DecompressedStream::blockSize;
+const size_t DecompressedStream::maxBlocksAhead;
+const size_t TarReader::blockSize;
+const uint64_t TarReader::maxExtendedHeaderSize;
+
+namespace {
+
+bool isGzipMagic(const char *data, size_t size)
+{
+    return size >= 2 && static_cast<uchar>(data[0]) == 0x1f && static_cast<uchar>(data[1]) == 0x8b;
+}
+
+bool isZstdMagic(const char *data, size_t size)
+{
+    static const uchar magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+    return size >= sizeof(magic) && std::memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+}
+
+struct Decompressor::State
+{
+    State()
+        : initialized(false)
+    {
+#ifdef FINDER_HAVE_ZSTD
+        zstd = nullptr;
+#endif
+    }
+
+    ~State()
+    {
+#ifdef FINDER_HAVE_ZLIB
+        if (initialized && zlib.state != Z_NULL) {
+            inflateEnd(&zlib);
+        }
+#endif
+#ifdef FINDER_HAVE_ZSTD
+        if (zstd != nullptr) {
+            ZSTD_freeDStream(zstd);
+        }
+#endif
+    }
+
+    bool initialized;
+#ifdef FINDER_HAVE_ZLIB
+    z_stream zlib;
+#endif
+#ifdef FINDER_HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+};
+
+Decompressor::Decompressor(Format format, const Source &source)
+    : format(format)
+    , source(source)
+    , state(new State)
+    , input(nullptr)
+    , available(0)
+    , inputEnd(false)
+    , streamEnd(false)
+    , trailing(false)
+{
+#ifdef FINDER_HAVE_ZLIB
+    std::memset(&state->zlib, 0, sizeof(state->zlib));
+    if (format == Format::Gzip) {
+        state->initialized = inflateInit2(&state->zlib, 16 + MAX_WBITS) == Z_OK;
+    }
+#endif
+#ifdef FINDER_HAVE_ZSTD
+    if (format == Format::Zstd) {
+        state->zstd = ZSTD_createDStream();
+        state->initialized = state->zstd != nullptr && !ZSTD_isError(ZSTD_initDStream(state->zstd));
+    }
+#endif
+}
+
+Decompressor::~Decompressor()
+{}
+
+bool Decompressor::pull()
+{
+    if (inputEnd) {
+        return false;
+    }
+    if (!source(&input, &available)) {
+        inputEnd = true;
+        available = 0;
+        return false;
+    }
+    return true;
+}
+
+// Fills up to 'capacity' bytes of 'buffer'; returns how many, 0 at the end
+// of the stream and -1 on corrupt or truncated input.
+qint64 Decompressor::read(char *buffer, size_t capacity)
+{
+    if (format == Format::Plain) {
+        while (available == 0) {
+            if (!pull()) {
+                return 0;
+            }
+        }
+        size_t size = std::min(capacity, available);
+        std::memcpy(buffer, input, size);
+        input += size;
+        available -= size;
+        return static_cast<qint64>(size);
+    }
+
+    if (!state->initialized) {
+        return -1;
+    }
+    while (!streamEnd) {
+        if (available == 0) {
+            pull();
+        }
+
+#ifdef FINDER_HAVE_ZLIB
+        if (format == Format::Gzip) {
+            z_stream &zlib = state->zlib;
+            uInt space = static_cast<uInt>(std::min<size_t>(capacity, 1u << 30));
+            zlib.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input));
+            zlib.avail_in = static_cast<uInt>(std::min<size_t>(available, 1u << 30));
+            zlib.next_out = reinterpret_cast<Bytef *>(buffer);
+            zlib.avail_out = space;
+            int status = inflate(&zlib, Z_NO_FLUSH);
+            size_t produced = space - zlib.avail_out;
+            available -= reinterpret_cast<const char *>(zlib.next_in) - input;
+            input = reinterpret_cast<const char *>(zlib.next_in);
+            trailing = trailing && produced == 0;
+            if (status == Z_STREAM_END) {
+                // Another member may follow.
+                while (available == 0 && pull()) {
+                }
+                if (available != 0) {
+                    inflateReset(&zlib);
+                    trailing = true;
+                } else {
+                    streamEnd = true;
+                }
+            } else if (status == Z_DATA_ERROR && trailing) {
+                // Not a member after all; gzip ignores such trailing bytes.
+                streamEnd = true;
+            } else if (status != Z_OK && (status != Z_BUF_ERROR || (produced == 0 && inputEnd))) {
+                // Corrupt, or the input ended in the middle of a member.
+                return -1;
+            }
+            if (produced != 0) {
+                return static_cast<qint64>(produced);
+            }
+            continue;
+        }
+#endif
+#ifdef FINDER_HAVE_ZSTD
+        if (format == Format::Zstd) {
+            ZSTD_inBuffer in = {input, available, 0};
+            ZSTD_outBuffer out = {buffer, capacity, 0};
+            size_t hint = ZSTD_decompressStream(state->zstd, &out, &in);
+            if (ZSTD_isError(hint)) {
+                return -1;
+            }
+            input += in.pos;
+            available -= in.pos;
+            if (hint == 0) {
+                while (available == 0 && pull()) {
+                }
+                streamEnd = available == 0;
+            } else if (out.pos == 0 && in.pos == 0 && inputEnd) {
+                return -1;
+            }
+            if (out.pos != 0) {
+                return static_cast<qint64>(out.pos);
+            }
+            continue;
+        }
+#endif
+        return -1;
+    }
+    return 0;
+}
+
+// Recognizes the compressed formats this build can decode.
+bool Decompressor::detect(const char *data, size_t size, Format &format)
+{
+#ifdef FINDER_HAVE_ZLIB
+    if (isGzipMagic(data, size)) {
+        format = Format::Gzip;
+        return true;
+    }
+#endif
+#ifdef FINDER_HAVE_ZSTD
+    if (isZstdMagic(data, size)) {
+        format = Format::Zstd;
+        return true;
+    }
+#endif
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    format = Format::Plain;
+    return false;
+}
+
+// True for a compressed file and for a plain tar archive; 'data' should
+// hold at least the first TarReader::blockSize bytes of the file.
+bool Decompressor::isArchive(const char *data, size_t size, Format &format)
+{
+    return detect(data, size, format) || TarReader::isTar(data, size);
+}
+
+bool Decompressor::isArchive(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray head = file.read(TarReader::blockSize);
+    Format format;
+    return isArchive(head.constData(), head.size(), format);
+}
+
+DecompressedStream::DecompressedStream(Decompressor::Format format, const Decompressor::Source &source)
+    : decompressor(format, source)
+    , done(false)
+    , error(false)
+    , stopped(false)
+{
+    thread = std::thread([this]
+    {
+        run();
+    });
+}
+
+DecompressedStream::~DecompressedStream()
+{
+    {
+        std::lock_guard<std::mutex> lg(m);
+        stopped = true;
+    }
+    consumedCv.notify_all();
+    thread.join();
+}
+
+// Waits for the next decompressed block; false once everything was handed
+// out or decompression failed.
+bool DecompressedStream::next(QByteArray &block)
+{
+    std::unique_lock<std::mutex> lg(m);
+    producedCv.wait(lg, [this]
+    {
+        return !blocks.empty() || done;
+    });
+    if (blocks.empty()) {
+        return false;
+    }
+
+    block = std::move(blocks.front());
+    blocks.pop_front();
+    consumedCv.notify_one();
+    return true;
+}
+
+bool DecompressedStream::failed() const
+{
+    std::lock_guard<std::mutex> lg(m);
+    return error;
+}
+
+void DecompressedStream::run()
+{
+    bool failed = false;
+    for (bool end = false; !end && !failed;) {
+        QByteArray block(static_cast<int>(DecompressedStream::blockSize), Qt::Uninitialized);
+        size_t size = 0;
+        while (size != DecompressedStream::blockSize) {
+            qint64 read = decompressor.read(block.data() + size, DecompressedStream::blockSize - size);
+            if (read <= 0) {
+                end = true;
+                failed = read < 0;
+                break;
+            }
+            size += static_cast<size_t>(read);
+        }
+        block.truncate(static_cast<int>(size));
+
+        std::unique_lock<std::mutex> lg(m);
+        consumedCv.wait(lg, [this]
+        {
+            return blocks.size() < DecompressedStream::maxBlocksAhead || stopped;
+        });
+        if (stopped) {
+            break;
+        }
+        if (size != 0) {
+            blocks.push_back(std::move(block));
+            producedCv.notify_one();
+        }
+    }
+
+    std::lock_guard<std::mutex> lg(m);
+    done = true;
+    error = failed;
+    producedCv.notify_one();
+}
+
+TarReader::TarReader(const MemberCallback &onMember, const DataCallback &onData, const EndCallback &onEnd)
+    : onMember(onMember)
+    , onData(onData)
+    , onEnd(onEnd)
+    , state(State::Header)
+    , remaining(0)
+    , padding(0)
+{}
+
+// Consumes the next bytes of the archive; false once it turned out not to
+// be a valid one.
+bool TarReader::feed(const char *data, size_t size)
+{
+    while (size != 0 && state != State::End && state != State::Error) {
+        if (state == State::Header) {
+            size_t take = std::min(TarReader::blockSize - header.size(), size);
+            header.append(data, static_cast<int>(take));
+            data += take;
+            size -= take;
+            if (static_cast<size_t>(header.size()) == TarReader::blockSize) {
+                parseHeader();
+                header.clear();
+            }
+            continue;
+        }
+
+        if (state == State::Padding) {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(padding, size));
+            data += take;
+            size -= take;
+            padding -= take;
+            if (padding == 0) {
+                state = State::Header;
+            }
+            continue;
+        }
+
+        size_t take = static_cast<size_t>(std::min<uint64_t>(remaining, size));
+        if (state == State::Data) {
+            onData(data, take);
+        } else if (state == State::LongName || state == State::Pax) {
+            extended.append(data, static_cast<int>(take));
+        }
+        data += take;
+        size -= take;
+        remaining -= take;
+        if (remaining != 0) {
+            continue;
+        }
+
+        if (state == State::Data) {
+            onEnd();
+        } else if (state == State::LongName) {
+            nextPath = extended.left(static_cast<int>(qstrnlen(extended.constData(), extended.size())));
+        } else if (state == State::Pax) {
+            QByteArray path = parsePaxPath(extended);
+            if (!path.isEmpty()) {
+                nextPath = path;
+            }
+        }
+        extended.clear();
+        state = padding != 0 ? State::Padding : State::Header;
+    }
+    return state != State::Error;
+}
+
+bool TarReader::atEnd() const
+{
+    return state == State::End;
+}
+
+bool TarReader::parseHeader()
+{
+    const char *block = header.constData();
+    if (std::all_of(block, block + TarReader::blockSize, [](char c) { return c == '\0'; })) {
+        state = State::End;
+        return true;
+    }
+    if (!isTar(block, TarReader::blockSize)) {
+        state = State::Error;
+        return false;
+    }
+
+    uint64_t size = parseNumber(block + 124, 12);
+    char type = block[156];
+    remaining = size;
+    padding = (TarReader::blockSize - size % TarReader::blockSize) % TarReader::blockSize;
+
+    if (type == 'L' || type == 'x') {
+        state = size <= TarReader::maxExtendedHeaderSize ? (type == 'L' ? State::LongName : State::Pax) : State::Skip;
+    } else if (type == '0' || type == '\0' || type == '7') {
+        QByteArray path = nextPath;
+        if (path.isEmpty()) {
+            QByteArray name(block, static_cast<int>(qstrnlen(block, 100)));
+            QByteArray prefix(block + 345, static_cast<int>(qstrnlen(block + 345, 155)));
+            path = prefix.isEmpty() ? name : prefix + '/' + name;
+        }
+        nextPath.clear();
+        while (path.startsWith("./")) {
+            path.remove(0, 2);
+        }
+        QByteArray name = path;
+        for (int copy = 2; names.contains(path); copy++) {
+            path = name + ';' + QByteArray::number(copy);
+        }
+        names.insert(path);
+
+        onMember(path);
+        state = State::Data;
+        if (size == 0) {
+            onEnd();
+            state = State::Header;
+        }
+    } else {
+        nextPath.clear();
+        state = State::Skip;
+    }
+
+    if (state == State::Skip && size == 0) {
+        state = State::Header;
+    }
+    return true;
+}
+
+// Octal, NUL or space terminated, or base-256 when the high bit of the
+// first byte is set (GNU, for sizes of 8 GiB and more).
+uint64_t TarReader::parseNumber(const char *field, size_t size)
+{
+    uint64_t value = 0;
+    if (static_cast<uchar>(field[0]) & 0x80) {
+        value = static_cast<uchar>(field[0]) & 0x7f;
+        for (size_t i = 1; i != size; i++) {
+            value = value << 8 | static_cast<uchar>(field[i]);
+        }
+        return value;
+    }
+
+    size_t i = 0;
+    while (i != size && field[i] == ' ') {
+        i++;
+    }
+    for (; i != size && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value << 3 | static_cast<uint64_t>(field[i] - '0');
+    }
+    return value;
+}
+
+// Pax records are "<length> <key>=<value>\n".
+QByteArray TarReader::parsePaxPath(const QByteArray &records)
+{
+    int pos = 0;
+    while (pos < records.size()) {
+        int space = records.indexOf(' ', pos);
+        if (space == -1) {
+            break;
+        }
+        int length = records.mid(pos, space - pos).toInt();
+        if (length <= space - pos || pos + length > records.size()) {
+            break;
+        }
+        QByteArray record = records.mid(space + 1, length - (space - pos) - 2);
+        if (record.startsWith("path=")) {
+            return record.mid(5);
+        }
+        pos += length;
+    }
+    return QByteArray();
+}
+
+bool TarReader::isTar(const char *data, size_t size)
+{
+    if (size < TarReader::blockSize || std::memcmp(data + 257, "ustar", 5) != 0) {
+        return false;
+    }
+
+    // The checksum field itself counts as spaces.
+    uint64_t sum = 0;
+    for (size_t i = 0; i != TarReader::blockSize; i++) {
+        sum += i >= 148 && i < 156 ? ' ' : static_cast<uchar>(data[i]);
+    }
+    return sum == parseNumber(data + 148, 8);
+}
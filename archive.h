@@ -0,0 +1,141 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <QByteArray>
+#include <QSet>
+#include <QString>
+
+// Streaming decoder of a compressed file, told apart from plain files by
+// its magic bytes: gzip (any number of concatenated members) when built
+// with zlib, zstd (any number of frames) when built with libzstd. Input is
+// pulled from a Source block by block and output is produced into the
+// caller's buffer, so memory stays bounded whatever the ratio.
+class Decompressor
+{
+public:
+    enum class Format
+    {
+        Plain,
+        Gzip,
+        Zstd
+    };
+
+    // Hands out the next block of raw input; false at the end.
+    typedef std::function<bool(const char **data, size_t *size)> Source;
+
+    Decompressor(Format format, const Source &source);
+    ~Decompressor();
+
+    qint64 read(char *buffer, size_t capacity);
+
+    static bool detect(const char *data, size_t size, Format &format);
+    static bool isArchive(const char *data, size_t size, Format &format);
+    static bool isArchive(const QString &filePath);
+
+private:
+    struct State;
+
+    bool pull();
+
+    Format format;
+    Source source;
+    std::unique_ptr<State> state;
+    const char *input;
+    size_t available;
+    bool inputEnd;
+    bool streamEnd;
+    bool trailing;
+};
+
+// Runs a Decompressor on a thread of its own, so that decompressing a file
+// overlaps with matching what was decompressed before; at most
+// maxBlocksAhead blocks wait for the consumer.
+class DecompressedStream
+{
+public:
+    DecompressedStream(Decompressor::Format format, const Decompressor::Source &source);
+    ~DecompressedStream();
+
+    bool next(QByteArray &block);
+    bool failed() const;
+
+private:
+    void run();
+
+private:
+    static const size_t blockSize = 256 * 1024;
+    static const size_t maxBlocksAhead = 4;
+
+    Decompressor decompressor;
+    mutable std::mutex m;
+    std::condition_variable producedCv;
+    std::condition_variable consumedCv;
+    std::deque<QByteArray> blocks;
+    bool done;
+    bool error;
+    bool stopped;
+    std::thread thread;
+};
+
+// Splits a tar stream into its members as it arrives. Regular files are
+// reported with their full path, GNU long names and pax path records
+// included; directories, links and other entries are skipped. A path that
+// comes again, as when members were appended to an archive, is reported as
+// the first free one of "path;2", "path;3" and so on, so that every member
+// has a name of its own. Only ustar and GNU archives are recognized, as the
+// old format has no magic.
+class TarReader
+{
+public:
+    typedef std::function<void(const QByteArray &path)> MemberCallback;
+    typedef std::function<void(const char *data, size_t size)> DataCallback;
+    typedef std::function<void()> EndCallback;
+
+    static const size_t blockSize = 512;
+
+    TarReader(const MemberCallback &onMember, const DataCallback &onData, const EndCallback &onEnd);
+
+    bool feed(const char *data, size_t size);
+    bool atEnd() const;
+
+    static bool isTar(const char *data, size_t size);
+
+private:
+    enum class State
+    {
+        Header,
+        Data,
+        LongName,
+        Pax,
+        Skip,
+        Padding,
+        End,
+        Error
+    };
+
+    bool parseHeader();
+    static uint64_t parseNumber(const char *field, size_t size);
+    static QByteArray parsePaxPath(const QByteArray &records);
+
+private:
+    static const uint64_t maxExtendedHeaderSize = 1024 * 1024;
+
+    MemberCallback onMember;
+    DataCallback onData;
+    EndCallback onEnd;
+    State state;
+    QByteArray header;
+    QByteArray extended;
+    QByteArray nextPath;
+    QSet<QByteArray> names;
+    uint64_t remaining;
+    uint64_t padding;
+};
+
+#endif // ARCHIVE_H
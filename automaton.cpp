@@ -1,67 +1,431 @@
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
 #include "automaton.h"
 
-Automaton::Automaton(size_t size = 1)
-    : activeStateIdx(0)
-    , states(size)
+const size_t Automaton::maxFoldVariants;
+
+namespace {
+
+// Above this no character has a case mapping (Adlam ends at U+1E943).
+const uint maxCasedCodePoint = 0x1ffff;
+
+// The multi-character folds of CaseFolding.txt (status F) outside of the
+// Greek Extended block.
+struct FullFold
+{
+    uint codePoint;
+    uint folded[3];
+};
+
+const FullFold fullFolds[] = {
+    {0x00df, {0x0073, 0x0073, 0}},
+    {0x0130, {0x0069, 0x0307, 0}},
+    {0x0149, {0x02bc, 0x006e, 0}},
+    {0x01f0, {0x006a, 0x030c, 0}},
+    {0x0390, {0x03b9, 0x0308, 0x0301}},
+    {0x03b0, {0x03c5, 0x0308, 0x0301}},
+    {0x0587, {0x0565, 0x0582, 0}},
+    {0x1e96, {0x0068, 0x0331, 0}},
+    {0x1e97, {0x0074, 0x0308, 0}},
+    {0x1e98, {0x0077, 0x030a, 0}},
+    {0x1e99, {0x0079, 0x030a, 0}},
+    {0x1e9a, {0x0061, 0x02be, 0}},
+    {0x1e9e, {0x0073, 0x0073, 0}},
+    {0xfb00, {0x0066, 0x0066, 0}},
+    {0xfb01, {0x0066, 0x0069, 0}},
+    {0xfb02, {0x0066, 0x006c, 0}},
+    {0xfb03, {0x0066, 0x0066, 0x0069}},
+    {0xfb04, {0x0066, 0x0066, 0x006c}},
+    {0xfb05, {0x0073, 0x0074, 0}},
+    {0xfb06, {0x0073, 0x0074, 0}},
+    {0xfb13, {0x0574, 0x0576, 0}},
+    {0xfb14, {0x0574, 0x0565, 0}},
+    {0xfb15, {0x0574, 0x056b, 0}},
+    {0xfb16, {0x057e, 0x0576, 0}},
+    {0xfb17, {0x0574, 0x056d, 0}},
+};
+
+int fullFoldSize(const FullFold &fold)
+{
+    return fold.folded[2] != 0 ? 3 : 2;
+}
+
+const FullFold *findFullFold(uint codePoint)
+{
+    for (const FullFold &fold : fullFolds) {
+        if (fold.codePoint == codePoint) {
+            return &fold;
+        }
+    }
+    return nullptr;
+}
+
+// Every character with a simple case folding, by the character it folds to.
+const std::unordered_map<uint, std::vector<uint>> &foldClasses()
+{
+    static const std::unordered_map<uint, std::vector<uint>> classes = []
+    {
+        std::unordered_map<uint, std::vector<uint>> result;
+        for (uint c = 0; c <= maxCasedCodePoint; c++) {
+            uint folded = QChar::toCaseFolded(c);
+            if (folded != c) {
+                std::vector<uint> &members = result[folded];
+                if (members.empty()) {
+                    members.push_back(folded);
+                }
+                members.push_back(c);
+            }
+        }
+        return result;
+    }();
+    return classes;
+}
+
+std::vector<uint16_t> encode(uint codePoint, bool utf8)
+{
+    std::vector<uint16_t> units;
+    if (utf8) {
+        for (char byte : QString::fromUcs4(&codePoint, 1).toUtf8()) {
+            units.push_back(static_cast<uint8_t>(byte));
+        }
+    } else if (QChar::requiresSurrogates(codePoint)) {
+        units.push_back(QChar::highSurrogate(codePoint));
+        units.push_back(QChar::lowSurrogate(codePoint));
+    } else {
+        units.push_back(static_cast<uint16_t>(codePoint));
+    }
+    return units;
+}
+
+}
+
+Automaton::Automaton()
+    : Automaton(Automaton::fromString(QString()))
+{}
+
+Automaton::Automaton(const std::shared_ptr<const Table> &table)
+    : table(table)
+    , classes(table->classes.data())
+    , transitions(table->transitions.data())
+    , terminal(table->terminal.data())
+    , classesSize(static_cast<uint32_t>(table->classes.size()))
+    , classShift(table->classShift)
+    , activeStateIdx(0)
 {}
 
-Automaton Automaton::fromString(const QString &str)
+Automaton Automaton::fromString(const QString &str, CaseFolding folding)
+{
+    return fromStrings(QStringList() << str, folding);
+}
+
+Automaton Automaton::fromStrings(const QStringList &strings, CaseFolding folding)
+{
+    std::vector<Variant> variants;
+    for (int idx = 0; idx < strings.size(); idx++) {
+        if (folding != CaseFolding::None) {
+            std::vector<Variant> folded = foldedVariants(idx, strings[idx].toUcs4(), folding, false);
+            variants.insert(variants.end(), folded.begin(), folded.end());
+            continue;
+        }
+
+        variants.push_back({idx, 0, 0, {}});
+        for (const QChar &ch : strings[idx]) {
+            variants.back().positions.emplace_back(1, std::vector<uint16_t>(1, ch.unicode()));
+        }
+    }
+
+    size_t alphabetSize = 0;
+    for (const Variant &variant : variants) {
+        for (const Alternatives &position : variant.positions) {
+            for (const std::vector<uint16_t> &alternative : position) {
+                for (uint16_t unit : alternative) {
+                    alphabetSize = std::max<size_t>(alphabetSize, unit + 1);
+                }
+            }
+        }
+    }
+
+    return build(std::move(variants), alphabetSize);
+}
+
+Automaton Automaton::fromUtf8(const QByteArray &bytes, CaseFolding folding)
+{
+    return fromUtf8(std::vector<QByteArray>(1, bytes), folding);
+}
+
+Automaton Automaton::fromUtf8(const std::vector<QByteArray> &bytes, CaseFolding folding)
+{
+    std::vector<Variant> variants;
+    for (size_t idx = 0; idx < bytes.size(); idx++) {
+        if (folding != CaseFolding::None) {
+            QVector<uint> codePoints = QString::fromUtf8(bytes[idx]).toUcs4();
+            std::vector<Variant> folded = foldedVariants(static_cast<int>(idx), codePoints, folding, true);
+            variants.insert(variants.end(), folded.begin(), folded.end());
+            continue;
+        }
+
+        variants.push_back({static_cast<int>(idx), 0, 0, {}});
+        for (char ch : bytes[idx]) {
+            variants.back().positions.emplace_back(1, std::vector<uint16_t>(1, static_cast<uint8_t>(ch)));
+        }
+    }
+
+    return build(std::move(variants), 256);
+}
+
+// All characters with the same simple case folding as 'codePoint',
+// including itself.
+std::vector<uint> Automaton::caseVariants(uint codePoint)
 {
-    Automaton result;
-    std::vector<int> suffix(str.size() + 1, 0);
-    suffix[0] = -1;
+    const auto &classes = foldClasses();
+    auto found = classes.find(QChar::toCaseFolded(codePoint));
+    if (found == classes.end()) {
+        return std::vector<uint>(1, codePoint);
+    }
+    return found->second;
+}
+
+std::vector<Automaton::Variant> Automaton::foldedVariants(int pattern, const QVector<uint> &codePoints,
+                                                          CaseFolding folding, bool utf8)
+{
+    QVector<uint> folded;
+    for (uint c : codePoints) {
+        const FullFold *full = folding == CaseFolding::Full ? findFullFold(c) : nullptr;
+        if (full != nullptr) {
+            for (int i = 0; i != fullFoldSize(*full); i++) {
+                folded.append(full->folded[i]);
+            }
+        } else {
+            folded.append(QChar::toCaseFolded(c));
+        }
+    }
+
+    auto alternatives = [utf8](const std::vector<uint> &members)
+    {
+        Alternatives result;
+        for (uint member : members) {
+            result.push_back(encode(member, utf8));
+        }
+        return result;
+    };
 
-    for (int i = 0; i < str.size(); i++) {
-        QChar ch = str.at(i);
+    // Depth first, so the first variant spells every character on its own
+    // and the ones dropped over maxFoldVariants are those with most spans.
+    std::vector<Variant> variants;
+    std::vector<Alternatives> positions;
+    std::function<void(int)> expand = [&](int at)
+    {
+        if (variants.size() == Automaton::maxFoldVariants) {
+            return;
+        }
+        if (at == folded.size()) {
+            variants.push_back({pattern, 0, 0, positions});
+            return;
+        }
 
-        int p = suffix[i];
-        while (p != -1 && str.at(p) != ch) {
-            p = suffix[p];
+        positions.push_back(alternatives(caseVariants(folded[at])));
+        expand(at + 1);
+        positions.pop_back();
+
+        if (folding != CaseFolding::Full) {
+            return;
+        }
+        for (size_t i = 0; i != sizeof(fullFolds) / sizeof(fullFolds[0]); i++) {
+            int size = fullFoldSize(fullFolds[i]);
+            if (at + size > folded.size() || !std::equal(fullFolds[i].folded, fullFolds[i].folded + size, folded.begin() + at)) {
+                continue;
+            }
+
+            std::vector<uint> sources;
+            bool seen = false;
+            for (size_t j = 0; j != sizeof(fullFolds) / sizeof(fullFolds[0]); j++) {
+                if (fullFoldSize(fullFolds[j]) == size && std::equal(fullFolds[j].folded, fullFolds[j].folded + size, fullFolds[i].folded)) {
+                    seen = seen || j < i;
+                    for (uint source : caseVariants(fullFolds[j].codePoint)) {
+                        if (std::find(sources.begin(), sources.end(), source) == sources.end()) {
+                            sources.push_back(source);
+                        }
+                    }
+                }
+            }
+            if (seen) {
+                continue;
+            }
+
+            positions.push_back(alternatives(sources));
+            expand(at + size);
+            positions.pop_back();
+        }
+    };
+    expand(0);
+    return variants;
+}
+
+// Builds the Aho-Corasick automaton of the variants. The alternatives of a
+// position branch from one state and meet again in the state after it, so
+// with case folding the trie is a DAG; states are therefore visited once,
+// in the order of their shortest distance from the root, when the suffix
+// links are computed.
+Automaton Automaton::build(std::vector<Variant> &&variants, size_t alphabetSize)
+{
+    auto table = std::make_shared<Table>();
+
+    int classCount = 1;
+    table->classes.assign(alphabetSize, 0);
+    for (const Variant &variant : variants) {
+        for (const Alternatives &position : variant.positions) {
+            for (const std::vector<uint16_t> &alternative : position) {
+                for (uint16_t unit : alternative) {
+                    uint16_t &cls = table->classes[unit];
+                    if (cls == 0) {
+                        cls = static_cast<uint16_t>(classCount++);
+                    }
+                }
+            }
         }
-        suffix[i + 1] = p + 1;
     }
 
-    result.states.resize(str.size() + 1);
-    for (int i = 0; i < str.size(); i++) {
-        result.states[i].transitions[str.at(i)] = i + 1;
+    table->classShift = 0;
+    while ((1 << table->classShift) < classCount) {
+        table->classShift++;
     }
+    size_t rowSize = size_t(1) << table->classShift;
 
-    for (size_t i = 1; i < suffix.size(); i++) {
-        State &suf = result.states[suffix[i]];
-        State &state = result.states[i];
-        for (auto &trans : suf.transitions) {
-            QChar ch = trans.first;
-            if (state.transitions.count(ch) == 0) {
-                state.transitions[ch] = trans.second;
+    std::vector<int32_t> &trie = table->transitions;
+    std::vector<int32_t> &outputs = table->outputs;
+    trie.assign(rowSize, 0);
+    outputs.assign(1, -1);
+    for (size_t idx = 0; idx < variants.size(); idx++) {
+        Variant &variant = variants[idx];
+        int32_t state = 0;
+        for (const Alternatives &position : variant.positions) {
+            int32_t target = -1;
+            size_t shortest = SIZE_MAX;
+            size_t longest = 0;
+            for (const std::vector<uint16_t> &alternative : position) {
+                int32_t current = state;
+                for (size_t i = 0; i != alternative.size(); i++) {
+                    size_t cell = (size_t(current) << table->classShift) | table->classes[alternative[i]];
+                    if (trie[cell] == 0) {
+                        if (i + 1 == alternative.size() && target != -1) {
+                            trie[cell] = target;
+                        } else {
+                            trie[cell] = static_cast<int32_t>(outputs.size());
+                            outputs.push_back(-1);
+                            trie.resize(trie.size() + rowSize, 0);
+                        }
+                    }
+                    current = trie[cell];
+                }
+                if (target == -1) {
+                    target = current;
+                }
+                shortest = std::min(shortest, alternative.size());
+                longest = std::max(longest, alternative.size());
             }
+            state = target;
+            variant.minLength += shortest;
+            variant.maxLength += longest;
+        }
+        if (outputs[state] == -1) {
+            outputs[state] = static_cast<int32_t>(idx);
+        }
+        if (variant.minLength == variant.maxLength) {
+            variant.positions.clear();
         }
     }
+    table->variants = std::move(variants);
 
-    result.states.back().terminal = true;
+    size_t stateCount = outputs.size();
+    std::vector<int32_t> suffix(stateCount, 0);
+    std::vector<char> queued(stateCount, 0);
+    std::vector<int32_t> order;
+    order.reserve(stateCount);
+    table->outputLinks.assign(stateCount, -1);
+
+    for (size_t cls = 0; cls < rowSize; cls++) {
+        if (trie[cls] != 0 && !queued[trie[cls]]) {
+            queued[trie[cls]] = 1;
+            order.push_back(trie[cls]);
+        }
+    }
+
+    for (size_t i = 0; i < order.size(); i++) {
+        int32_t state = order[i];
+        int32_t *row = &trie[state * rowSize];
+        const int32_t *fallback = &trie[suffix[state] * rowSize];
+
+        for (size_t cls = 0; cls < rowSize; cls++) {
+            if (row[cls] == 0) {
+                row[cls] = fallback[cls];
+            } else if (!queued[row[cls]]) {
+                queued[row[cls]] = 1;
+                suffix[row[cls]] = fallback[cls];
+                order.push_back(row[cls]);
+            }
+        }
+
+        int32_t link = suffix[state];
+        table->outputLinks[state] = outputs[link] != -1 ? link : table->outputLinks[link];
+    }
 
-    return result;
+    table->terminal.assign((stateCount + 63) / 64, 0);
+    for (size_t state = 0; state < stateCount; state++) {
+        if (outputs[state] != -1 || table->outputLinks[state] != -1) {
+            table->terminal[state >> 6] |= uint64_t(1) << (state & 63);
+        }
+    }
+
+    return Automaton(table);
+}
+
+int Automaton::pattern(int output) const
+{
+    return table->variants[output].pattern;
 }
 
-bool Automaton::step(const QChar &current, bool autoReset)
+// The length of the match of 'output' ending at data + end; for automata
+// built by fromUtf8. Alternatives are whole UTF-8 characters, none of them a
+// suffix of another, so walking back position by position never has to
+// backtrack.
+size_t Automaton::matchLength(int output, const char *data, size_t end) const
 {
-    State &activeState = states[activeStateIdx];
-    if (activeState.transitions.count(current) == 0) {
-        if (autoReset) {
-            reset();
+    const Variant &variant = table->variants[output];
+    if (variant.positions.empty()) {
+        return variant.maxLength;
+    }
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+    size_t begin = end;
+    for (auto position = variant.positions.rbegin(); position != variant.positions.rend(); ++position) {
+        for (const std::vector<uint16_t> &alternative : *position) {
+            if (alternative.size() <= begin
+                    && std::equal(alternative.begin(), alternative.end(), bytes + begin - alternative.size())) {
+                begin -= alternative.size();
+                break;
+            }
         }
-        return false;
     }
+    return end - begin;
+}
 
-    activeStateIdx = activeState.transitions[current];
-    return true;
+size_t Automaton::maxMatchLength() const
+{
+    size_t longest = 0;
+    for (const Variant &variant : table->variants) {
+        longest = std::max(longest, variant.maxLength);
+    }
+    return longest;
 }
 
-void Automaton::reset()
+size_t Automaton::stateCount() const
 {
-    activeStateIdx = 0;
+    return table->transitions.size() >> classShift;
 }
 
-bool Automaton::isTerminal() const
+size_t Automaton::classCount() const
 {
-    return states[activeStateIdx].terminal;
+    return size_t(1) << classShift;
 }
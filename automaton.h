@@ -1,32 +1,139 @@
 #ifndef AUTOMATON_H
 #define AUTOMATON_H
 
-#include <map>
+#include <cstdint>
+#include <memory>
 #include <vector>
+#include <QByteArray>
 #include <QChar>
 #include <QString>
+#include <QStringList>
+#include <QVector>
 
+// Aho-Corasick matcher for one or more patterns, compiled into a dense
+// transition table. Input units are first mapped to an equivalence class
+// (all units absent from the patterns share class 0), so a row holds one
+// cell per class instead of one per possible unit. Automata built by
+// fromUtf8 cover the whole byte alphabet and are driven through stepByte.
+// For a single pattern the map-based ReferenceAutomaton produces the same
+// state sequence and is kept for differential testing.
+//
+// Case-insensitive automata are compiled from the same tables: every
+// character of a pattern becomes the set of encodings of the characters
+// folding to the same one, and all of them lead to a single trie state, so
+// stepping costs exactly as much as without folding. Full folding also adds
+// a variant of the pattern for every multi-character fold it contains (the
+// "ss" of "strasse" may be spelled with one 'ß'), up to maxFoldVariants per
+// pattern. A match may then be shorter or longer than its pattern, so its
+// length is recovered by matchLength from the bytes it ends with.
 class Automaton
 {
+public:
+    enum class CaseFolding
+    {
+        None,
+        Simple,
+        Full
+    };
+
 private:
-    struct State
+    // The unit strings that may stand for one character of a pattern.
+    typedef std::vector<std::vector<uint16_t>> Alternatives;
+
+    // One spelling of a pattern; an output of the automaton. The positions
+    // are only kept while its matches may differ in length.
+    struct Variant
     {
-        bool terminal;
-        std::map<QChar, int> transitions;
+        int pattern;
+        size_t minLength;
+        size_t maxLength;
+        std::vector<Alternatives> positions;
+    };
+
+    struct Table
+    {
+        std::vector<uint16_t> classes;
+        std::vector<int32_t> transitions;
+        std::vector<uint64_t> terminal;
+        std::vector<int32_t> outputs;
+        std::vector<int32_t> outputLinks;
+        std::vector<Variant> variants;
+        int classShift;
     };
 
 private:
-    explicit Automaton(size_t size);
+    explicit Automaton(const std::shared_ptr<const Table> &table);
+    static Automaton build(std::vector<Variant> &&variants, size_t alphabetSize);
+    static std::vector<Variant> foldedVariants(int pattern, const QVector<uint> &codePoints,
+                                               CaseFolding folding, bool utf8);
 
 public:
-    static Automaton fromString(const QString &string);
-    bool step(const QChar &current, bool autoReset = false);
+    Automaton();
+
+    static Automaton fromString(const QString &string, CaseFolding folding = CaseFolding::None);
+    static Automaton fromStrings(const QStringList &strings, CaseFolding folding = CaseFolding::None);
+    static Automaton fromUtf8(const QByteArray &bytes, CaseFolding folding = CaseFolding::None);
+    static Automaton fromUtf8(const std::vector<QByteArray> &patterns, CaseFolding folding = CaseFolding::None);
+    static std::vector<uint> caseVariants(uint codePoint);
+    bool step(const QChar &current);
+    bool stepByte(uint8_t current);
     void reset();
     bool isTerminal() const;
+    template <typename Callback> void forEachMatch(Callback callback) const;
+    int pattern(int output) const;
+    size_t matchLength(int output, const char *data, size_t end) const;
+    size_t maxMatchLength() const;
+    size_t stateCount() const;
+    size_t classCount() const;
+
+private:
+    static const size_t maxFoldVariants = 16;
 
 private:
-    int activeStateIdx;
-    std::vector<State> states;
+    std::shared_ptr<const Table> table;
+    const uint16_t *classes;
+    const int32_t *transitions;
+    const uint64_t *terminal;
+    uint32_t classesSize;
+    int classShift;
+    int32_t activeStateIdx;
 };
 
+inline bool Automaton::step(const QChar &current)
+{
+    ushort unit = current.unicode();
+    int32_t cls = unit < classesSize ? classes[unit] : 0;
+    activeStateIdx = transitions[(activeStateIdx << classShift) | cls];
+    return isTerminal();
+}
+
+inline bool Automaton::stepByte(uint8_t current)
+{
+    activeStateIdx = transitions[(activeStateIdx << classShift) | classes[current]];
+    return isTerminal();
+}
+
+inline void Automaton::reset()
+{
+    activeStateIdx = 0;
+}
+
+inline bool Automaton::isTerminal() const
+{
+    return (terminal[activeStateIdx >> 6] >> (activeStateIdx & 63)) & 1;
+}
+
+// Reports every output (see pattern() and matchLength()) ending at the
+// current position, longest first.
+template <typename Callback>
+void Automaton::forEachMatch(Callback callback) const
+{
+    const Table &t = *table;
+    for (int32_t state = activeStateIdx; state != -1; state = t.outputLinks[state]) {
+        if (t.outputs[state] != -1) {
+            callback(t.outputs[state]);
+        }
+    }
+}
+
 #endif // AUTOMATON_H
@@ -0,0 +1,414 @@
+#include <algorithm>
+#include <QtTest>
+
+#include "automatontest.h"
+#include "finder.h"
+#include "referenceautomaton.h"
+#include "scanner.h"
+
+namespace {
+
+const uint seed = 1;
+
+// Few distinct characters, so that patterns overlap and share prefixes.
+const QString plainAlphabet = QStringLiteral("abc");
+// Letters with a simple folding, some of them folding across scripts or
+// across UTF-8 lengths: K KELVIN SIGN, LONG S and E WITH ACUTE.
+const QString foldingAlphabet = QString::fromUtf8("aAkKKsſSéÉb");
+// Letters whose full folding is longer than they are, among the letters
+// they fold to: SHARP S and CAPITAL SHARP S fold to "ss", the ligatures to
+// the letters they join.
+const QString fullFoldingAlphabet = QString::fromUtf8("sSſßẞtfFiIlﬀﬁﬂﬃﬆa");
+// Word characters of one and two bytes, a combining mark, which also
+// continues a word, and separators.
+const QString wordAlphabet = QString::fromUtf8("ab é_-.1\xcc\x81");
+const QString wordPatternAlphabet = QString::fromUtf8("abé");
+
+struct FullFold
+{
+    ushort codePoint;
+    const char *folded;
+};
+
+// The full foldings of fullFoldingAlphabet.
+const FullFold fullFolds[] = {
+    {0x00df, "ss"},
+    {0x1e9e, "ss"},
+    {0xfb00, "ff"},
+    {0xfb01, "fi"},
+    {0xfb02, "fl"},
+    {0xfb03, "ffi"},
+    {0xfb06, "st"},
+};
+
+QString span(int pattern, qint64 begin, qint64 end)
+{
+    return QString("%1:%2-%3").arg(pattern).arg(begin).arg(end);
+}
+
+// The UTF-8 offset of every character of 'text' and of its end.
+std::vector<int> utf8Offsets(const QString &text)
+{
+    std::vector<int> offsets;
+    for (int i = 0; i <= text.size(); i++) {
+        offsets.push_back(text.left(i).toUtf8().size());
+    }
+    return offsets;
+}
+
+bool isWordChar(QChar ch)
+{
+    uint c = ch.unicode();
+    return c == '_' || QChar::isLetterOrNumber(c) || QChar::isMark(c);
+}
+
+}
+
+QString AutomatonTest::randomString(std::mt19937 &rng, const QString &alphabet, int minSize, int maxSize)
+{
+    QString result;
+    int size = minSize + static_cast<int>(rng() % static_cast<uint>(maxSize - minSize + 1));
+    for (int i = 0; i < size; i++) {
+        result += alphabet.at(static_cast<int>(rng() % static_cast<uint>(alphabet.size())));
+    }
+    return result;
+}
+
+QString AutomatonTest::fold(const QString &string)
+{
+    QString result;
+    for (const QChar &ch : string) {
+        result += QChar(static_cast<ushort>(QChar::toCaseFolded(ch.unicode())));
+    }
+    return result;
+}
+
+QStringList AutomatonTest::fold(const QStringList &strings)
+{
+    QStringList result;
+    for (const QString &string : strings) {
+        result << fold(string);
+    }
+    return result;
+}
+
+QStringList AutomatonTest::randomPatterns(std::mt19937 &rng, const QString &alphabet)
+{
+    QStringList patterns;
+    int count = 1 + static_cast<int>(rng() % 4);
+    for (int i = 0; i < count; i++) {
+        patterns << randomString(rng, alphabet, 1, 5);
+    }
+    return patterns;
+}
+
+// Whether some pattern ends with each character of 'text'.
+std::vector<bool> AutomatonTest::expectedEnds(const QStringList &patterns, const QString &text)
+{
+    std::vector<bool> ends(static_cast<size_t>(text.size()), false);
+    for (const QString &pattern : patterns) {
+        ReferenceAutomaton reference = ReferenceAutomaton::fromString(pattern);
+        for (int i = 0; i < text.size(); i++) {
+            reference.step(text.at(i), true);
+            if (reference.isTerminal()) {
+                ends[static_cast<size_t>(i)] = true;
+            }
+        }
+    }
+    return ends;
+}
+
+// Describes the first position where the automaton disagrees, if any.
+QString AutomatonTest::compareUnits(const QStringList &patterns, Automaton::CaseFolding folding, const QString &text)
+{
+    Automaton automaton = Automaton::fromStrings(patterns, folding);
+    bool folded = folding != Automaton::CaseFolding::None;
+    std::vector<bool> ends = expectedEnds(folded ? fold(patterns) : patterns, folded ? fold(text) : text);
+    for (int i = 0; i < text.size(); i++) {
+        if (automaton.step(text.at(i)) != ends[static_cast<size_t>(i)]) {
+            return QString("patterns \"%1\", text \"%2\", position %3").arg(patterns.join("\", \"")).arg(text).arg(i);
+        }
+    }
+    return QString();
+}
+
+// Only the last byte of a character may complete a match.
+QString AutomatonTest::compareBytes(const QStringList &patterns, Automaton::CaseFolding folding, const QString &text)
+{
+    std::vector<QByteArray> encoded;
+    for (const QString &pattern : patterns) {
+        encoded.push_back(pattern.toUtf8());
+    }
+    Automaton automaton = Automaton::fromUtf8(encoded, folding);
+    bool folded = folding != Automaton::CaseFolding::None;
+    std::vector<bool> ends = expectedEnds(folded ? fold(patterns) : patterns, folded ? fold(text) : text);
+    for (int i = 0; i < text.size(); i++) {
+        QByteArray bytes = QString(text.at(i)).toUtf8();
+        for (int b = 0; b < bytes.size(); b++) {
+            bool expected = b == bytes.size() - 1 && ends[static_cast<size_t>(i)];
+            if (automaton.stepByte(static_cast<uint8_t>(bytes.at(b))) != expected) {
+                return QString("patterns \"%1\", text \"%2\", position %3, byte %4")
+                        .arg(patterns.join("\", \"")).arg(text).arg(i).arg(b);
+            }
+        }
+    }
+    return QString();
+}
+
+QString AutomatonTest::fullFold(const QString &string)
+{
+    QString result;
+    for (const QChar &ch : string) {
+        auto full = std::find_if(std::begin(fullFolds), std::end(fullFolds), [&](const FullFold &entry)
+        {
+            return entry.codePoint == ch.unicode();
+        });
+        if (full != std::end(fullFolds)) {
+            result += QLatin1String(full->folded);
+        } else {
+            result += QChar(static_cast<ushort>(QChar::toCaseFolded(ch.unicode())));
+        }
+    }
+    return result;
+}
+
+// One or two patterns of up to three characters, so that no pattern has
+// more spellings than Automaton keeps. Patterns equal to an earlier one,
+// once folded if 'folded', share its output and are drawn again.
+QStringList AutomatonTest::randomDistinctPatterns(std::mt19937 &rng, const QString &alphabet, bool folded)
+{
+    QStringList patterns;
+    int count = 1 + static_cast<int>(rng() % 2);
+    while (patterns.size() < count) {
+        QString pattern = randomString(rng, alphabet, 1, 3);
+        bool repeated = std::any_of(patterns.begin(), patterns.end(), [&](const QString &other)
+        {
+            return folded ? fullFold(other) == fullFold(pattern) : other == pattern;
+        });
+        if (!repeated) {
+            patterns << pattern;
+        }
+    }
+    return patterns;
+}
+
+// Every match of a fully folding automaton, as pattern:begin-end in bytes,
+// with the begin taken from matchLength.
+QStringList AutomatonTest::foldedSpans(const QStringList &patterns, const QString &text)
+{
+    std::vector<QByteArray> encoded;
+    for (const QString &pattern : patterns) {
+        encoded.push_back(pattern.toUtf8());
+    }
+    Automaton automaton = Automaton::fromUtf8(encoded, Automaton::CaseFolding::Full);
+    QByteArray bytes = text.toUtf8();
+    QStringList spans;
+    for (int i = 0; i < bytes.size(); i++) {
+        if (!automaton.stepByte(static_cast<uint8_t>(bytes.at(i)))) {
+            continue;
+        }
+        size_t end = static_cast<size_t>(i) + 1;
+        automaton.forEachMatch([&](int output)
+        {
+            size_t length = automaton.matchLength(output, bytes.constData(), end);
+            spans << span(automaton.pattern(output), static_cast<qint64>(end - length), static_cast<qint64>(end));
+        });
+    }
+    spans.sort();
+    return spans;
+}
+
+// Every run of whole characters of 'text' that folds to what a pattern
+// folds to. A folding is never split, so "s" does not match in "ß".
+QStringList AutomatonTest::expectedFoldedSpans(const QStringList &patterns, const QString &text)
+{
+    std::vector<int> offsets = utf8Offsets(text);
+    QStringList spans;
+    for (int pattern = 0; pattern < patterns.size(); pattern++) {
+        QString folded = fullFold(patterns.at(pattern));
+        for (int end = 1; end <= text.size(); end++) {
+            for (int begin = 0; begin < end; begin++) {
+                if (fullFold(text.mid(begin, end - begin)) == folded) {
+                    spans << span(pattern, offsets[static_cast<size_t>(begin)], offsets[static_cast<size_t>(end)]);
+                }
+            }
+        }
+    }
+    spans.sort();
+    return spans;
+}
+
+// Every whole-word match of a Scanner given all of 'text' at once, as
+// pattern:begin-end in bytes.
+QStringList AutomatonTest::mappedWords(const QStringList &patterns, const QByteArray &text)
+{
+    Finder::Search search = Finder::compileSearch(patterns, Finder::PatternSyntax::Literal, Finder::ScanMode::Mapped,
+                                                  Automaton::CaseFolding::None, true);
+    Scanner scanner("mapped", search, nullptr);
+    scanner.scanMapped(text.constData(), static_cast<size_t>(text.size()), 0, static_cast<size_t>(text.size()));
+    scanner.finish();
+    QStringList spans;
+    for (const Finder::Match &match : scanner.takeMatches()) {
+        spans << span(static_cast<int>(match.pattern), static_cast<qint64>(match.offset),
+                      static_cast<qint64>(match.offset + match.length));
+    }
+    spans.sort();
+    return spans;
+}
+
+// The same through feed(): a match ending at the end of a block waits for
+// the character after it in the next one.
+QStringList AutomatonTest::fedWords(const QStringList &patterns, const std::vector<QByteArray> &blocks)
+{
+    Finder::Search search = Finder::compileSearch(patterns, Finder::PatternSyntax::Literal, Finder::ScanMode::Mapped,
+                                                  Automaton::CaseFolding::None, true);
+    Scanner scanner("fed", search, nullptr);
+    for (const QByteArray &block : blocks) {
+        scanner.feed(block.constData(), static_cast<size_t>(block.size()));
+    }
+    scanner.finish();
+    QStringList spans;
+    for (const Finder::Match &match : scanner.takeMatches()) {
+        spans << span(static_cast<int>(match.pattern), static_cast<qint64>(match.offset),
+                      static_cast<qint64>(match.offset + match.length));
+    }
+    spans.sort();
+    return spans;
+}
+
+// Every occurrence of a pattern with no word character right before or
+// right after it.
+QStringList AutomatonTest::expectedWords(const QStringList &patterns, const QString &text)
+{
+    std::vector<int> offsets = utf8Offsets(text);
+    QStringList spans;
+    for (int pattern = 0; pattern < patterns.size(); pattern++) {
+        const QString &word = patterns.at(pattern);
+        for (int begin = text.indexOf(word); begin != -1; begin = text.indexOf(word, begin + 1)) {
+            int end = begin + word.size();
+            if ((begin == 0 || !isWordChar(text.at(begin - 1))) && (end == text.size() || !isWordChar(text.at(end)))) {
+                spans << span(pattern, offsets[static_cast<size_t>(begin)], offsets[static_cast<size_t>(end)]);
+            }
+        }
+    }
+    spans.sort();
+    return spans;
+}
+
+void AutomatonTest::singlePattern()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QStringList patterns = QStringList() << randomString(rng, plainAlphabet, 1, 6);
+        QString text = randomString(rng, plainAlphabet, 0, maxTextSize);
+        QString mismatch = compareUnits(patterns, Automaton::CaseFolding::None, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void AutomatonTest::multiplePatterns()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QStringList patterns = randomPatterns(rng, plainAlphabet);
+        QString text = randomString(rng, plainAlphabet, 0, maxTextSize);
+        QString mismatch = compareUnits(patterns, Automaton::CaseFolding::None, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void AutomatonTest::utf8()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QStringList patterns = randomPatterns(rng, foldingAlphabet);
+        QString text = randomString(rng, foldingAlphabet, 0, maxTextSize);
+        QString mismatch = compareBytes(patterns, Automaton::CaseFolding::None, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void AutomatonTest::simpleCaseFolding()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QStringList patterns = randomPatterns(rng, foldingAlphabet);
+        QString text = randomString(rng, foldingAlphabet, 0, maxTextSize);
+        QString mismatch = compareUnits(patterns, Automaton::CaseFolding::Simple, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void AutomatonTest::simpleCaseFoldingUtf8()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QStringList patterns = randomPatterns(rng, foldingAlphabet);
+        QString text = randomString(rng, foldingAlphabet, 0, maxTextSize);
+        QString mismatch = compareBytes(patterns, Automaton::CaseFolding::Simple, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void AutomatonTest::fullCaseFoldingSpans()
+{
+    QCOMPARE(foldedSpans(QStringList() << QString::fromUtf8("straße"), "STRASSE"), QStringList() << "0:0-7");
+    QCOMPARE(foldedSpans(QStringList() << "strasse", QString::fromUtf8("xstraße")), QStringList() << "0:1-8");
+    QCOMPARE(foldedSpans(QStringList() << "ss", QString::fromUtf8("ẞ")), QStringList() << "0:0-3");
+    QCOMPARE(foldedSpans(QStringList() << QString::fromUtf8("ß"), "ssS"), QStringList() << "0:0-2" << "0:1-3");
+    QCOMPARE(foldedSpans(QStringList() << QString::fromUtf8("ﬃ"), QString::fromUtf8("oﬀi ofﬁ")),
+             QStringList() << "0:1-5" << "0:7-11");
+    QCOMPARE(foldedSpans(QStringList() << "s", QString::fromUtf8("ß")), QStringList());
+}
+
+void AutomatonTest::fullCaseFolding()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QStringList patterns = randomDistinctPatterns(rng, fullFoldingAlphabet, true);
+        QString text = randomString(rng, fullFoldingAlphabet, 0, maxFoldedTextSize);
+        QStringList spans = foldedSpans(patterns, text);
+        QStringList expected = expectedFoldedSpans(patterns, text);
+        QVERIFY2(spans == expected, qPrintable(QString("patterns \"%1\", text \"%2\": %3, expected %4")
+                                               .arg(patterns.join("\", \""), text, spans.join(' '), expected.join(' '))));
+    }
+}
+
+void AutomatonTest::wholeWordsAtBlockEdges()
+{
+    QStringList patterns = QStringList() << "ab";
+    // A letter, a separator, half of a two-byte letter and a combining mark
+    // right after the edge.
+    QCOMPARE(fedWords(patterns, {"x ab", "c"}), QStringList());
+    QCOMPARE(fedWords(patterns, {"x ab", " c"}), QStringList() << "0:2-4");
+    QCOMPARE(fedWords(patterns, {"x ab", "\xc3", "\xa9"}), QStringList());
+    QCOMPARE(fedWords(patterns, {"x ab", "\xcc\x81"}), QStringList());
+    // The end of the file, and later matches queued behind a held one.
+    QCOMPARE(fedWords(patterns, {"x ab"}), QStringList() << "0:2-4");
+    QCOMPARE(fedWords(patterns, {"ab ab", " ab", "_"}), QStringList() << "0:0-2" << "0:3-5");
+}
+
+void AutomatonTest::wholeWords()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QStringList patterns = randomDistinctPatterns(rng, wordPatternAlphabet, false);
+        QString text = randomString(rng, wordAlphabet, 0, maxTextSize);
+        QByteArray bytes = text.toUtf8();
+        std::vector<QByteArray> blocks;
+        for (int at = 0; at < bytes.size();) {
+            int size = 1 + static_cast<int>(rng() % maxBlockSize);
+            blocks.push_back(bytes.mid(at, size));
+            at += size;
+        }
+
+        QStringList expected = expectedWords(patterns, text);
+        QString context = QString("patterns \"%1\", text \"%2\"").arg(patterns.join("\", \""), text);
+        QStringList mapped = mappedWords(patterns, bytes);
+        QVERIFY2(mapped == expected, qPrintable(context + QString(", mapped: %1, expected %2")
+                                                .arg(mapped.join(' '), expected.join(' '))));
+        QStringList fed = fedWords(patterns, blocks);
+        QVERIFY2(fed == expected, qPrintable(context + QString(", fed: %1, expected %2")
+                                             .arg(fed.join(' '), expected.join(' '))));
+    }
+}
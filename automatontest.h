@@ -0,0 +1,61 @@
+#ifndef AUTOMATONTEST_H
+#define AUTOMATONTEST_H
+
+#include <random>
+#include <vector>
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include "automaton.h"
+
+// Differential tests of the dense Automaton against the map-based
+// ReferenceAutomaton: both are stepped over the same random input and have
+// to agree on every position where a pattern ends. Several patterns are
+// checked against one reference per pattern, byte-driven automata at the
+// last byte of every character, and case-insensitive ones against
+// references built from the folded pattern and fed the folded input.
+// Full folding and whole words are checked against brute force instead:
+// every span of the input whose folding equals a pattern's, and every
+// occurrence with no word character on either side, fed to a Scanner
+// whole and in blocks that cut through matches and characters.
+class AutomatonTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static QString randomString(std::mt19937 &rng, const QString &alphabet, int minSize, int maxSize);
+    static QString fold(const QString &string);
+    static QStringList randomPatterns(std::mt19937 &rng, const QString &alphabet);
+    static std::vector<bool> expectedEnds(const QStringList &patterns, const QString &text);
+    static QStringList fold(const QStringList &strings);
+    static QString compareUnits(const QStringList &patterns, Automaton::CaseFolding folding, const QString &text);
+    static QString compareBytes(const QStringList &patterns, Automaton::CaseFolding folding, const QString &text);
+    static QString fullFold(const QString &string);
+    static QStringList randomDistinctPatterns(std::mt19937 &rng, const QString &alphabet, bool folded);
+    static QStringList foldedSpans(const QStringList &patterns, const QString &text);
+    static QStringList expectedFoldedSpans(const QStringList &patterns, const QString &text);
+    static QStringList mappedWords(const QStringList &patterns, const QByteArray &text);
+    static QStringList fedWords(const QStringList &patterns, const std::vector<QByteArray> &blocks);
+    static QStringList expectedWords(const QStringList &patterns, const QString &text);
+
+private slots:
+    void singlePattern();
+    void multiplePatterns();
+    void utf8();
+    void simpleCaseFolding();
+    void simpleCaseFoldingUtf8();
+    void fullCaseFoldingSpans();
+    void fullCaseFolding();
+    void wholeWordsAtBlockEdges();
+    void wholeWords();
+
+private:
+    static const int iterations = 2000;
+    static const int maxTextSize = 64;
+    static const int maxFoldedTextSize = 16;
+    static const int maxBlockSize = 4;
+};
+
+#endif // AUTOMATONTEST_H
@@ -0,0 +1,573 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <sys/resource.h>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+#include "crawler.h"
+#include "finder.h"
+#include "scanner.h"
+#include "sessionpool.h"
+
+namespace {
+
+// Bump when the generated content changes, so stale corpora are refused.
+const int corpusVersion = 1;
+const int maxCrawlThreadsCount = 8;
+const int readingBlockSize = 64 * 1024;
+const size_t scanningBlockSize = 1024 * 1024;
+const int sessionsCount = 2;
+
+// Filler bytes never contain 'e', 'l' or 'n', so the planted "needle"
+// occurrences are the only ones and match counts are known in advance.
+const char filler[] = "abcdfghijkmopqrstuvwxyz ";
+const char planted[] = "needle";
+
+struct CorpusSpec
+{
+    const char *name;
+    int files;
+    size_t minSize;
+    size_t maxSize;
+    size_t matchEvery;
+    size_t lineLength;
+    bool binary;
+    bool scaleCount;
+};
+
+// 'matchEvery' and 'lineLength' are averages; 0 means no matches or no line
+// breaks. Depending on 'scaleCount' --scale multiplies the number of files
+// or their size.
+const CorpusSpec corpora[] = {
+    {"tiny", 20000, 64, 4096, 2048, 80, false, true},
+    {"huge", 4, 32 << 20, 32 << 20, 256 << 10, 100, false, false},
+    {"deep", 0, 1024, 1024, 512, 80, false, false},
+    {"dense", 16, 4 << 20, 4 << 20, 64, 80, false, true},
+    {"sparse", 16, 4 << 20, 4 << 20, 0, 80, false, true},
+    {"binary", 16, 4 << 20, 4 << 20, 1 << 20, 0, true, true},
+    {"longlines", 4, 8 << 20, 8 << 20, 64 << 10, 0, false, false},
+};
+
+struct Options
+{
+    QString root;
+    uint64_t seed;
+    double scale;
+    int threads;
+    int repeat;
+    QStringList stages;
+    QStringList corpora;
+    QStringList patterns;
+    Finder::PatternSyntax patternSyntax;
+};
+
+struct Result
+{
+    QString corpus;
+    QString stage;
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t matches;
+    double seconds;
+    double firstResultSeconds;
+    long peakRssKb;
+};
+
+typedef std::vector<std::pair<QString, qint64>> FileList;
+
+double secondsSince(std::chrono::steady_clock::time_point started)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+// On Linux the peak RSS can be reset between stages; elsewhere the
+// reported value is the peak of the whole process so far.
+void resetPeakRss()
+{
+    QFile clearRefs("/proc/self/clear_refs");
+    if (clearRefs.open(QIODevice::WriteOnly)) {
+        clearRefs.write("5");
+    }
+}
+
+long peakRssKb()
+{
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly)) {
+        for (const QByteArray &line : status.readAll().split('\n')) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').first().toLong();
+            }
+        }
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+QByteArray generate(std::mt19937_64 &rng, size_t size, size_t matchEvery, size_t lineLength, bool binary)
+{
+    QByteArray data(static_cast<int>(size), Qt::Uninitialized);
+    auto gap = [&rng](size_t average) -> size_t
+    {
+        return average == 0 ? SIZE_MAX : average / 2 + rng() % (average + 1);
+    };
+
+    size_t nextMatch = gap(matchEvery);
+    size_t nextLine = gap(lineLength);
+    uint64_t bits = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (i >= nextMatch && size - i >= sizeof(planted) - 1) {
+            memcpy(data.data() + i, planted, sizeof(planted) - 1);
+            i += sizeof(planted) - 2;
+            nextMatch = i + gap(matchEvery);
+            continue;
+        }
+        if (i >= nextLine) {
+            data[static_cast<int>(i)] = '\n';
+            nextLine = i + gap(lineLength);
+            continue;
+        }
+        if (i % 8 == 0) {
+            bits = rng();
+        }
+        uint8_t byte = static_cast<uint8_t>(bits >> (i % 8 * 8));
+        data[static_cast<int>(i)] = binary ? static_cast<char>(byte) : filler[byte % (sizeof(filler) - 1)];
+    }
+    return data;
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(data) == data.size();
+}
+
+bool generateDeep(const QString &directory, int depth, int &index, uint64_t seed, const CorpusSpec &spec)
+{
+    if (!QDir().mkpath(directory)) {
+        return false;
+    }
+    for (int i = 0; i != 2; i++, index++) {
+        std::seed_seq seq = {seed, static_cast<uint64_t>(&spec - corpora), static_cast<uint64_t>(index)};
+        std::mt19937_64 rng(seq);
+        QByteArray data = generate(rng, spec.minSize, spec.matchEvery, spec.lineLength, spec.binary);
+        if (!writeFile(QString("%1/f%2").arg(directory).arg(i), data)) {
+            return false;
+        }
+    }
+
+    // A bushy top with long narrow chains below it.
+    int children = depth < 5 ? 3 : depth < 20 ? 1 : 0;
+    for (int i = 0; i != children; i++) {
+        if (!generateDeep(QString("%1/d%2").arg(directory).arg(i), depth + 1, index, seed, spec)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool generateCorpus(const QString &directory, const CorpusSpec &spec, const Options &options)
+{
+    if (spec.files == 0) {
+        int index = 0;
+        return generateDeep(directory, 0, index, options.seed, spec);
+    }
+
+    int files = spec.scaleCount ? std::max(1, static_cast<int>(spec.files * options.scale)) : spec.files;
+    double sizeScale = spec.scaleCount ? 1.0 : options.scale;
+    for (int i = 0; i != files; i++) {
+        std::seed_seq seq = {options.seed, static_cast<uint64_t>(&spec - corpora), static_cast<uint64_t>(i)};
+        std::mt19937_64 rng(seq);
+        size_t size = spec.minSize + rng() % (spec.maxSize - spec.minSize + 1);
+        size = std::max<size_t>(1, static_cast<size_t>(size * sizeScale));
+
+        QString subdirectory = QString("%1/%2").arg(directory).arg(i / 200);
+        if ((i % 200 == 0 && !QDir().mkpath(subdirectory))
+                || !writeFile(QString("%1/f%2").arg(subdirectory).arg(i),
+                              generate(rng, size, spec.matchEvery, spec.lineLength, spec.binary))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Generates the corpora once per seed and scale; a manifest written last
+// marks a complete corpus that later runs reuse.
+bool prepareCorpora(const Options &options)
+{
+    QByteArray manifest = QString("{\"version\":%1,\"seed\":%2,\"scale\":%3}\n")
+            .arg(corpusVersion).arg(options.seed).arg(options.scale).toUtf8();
+    QFile manifestFile(options.root + "/corpus.json");
+    if (manifestFile.open(QIODevice::ReadOnly)) {
+        if (manifestFile.readAll() == manifest) {
+            return true;
+        }
+        fprintf(stderr, "qt-finder-bench: %s holds a different corpus, remove it or pick another --corpus\n",
+                options.root.toLocal8Bit().constData());
+        return false;
+    }
+    if (QDir(options.root).exists() && !QDir(options.root).entryList(QDir::AllEntries | QDir::NoDotAndDotDot).isEmpty()) {
+        fprintf(stderr, "qt-finder-bench: %s is not empty and holds no corpus\n", options.root.toLocal8Bit().constData());
+        return false;
+    }
+
+    fprintf(stderr, "generating corpus in %s\n", options.root.toLocal8Bit().constData());
+    for (const CorpusSpec &spec : corpora) {
+        if (!generateCorpus(options.root + '/' + spec.name, spec, options)) {
+            fprintf(stderr, "qt-finder-bench: cannot write corpus %s\n", spec.name);
+            return false;
+        }
+    }
+    return writeFile(options.root + "/corpus.json", manifest);
+}
+
+FileList listFiles(const QString &directory)
+{
+    std::atomic<bool> cancel(false);
+    std::mutex m;
+    FileList files;
+    Crawler crawler(cancel, [&](const QString &filePath, qint64 size, qint64, uint64_t)
+    {
+        std::lock_guard<std::mutex> lg(m);
+        files.emplace_back(filePath, size);
+    });
+    crawler.crawl(directory, maxCrawlThreadsCount);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Runs 'work' for every index below 'count' on 'threads' threads.
+template <typename Work>
+void parallelFor(size_t count, int threads, Work work)
+{
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (int i = 0; i != threads; i++) {
+        pool.emplace_back([&]
+        {
+            for (size_t index; (index = next++) < count;) {
+                work(index);
+            }
+        });
+    }
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+}
+
+void crawlStage(const QString &directory, const Options &options, Result &result)
+{
+    std::atomic<bool> cancel(false);
+    std::atomic<uint64_t> files(0);
+    std::atomic<uint64_t> bytes(0);
+    Crawler crawler(cancel, [&](const QString &, qint64 size, qint64, uint64_t)
+    {
+        files++;
+        bytes += size;
+    });
+
+    auto started = std::chrono::steady_clock::now();
+    crawler.crawl(directory, std::min(options.threads, maxCrawlThreadsCount));
+    result.seconds = secondsSince(started);
+    result.files = files.load();
+    result.bytes = bytes.load();
+}
+
+void readStage(const FileList &files, const Options &options, Result &result)
+{
+    std::atomic<uint64_t> bytes(0);
+    auto started = std::chrono::steady_clock::now();
+    parallelFor(files.size(), options.threads, [&](size_t index)
+    {
+        QFile file(files[index].first);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return;
+        }
+        QByteArray block(readingBlockSize, Qt::Uninitialized);
+        qint64 read;
+        while ((read = file.read(block.data(), block.size())) > 0) {
+            bytes += read;
+        }
+    });
+    result.seconds = secondsSince(started);
+    result.files = files.size();
+    result.bytes = bytes.load();
+}
+
+// Scans file contents loaded beforehand, so only Scanner and the automata
+// are measured.
+void matchStage(const FileList &files, const Options &options, Result &result)
+{
+    std::vector<QByteArray> contents;
+    uint64_t bytes = 0;
+    for (const auto &file : files) {
+        QFile input(file.first);
+        contents.push_back(input.open(QIODevice::ReadOnly) ? input.readAll() : QByteArray());
+        bytes += contents.back().size();
+    }
+
+    Finder::Search search = Finder::compileSearch(options.patterns, options.patternSyntax, Finder::ScanMode::Mapped);
+    std::atomic<uint64_t> matches(0);
+    auto started = std::chrono::steady_clock::now();
+    parallelFor(contents.size(), options.threads, [&](size_t index)
+    {
+        thread_local std::unique_ptr<Regex::Dfa> dfa;
+        if (search.regex && (!dfa || dfa->regex() != search.regex.get())) {
+            dfa.reset(new Regex::Dfa(search.regex));
+        }
+
+        const QByteArray &data = contents[index];
+        Scanner scanner(files[index].first, search, dfa.get());
+        size_t size = data.size();
+        for (size_t from = 0; from < size; from += scanningBlockSize) {
+            scanner.scanMapped(data.constData(), size, from, std::min(size, from + scanningBlockSize));
+            matches += scanner.takeMatches().size();
+        }
+        scanner.finish();
+        matches += scanner.takeMatches().size();
+    });
+    result.seconds = secondsSince(started);
+    result.files = files.size();
+    result.bytes = bytes;
+    result.matches = matches.load();
+}
+
+void endToEndStage(const QString &directory, const Options &options, Result &result)
+{
+    Finder finder;
+    finder.setThreadsCount(options.threads);
+    finder.setPatternSyntax(options.patternSyntax);
+    finder.setPatterns(options.patterns);
+
+    auto started = std::chrono::steady_clock::now();
+    finder.setDirectory(directory);
+    for (;;) {
+        bool finished = finder.getStatus() == 2;
+        Finder::EntryList list = finder.getResult();
+        if (!list.list.empty() && result.matches == 0) {
+            result.firstResultSeconds = secondsSince(started);
+        }
+        result.matches += list.list.size();
+        if (finished && list.list.empty()) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    result.seconds = secondsSince(started);
+
+    Finder::Metrics metrics = finder.getMetrics();
+    result.files = metrics.scannedCount;
+    result.bytes = metrics.scannedSize;
+}
+
+// Runs sessionsCount identical searches at once on one SessionPool; 'bytes'
+// is what the pool actually read, which stays close to the corpus size
+// when the sessions share their reads.
+void sessionsStage(const QString &directory, const Options &options, Result &result)
+{
+    SessionPool pool(options.threads);
+    std::vector<std::shared_ptr<SessionPool::Session>> sessions;
+    auto started = std::chrono::steady_clock::now();
+    for (int i = 0; i != sessionsCount; i++) {
+        sessions.push_back(pool.start(directory, Finder::compileSearch(options.patterns, options.patternSyntax,
+                                                                       Finder::ScanMode::Mapped)));
+    }
+    for (const auto &session : sessions) {
+        for (;;) {
+            bool finished = session->getStatus() != 1;
+            Finder::EntryList list = session->getResult();
+            if (!list.list.empty() && result.firstResultSeconds < 0) {
+                result.firstResultSeconds = secondsSince(started);
+            }
+            result.matches += list.list.size();
+            if (finished && list.list.empty()) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    result.seconds = secondsSince(started);
+    result.files = sessions.front()->getMetrics().scannedCount;
+    result.bytes = pool.readSize();
+}
+
+QByteArray shellQuote(const QString &text)
+{
+    return "'" + text.toLocal8Bit().replace("'", "'\\''") + "'";
+}
+
+void grepStage(const QString &directory, const FileList &files, const Options &options, Result &result)
+{
+    QByteArray command = "LC_ALL=C grep -r -c";
+    command += options.patternSyntax == Finder::PatternSyntax::RegularExpression ? " -E" : " -F";
+    for (const QString &pattern : options.patterns) {
+        command += " -e " + shellQuote(pattern);
+    }
+    command += " -- " + shellQuote(directory) + " > /dev/null";
+
+    auto started = std::chrono::steady_clock::now();
+    int status = std::system(command.constData());
+    result.seconds = secondsSince(started);
+    Q_UNUSED(status);
+
+    rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    result.peakRssKb = usage.ru_maxrss;
+    result.files = files.size();
+    for (const auto &file : files) {
+        result.bytes += file.second;
+    }
+}
+
+Result runStage(const QString &corpus, const QString &stage, const QString &directory,
+                const FileList &files, const Options &options)
+{
+    Result result = {corpus, stage, 0, 0, 0, 0, -1, 0};
+    resetPeakRss();
+    if (stage == "crawl") {
+        crawlStage(directory, options, result);
+    } else if (stage == "read") {
+        readStage(files, options, result);
+    } else if (stage == "match") {
+        matchStage(files, options, result);
+    } else if (stage == "e2e") {
+        endToEndStage(directory, options, result);
+    } else if (stage == "sessions") {
+        sessionsStage(directory, options, result);
+    } else if (stage == "grep") {
+        grepStage(directory, files, options, result);
+    }
+    if (stage != "grep") {
+        result.peakRssKb = peakRssKb();
+    }
+    return result;
+}
+
+void report(const Result &result, const Options &options)
+{
+    double megabytes = result.bytes / (1024.0 * 1024.0);
+    double seconds = std::max(result.seconds, 1e-9);
+    printf("{\"corpus\":\"%s\",\"stage\":\"%s\",\"seed\":%llu,\"scale\":%g,\"threads\":%d,"
+           "\"files\":%llu,\"bytes\":%llu,\"matches\":%llu,\"seconds\":%.6f,\"mbPerSecond\":%.2f,"
+           "\"filesPerSecond\":%.1f,\"firstResultSeconds\":%.6f,\"peakRssKb\":%ld}\n",
+           result.corpus.toUtf8().constData(), result.stage.toUtf8().constData(),
+           static_cast<unsigned long long>(options.seed), options.scale, options.threads,
+           static_cast<unsigned long long>(result.files), static_cast<unsigned long long>(result.bytes),
+           static_cast<unsigned long long>(result.matches), result.seconds, megabytes / seconds,
+           result.files / seconds, result.firstResultSeconds, result.peakRssKb);
+    fflush(stdout);
+
+    fprintf(stderr, "%-10s %-6s %9.3f s %10.1f MB/s %12.0f files/s %10llu matches %8ld KB\n",
+            result.corpus.toUtf8().constData(), result.stage.toUtf8().constData(), result.seconds,
+            megabytes / seconds, result.files / seconds, static_cast<unsigned long long>(result.matches),
+            result.peakRssKb);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qt-finder-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Generates reproducible corpora and measures the search engine stage by stage.\n"
+                                     "Prints one JSON object per corpus and stage to stdout. Every stage runs\n"
+                                     "with a warm page cache and the run with the median time is reported.");
+    parser.addHelpOption();
+
+    QCommandLineOption corpusOption("corpus", "Directory of the generated corpus.", "directory",
+                                    QDir::tempPath() + "/qt-finder-bench");
+    QCommandLineOption seedOption("seed", "Seed of the corpus generator.", "seed", "1");
+    QCommandLineOption scaleOption("scale", "Scale of the corpus, 1 is about 400 MB.", "factor", "1");
+    QCommandLineOption threadsOption(QStringList() << "j" << "threads", "Threads to use, 0 to adapt.", "count",
+                                     QString::number(std::max(1u, std::thread::hardware_concurrency())));
+    QCommandLineOption repeatOption("repeat", "Runs per stage.", "count", "3");
+    QCommandLineOption stagesOption("stages", "Comma separated stages: crawl, read, match, e2e, sessions, grep.", "list",
+                                    "crawl,read,match,e2e");
+    QCommandLineOption corporaOption("corpora", "Comma separated corpora, all by default.", "list");
+    QCommandLineOption patternOption(QStringList() << "e" << "pattern", "Pattern to search for; may be repeated.",
+                                     "pattern");
+    QCommandLineOption regexOption(QStringList() << "E" << "regexp", "Treat patterns as regular expressions.");
+    QCommandLineOption grepOption("grep", "Also time the system grep -r.");
+    parser.addOption(corpusOption);
+    parser.addOption(seedOption);
+    parser.addOption(scaleOption);
+    parser.addOption(threadsOption);
+    parser.addOption(repeatOption);
+    parser.addOption(stagesOption);
+    parser.addOption(corporaOption);
+    parser.addOption(patternOption);
+    parser.addOption(regexOption);
+    parser.addOption(grepOption);
+    parser.process(app);
+
+    Options options;
+    options.root = parser.value(corpusOption);
+    options.seed = parser.value(seedOption).toULongLong();
+    options.scale = parser.value(scaleOption).toDouble();
+    options.threads = parser.value(threadsOption).toInt();
+    options.repeat = std::max(1, parser.value(repeatOption).toInt());
+    options.stages = parser.value(stagesOption).split(',');
+    if (parser.isSet(grepOption) && !options.stages.contains("grep")) {
+        options.stages.append("grep");
+    }
+    options.patterns = parser.isSet(patternOption) ? parser.values(patternOption) : QStringList() << planted;
+    options.patternSyntax = parser.isSet(regexOption) ? Finder::PatternSyntax::RegularExpression
+                                                      : Finder::PatternSyntax::Literal;
+    for (const CorpusSpec &spec : corpora) {
+        options.corpora.append(spec.name);
+    }
+    if (parser.isSet(corporaOption)) {
+        options.corpora = parser.value(corporaOption).split(',');
+    }
+
+    if (options.scale <= 0 || options.threads < 0) {
+        fprintf(stderr, "qt-finder-bench: invalid --scale or --threads\n");
+        return 1;
+    }
+    for (const QString &stage : options.stages) {
+        if (!QStringList({"crawl", "read", "match", "e2e", "sessions", "grep"}).contains(stage)) {
+            fprintf(stderr, "qt-finder-bench: unknown stage %s\n", stage.toLocal8Bit().constData());
+            return 1;
+        }
+    }
+    if (!prepareCorpora(options)) {
+        return 1;
+    }
+
+    for (const QString &corpus : options.corpora) {
+        QString directory = options.root + '/' + corpus;
+        if (!QDir(directory).exists()) {
+            fprintf(stderr, "qt-finder-bench: no corpus %s\n", corpus.toLocal8Bit().constData());
+            return 1;
+        }
+
+        FileList files = listFiles(directory);
+        Options warmUp = options;
+        warmUp.threads = std::max(1, options.threads);
+        Result ignored = runStage(corpus, "read", directory, files, warmUp);
+        Q_UNUSED(ignored);
+
+        for (const QString &stage : options.stages) {
+            std::vector<Result> runs;
+            for (int i = 0; i != options.repeat; i++) {
+                runs.push_back(runStage(corpus, stage, directory, files, stage == "e2e" ? options : warmUp));
+            }
+            std::sort(runs.begin(), runs.end(), [](const Result &a, const Result &b)
+            {
+                return a.seconds < b.seconds;
+            });
+            report(runs[runs.size() / 2], options);
+        }
+    }
+    return 0;
+}
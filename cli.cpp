@@ -0,0 +1,199 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+
+#include "exportsink.h"
+#include "finder.h"
+
+namespace {
+
+// Exit codes follow grep: a match was found, nothing matched, or an error
+// occurred (bad arguments, bad pattern, unwritable output).
+const int exitMatched = 0;
+const int exitNotMatched = 1;
+const int exitError = 2;
+
+const int pollingInterval = 10;
+
+int fail(const QString &message)
+{
+    fprintf(stderr, "qt-finder-cli: %s\n", message.toLocal8Bit().constData());
+    return exitError;
+}
+
+bool parseCount(const QString &value, uint64_t &count)
+{
+    bool ok;
+    count = value.toULongLong(&ok);
+    return ok && count != 0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qt-finder-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Multithreaded search of file contents.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("pattern", "Pattern to search for, unless -e is given.");
+    parser.addPositionalArgument("directory", "Directory to search, the current one by default.", "[directory]");
+
+    QCommandLineOption patternOption(QStringList() << "e" << "pattern", "Search for <pattern>; may be repeated.", "pattern");
+    QCommandLineOption regexOption(QStringList() << "E" << "regexp", "Treat patterns as regular expressions.");
+    QCommandLineOption ignoreCaseOption(QStringList() << "i" << "ignore-case", "Match regardless of case (simple Unicode case folding).");
+    QCommandLineOption fullFoldingOption("full-case-folding", "Match regardless of case, folding ß to ss and the like.");
+    QCommandLineOption wordOption(QStringList() << "w" << "word-regexp", "Report only matches that form whole words.");
+    QCommandLineOption filesOption(QStringList() << "l" << "files-with-matches", "Print only the paths of files with a match.");
+    QCommandLineOption countOption(QStringList() << "c" << "count", "Print only the number of matches per file.");
+    QCommandLineOption maxCountOption(QStringList() << "m" << "max-count", "Stop reading a file after <num> matches.", "num");
+    QCommandLineOption maxTotalOption("max-total", "Stop the search after <num> matches in all.", "num");
+    QCommandLineOption textOption("text", "Decode files as text instead of scanning raw bytes.");
+    QCommandLineOption indexOption("index", "Use and update the trigram index of the directory.");
+    QCommandLineOption threadsOption(QStringList() << "j" << "threads", "Scan with <count> threads, 0 to adapt.", "count");
+    QCommandLineOption orderOption("order", "Scan files in crawl, smallest, largest, inode or physical order.", "order",
+                                   "crawl");
+    QCommandLineOption formatOption("format", "Output format: grep, jsonl or html.", "format", "grep");
+    QCommandLineOption includeOption("include", "Search only files matching <glob>; may be repeated.", "glob");
+    QCommandLineOption excludeOption("exclude", "Skip files and directories matching <glob>; may be repeated.", "glob");
+    QCommandLineOption noIgnoreOption("no-ignore", "Do not honor .gitignore and .ignore files.");
+    QCommandLineOption binaryOption("binary", "Search binary files too.");
+    QCommandLineOption metricsOption("metrics", "Append engine metrics as JSON lines to <file>, - for stderr.", "file");
+    parser.addOption(patternOption);
+    parser.addOption(regexOption);
+    parser.addOption(ignoreCaseOption);
+    parser.addOption(fullFoldingOption);
+    parser.addOption(wordOption);
+    parser.addOption(filesOption);
+    parser.addOption(countOption);
+    parser.addOption(maxCountOption);
+    parser.addOption(maxTotalOption);
+    parser.addOption(textOption);
+    parser.addOption(indexOption);
+    parser.addOption(threadsOption);
+    parser.addOption(orderOption);
+    parser.addOption(formatOption);
+    parser.addOption(includeOption);
+    parser.addOption(excludeOption);
+    parser.addOption(noIgnoreOption);
+    parser.addOption(binaryOption);
+    parser.addOption(metricsOption);
+    parser.process(app);
+
+    QStringList patterns = parser.values(patternOption);
+    QStringList arguments = parser.positionalArguments();
+    if (patterns.isEmpty() && !arguments.isEmpty()) {
+        patterns.append(arguments.takeFirst());
+    }
+    if (patterns.isEmpty() || arguments.size() > 1) {
+        return fail("usage: qt-finder-cli [options] pattern [directory]");
+    }
+
+    QString directory = arguments.isEmpty() ? QString(".") : arguments.first();
+    if (!QDir(directory).exists()) {
+        return fail(directory + ": No such directory");
+    }
+
+    ExportSink::Format format;
+    QString formatName = parser.value(formatOption);
+    if (formatName == "grep") {
+        format = ExportSink::Format::Grep;
+    } else if (formatName == "jsonl") {
+        format = ExportSink::Format::JsonLines;
+    } else if (formatName == "html") {
+        format = ExportSink::Format::Html;
+    } else {
+        return fail("unknown format " + formatName);
+    }
+
+    Finder::ScanOrder scanOrder = Finder::ScanOrder::Crawl;
+    QString orderName = parser.value(orderOption);
+    bool knownOrder = false;
+    for (Finder::ScanOrder order : {Finder::ScanOrder::Crawl, Finder::ScanOrder::SmallestFirst,
+                                    Finder::ScanOrder::LargestFirst, Finder::ScanOrder::Inode,
+                                    Finder::ScanOrder::Physical}) {
+        if (Finder::describe(order) == orderName) {
+            scanOrder = order;
+            knownOrder = true;
+        }
+    }
+    if (!knownOrder) {
+        return fail("unknown order " + orderName);
+    }
+
+    auto sink = std::make_shared<ExportSink>(STDOUT_FILENO, format);
+    if (!sink->isValid()) {
+        return fail(sink->errorString());
+    }
+
+    Finder finder;
+    if (parser.isSet(threadsOption)) {
+        bool ok;
+        int count = parser.value(threadsOption).toInt(&ok);
+        if (!ok || count < 0) {
+            return fail("invalid thread count " + parser.value(threadsOption));
+        }
+        finder.setThreadsCount(count);
+    }
+    finder.setPatternSyntax(parser.isSet(regexOption) ? Finder::PatternSyntax::RegularExpression
+                                                      : Finder::PatternSyntax::Literal);
+    finder.setCaseFolding(parser.isSet(fullFoldingOption) ? Automaton::CaseFolding::Full
+                          : parser.isSet(ignoreCaseOption) ? Automaton::CaseFolding::Simple
+                                                           : Automaton::CaseFolding::None);
+    finder.setWholeWords(parser.isSet(wordOption));
+    finder.setReportMode(parser.isSet(filesOption) ? Finder::ReportMode::FilesWithMatches
+                         : parser.isSet(countOption) ? Finder::ReportMode::Count
+                                                     : Finder::ReportMode::Matches);
+    uint64_t maxCount = 0;
+    if (parser.isSet(maxCountOption) && !parseCount(parser.value(maxCountOption), maxCount)) {
+        return fail("invalid count " + parser.value(maxCountOption));
+    }
+    finder.setMaxCountPerFile(maxCount);
+    uint64_t maxTotal = 0;
+    if (parser.isSet(maxTotalOption) && !parseCount(parser.value(maxTotalOption), maxTotal)) {
+        return fail("invalid count " + parser.value(maxTotalOption));
+    }
+    finder.setMaxCount(maxTotal);
+    finder.setScanOrder(scanOrder);
+    finder.setScanMode(parser.isSet(textOption) ? Finder::ScanMode::Text : Finder::ScanMode::Mapped);
+    finder.setIndexed(parser.isSet(indexOption));
+    finder.setPathFilter(std::make_shared<PathFilter>(parser.values(includeOption), parser.values(excludeOption),
+                                                      !parser.isSet(noIgnoreOption)));
+    finder.setSkippingBinary(!parser.isSet(binaryOption));
+    finder.setMetricsDump(parser.value(metricsOption));
+    finder.setPatterns(patterns);
+    finder.setDirectory(directory);
+    finder.exportResults(sink);
+
+    // Nothing shows the collected results, so keep draining them to bound
+    // the memory they take.
+    while (!sink->isFinished()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(pollingInterval));
+        finder.getResult();
+    }
+
+    QString metricsPath = parser.value(metricsOption);
+    if (!metricsPath.isEmpty()) {
+        QByteArray metrics = Finder::formatMetrics(finder.getMetrics());
+        QFile metricsFile(metricsPath);
+        if (metricsPath == "-") {
+            fprintf(stderr, "%s", metrics.constData());
+        } else if (metricsFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            metricsFile.write(metrics);
+        }
+    }
+
+    if (finder.getStatus() == 4) {
+        return fail("invalid pattern");
+    }
+    if (!sink->isValid()) {
+        return fail(sink->errorString());
+    }
+    return sink->count() != 0 ? exitMatched : exitNotMatched;
+}
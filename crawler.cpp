@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include <QDir>
+#include <QDateTime>
+#include <QFileInfo>
+
+#include "crawler.h"
+
+#ifdef Q_OS_LINUX
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+bool isDotOrDotDot(const char *name)
+{
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+}
+#endif
+
+Crawler::Crawler(const std::atomic<bool> &cancel, const FileCallback &onFile, const DirectoryCallback &onDirectory,
+                 const std::shared_ptr<const PathFilter> &filter)
+    : cancel(cancel)
+    , onFile(onFile)
+    , onDirectory(onDirectory)
+    , filter(filter && !filter->isEmpty() ? filter : nullptr)
+    , uid(0)
+    , busy(0)
+{
+#ifdef Q_OS_LINUX
+    uid = getuid();
+    gids.push_back(getgid());
+    int count = getgroups(0, nullptr);
+    if (count > 0) {
+        std::vector<gid_t> groups(count);
+        count = getgroups(count, groups.data());
+        for (int i = 0; i < count; i++) {
+            gids.push_back(groups[i]);
+        }
+    }
+#endif
+}
+
+bool Crawler::crawl(const QString &directory, int threadsCount)
+{
+    root = QFile::encodeName(QDir(directory).absolutePath());
+    while (root.size() > 1 && root.endsWith('/')) {
+        root.chop(1);
+    }
+
+#ifdef Q_OS_LINUX
+    pending.clear();
+    pending.push_back({root, nullptr});
+    busy = 0;
+
+    std::vector<std::thread> helpers;
+    for (int i = 1; i < threadsCount; i++) {
+        helpers.emplace_back([this]
+        {
+            work();
+        });
+    }
+    work();
+    for (auto &helper : helpers) {
+        helper.join();
+    }
+#else
+    Q_UNUSED(threadsCount);
+
+    std::vector<PendingDirectory> stack;
+    stack.push_back({root, nullptr});
+    while (!stack.empty()) {
+        if (cancel.load()) {
+            return false;
+        }
+
+        PendingDirectory current = std::move(stack.back());
+        stack.pop_back();
+        QString currentPath = QFile::decodeName(current.path);
+        if (onDirectory) {
+            onDirectory(currentPath);
+        }
+
+        auto rules = filter ? filter->enter(current.rules, current.path) : nullptr;
+        QByteArray prefix = current.path.endsWith('/') ? current.path : current.path + '/';
+        QDir::Filters filters = QDir::Dirs | QDir::Files | QDir::Hidden | QDir::NoSymLinks | QDir::NoDotAndDotDot;
+        for (const QFileInfo &entry : QDir(currentPath).entryInfoList(filters)) {
+            if (cancel.load()) {
+                return false;
+            }
+
+            QByteArray name = QFile::encodeName(entry.fileName());
+            QByteArray path = prefix + name;
+            if (entry.isDir()) {
+                if (!filter || filter->acceptsDirectory(rules.get(), root, path, name)) {
+                    stack.push_back({path, rules});
+                }
+            } else if (entry.permission(QFile::ReadUser)
+                       && (!filter || filter->acceptsFile(rules.get(), root, path, name))) {
+                onFile(entry.absoluteFilePath(), entry.size(), entry.lastModified().toMSecsSinceEpoch() * 1000000, 0);
+            }
+        }
+    }
+#endif
+
+    return !cancel.load();
+}
+
+// Where the first extent of a file lies on its device, from FIEMAP; false
+// when the file system does not tell (empty or inline files, delayed
+// allocation, file systems without extents) and on other systems.
+bool Crawler::physicalOffset(const QString &filePath, uint64_t &offset)
+{
+#ifdef Q_OS_LINUX
+    int fd = open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    alignas(struct fiemap) char request[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    std::memset(request, 0, sizeof(request));
+    struct fiemap *map = reinterpret_cast<struct fiemap *>(request);
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    bool found = ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents != 0
+            && (map->fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN) == 0;
+    if (found) {
+        offset = map->fm_extents[0].fe_physical;
+    }
+    close(fd);
+    return found;
+#else
+    Q_UNUSED(filePath);
+    Q_UNUSED(offset);
+    return false;
+#endif
+}
+
+#ifdef Q_OS_LINUX
+void Crawler::work()
+{
+    std::vector<char> buffer(Crawler::direntBufferSize);
+    std::vector<PendingDirectory> subdirectories;
+
+    for (;;) {
+        PendingDirectory directory;
+        {
+            std::unique_lock<std::mutex> lg(m);
+            hasWorkCv.wait(lg, [this]
+            {
+                return !pending.empty() || busy == 0 || cancel.load();
+            });
+
+            if (pending.empty() || cancel.load()) {
+                hasWorkCv.notify_all();
+                return;
+            }
+
+            directory = std::move(pending.back());
+            pending.pop_back();
+            busy++;
+        }
+
+        subdirectories.clear();
+        readDirectory(directory, subdirectories, buffer);
+
+        std::lock_guard<std::mutex> lg(m);
+        busy--;
+        for (PendingDirectory &subdirectory : subdirectories) {
+            pending.push_back(std::move(subdirectory));
+        }
+        if (!subdirectories.empty() || busy == 0) {
+            hasWorkCv.notify_all();
+        }
+    }
+}
+
+void Crawler::readDirectory(const PendingDirectory &directory, std::vector<PendingDirectory> &subdirectories,
+                            std::vector<char> &buffer)
+{
+    const QByteArray &path = directory.path;
+    int fd = openat(AT_FDCWD, path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (onDirectory) {
+        onDirectory(QFile::decodeName(path));
+    }
+
+    auto rules = filter ? filter->enter(directory.rules, path) : nullptr;
+    QByteArray prefix = path == "/" ? path : path + '/';
+    std::vector<std::pair<QByteArray, unsigned char>> files;
+    long read;
+    while (!cancel.load() && (read = syscall(SYS_getdents64, fd, buffer.data(), buffer.size())) > 0) {
+        for (long pos = 0; pos < read;) {
+            const LinuxDirent64 *entry = reinterpret_cast<const LinuxDirent64 *>(buffer.data() + pos);
+            pos += entry->d_reclen;
+
+            if (isDotOrDotDot(entry->d_name)) {
+                continue;
+            }
+            if (entry->d_type == DT_DIR) {
+                QByteArray subdirectory = prefix + entry->d_name;
+                if (!filter || filter->acceptsDirectory(rules.get(), root, subdirectory, entry->d_name)) {
+                    subdirectories.push_back({subdirectory, rules});
+                }
+            } else if (entry->d_type == DT_REG) {
+                if (!filter || filter->acceptsFile(rules.get(), root, prefix + entry->d_name, entry->d_name)) {
+                    files.emplace_back(entry->d_name, entry->d_type);
+                }
+            } else if (entry->d_type == DT_UNKNOWN) {
+                files.emplace_back(entry->d_name, entry->d_type);
+            }
+        }
+    }
+
+    for (const auto &file : files) {
+        if (cancel.load()) {
+            break;
+        }
+        const QByteArray &name = file.first;
+        QByteArray filePath = prefix + name;
+
+#ifdef STATX_BASIC_STATS
+        struct statx st;
+        if (statx(fd, name.constData(), AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                  STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME | STATX_INO, &st) != 0) {
+            continue;
+        }
+        uint32_t mode = st.stx_mode;
+        uint32_t owner = st.stx_uid;
+        uint32_t group = st.stx_gid;
+        qint64 size = st.stx_size;
+        qint64 mtime = st.stx_mtime.tv_sec * 1000000000LL + st.stx_mtime.tv_nsec;
+        uint64_t inode = st.stx_ino;
+#else
+        struct stat st;
+        if (fstatat(fd, name.constData(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        uint32_t mode = st.st_mode;
+        uint32_t owner = st.st_uid;
+        uint32_t group = st.st_gid;
+        qint64 size = st.st_size;
+        qint64 mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        uint64_t inode = st.st_ino;
+#endif
+
+        if (S_ISDIR(mode)) {
+            if (!filter || filter->acceptsDirectory(rules.get(), root, filePath, name)) {
+                subdirectories.push_back({filePath, rules});
+            }
+        } else if (S_ISREG(mode) && isReadable(mode, owner, group)
+                   && (!filter || file.second == DT_REG || filter->acceptsFile(rules.get(), root, filePath, name))) {
+            onFile(QFile::decodeName(filePath), size, mtime, inode);
+        }
+    }
+
+    close(fd);
+}
+
+bool Crawler::isReadable(uint32_t mode, uint32_t owner, uint32_t group) const
+{
+    if (uid == 0) {
+        return true;
+    }
+    if (owner == uid) {
+        return (mode & S_IRUSR) != 0;
+    }
+    if (std::find(gids.begin(), gids.end(), group) != gids.end()) {
+        return (mode & S_IRGRP) != 0;
+    }
+    return (mode & S_IROTH) != 0;
+}
+#endif
@@ -0,0 +1,68 @@
+#ifndef CRAWLER_H
+#define CRAWLER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <QByteArray>
+#include <QString>
+
+#include "pathfilter.h"
+
+// Walks a directory tree and reports every readable regular file together
+// with its size, modification time in nanoseconds and inode number (0 where
+// unknown), and optionally every directory it enters. Hidden entries are
+// included and symbolic links are never followed. On Linux directories are
+// read with raw getdents64 by several threads sharing one stack of pending
+// directories; d_type decides what an entry is, so only regular files (and
+// entries of unknown type) are stat'ed, relative to the descriptor of their
+// directory. Elsewhere the tree is walked with QDir on the calling thread.
+// With a filter, rejected files are not even stat'ed and rejected
+// directories are not descended into.
+class Crawler
+{
+public:
+    typedef std::function<void(const QString &filePath, qint64 size, qint64 mtime, uint64_t inode)> FileCallback;
+    typedef std::function<void(const QString &directoryPath)> DirectoryCallback;
+
+    Crawler(const std::atomic<bool> &cancel, const FileCallback &onFile,
+            const DirectoryCallback &onDirectory = DirectoryCallback(),
+            const std::shared_ptr<const PathFilter> &filter = nullptr);
+
+    bool crawl(const QString &directory, int threadsCount);
+    static bool physicalOffset(const QString &filePath, uint64_t &offset);
+
+private:
+    struct PendingDirectory
+    {
+        QByteArray path;
+        std::shared_ptr<const PathFilter::Rules> rules;
+    };
+
+    void work();
+    void readDirectory(const PendingDirectory &directory, std::vector<PendingDirectory> &subdirectories,
+                       std::vector<char> &buffer);
+    bool isReadable(uint32_t mode, uint32_t owner, uint32_t group) const;
+
+private:
+    static const size_t direntBufferSize = 32 * 1024;
+
+    const std::atomic<bool> &cancel;
+    FileCallback onFile;
+    DirectoryCallback onDirectory;
+    std::shared_ptr<const PathFilter> filter;
+    QByteArray root;
+
+    uint32_t uid;
+    std::vector<uint32_t> gids;
+
+    std::mutex m;
+    std::condition_variable hasWorkCv;
+    std::vector<PendingDirectory> pending;
+    int busy;
+};
+
+#endif // CRAWLER_H
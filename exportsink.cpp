@@ -0,0 +1,311 @@
+#include "exportsink.h"
+
+const size_t ExportSink::maxQueuedMatches;
+
+ExportSink::ExportSink(const QString &filePath, Format format)
+    : ExportSink(format)
+{
+    file.setFileName(filePath);
+    launch(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+}
+
+ExportSink::ExportSink(int fd, Format format)
+    : ExportSink(format)
+{
+    launch(file.open(fd, QIODevice::WriteOnly));
+}
+
+ExportSink::ExportSink(Format format)
+    : outputFormat(format)
+    , reportMode(Finder::ReportMode::Matches)
+    , lastFile(UINT32_MAX)
+    , lastLine(0)
+    , queued(0)
+    , closed(false)
+    , finished(false)
+    , written(0)
+{}
+
+void ExportSink::launch(bool opened)
+{
+    if (!opened) {
+        error = file.errorString();
+        closed = true;
+        finished.store(true);
+        return;
+    }
+
+    writer = std::thread([this]
+    {
+        run();
+    });
+}
+
+ExportSink::~ExportSink()
+{
+    close();
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+bool ExportSink::isValid() const
+{
+    return error.isEmpty();
+}
+
+QString ExportSink::errorString() const
+{
+    return error;
+}
+
+void ExportSink::start(const std::shared_ptr<const PathTable> &paths, Finder::ScanMode scanMode,
+                       Finder::ReportMode reportMode)
+{
+    std::lock_guard<std::mutex> lg(m);
+    this->paths = paths;
+    this->reportMode = reportMode;
+    // Matches are only written after start(), so the writer isn't using
+    // the reader yet; it keeps its open file from one batch to the next.
+    reader.setScanMode(scanMode);
+}
+
+void ExportSink::write(const std::vector<Finder::Match> &matches)
+{
+    if (matches.empty()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lg(m);
+    hasRoomCv.wait(lg, [this]
+    {
+        return closed || queued < ExportSink::maxQueuedMatches;
+    });
+    if (closed) {
+        return;
+    }
+
+    queue.push_back(matches);
+    queued += matches.size();
+    hasWorkCv.notify_one();
+}
+
+void ExportSink::close()
+{
+    std::lock_guard<std::mutex> lg(m);
+    closed = true;
+    hasWorkCv.notify_all();
+    hasRoomCv.notify_all();
+}
+
+bool ExportSink::isFinished() const
+{
+    return finished.load();
+}
+
+uint64_t ExportSink::count() const
+{
+    return written.load();
+}
+
+ExportSink::Format ExportSink::formatFor(const QString &filePath)
+{
+    QString suffix = filePath.mid(filePath.lastIndexOf('.') + 1).toLower();
+    if (suffix == "jsonl" || suffix == "ndjson" || suffix == "json") {
+        return Format::JsonLines;
+    }
+    if (suffix == "html" || suffix == "htm") {
+        return Format::Html;
+    }
+    return Format::Grep;
+}
+
+void ExportSink::run()
+{
+    if (outputFormat == Format::Html) {
+        buffer.append("<pre>");
+    }
+
+    for (;;) {
+        std::vector<Finder::Match> batch;
+        {
+            std::unique_lock<std::mutex> lg(m);
+            hasWorkCv.wait(lg, [this]
+            {
+                return closed || !queue.empty();
+            });
+            if (queue.empty()) {
+                break;
+            }
+
+            batch = std::move(queue.front());
+            queue.pop_front();
+            queued -= batch.size();
+            hasRoomCv.notify_all();
+        }
+
+        for (const Finder::Match &match : batch) {
+            if (!error.isEmpty()) {
+                break;
+            }
+            format(match);
+        }
+        flush(false);
+    }
+
+    if (outputFormat == Format::Html) {
+        if (lastFile != UINT32_MAX) {
+            buffer.append('\n');
+        }
+        buffer.append("</pre>");
+    }
+    flush(true);
+    file.close();
+    finished.store(true);
+}
+
+void ExportSink::format(const Finder::Match &match)
+{
+    bool newFile = match.file != lastFile;
+    if (newFile) {
+        lastPath = paths ? paths->path(match.file) : QString();
+    }
+    if (reportMode != Finder::ReportMode::Matches) {
+        formatFile(match);
+        lastFile = match.file;
+        written++;
+        return;
+    }
+
+    switch (outputFormat) {
+    case Format::Grep:
+        if (!newFile && match.line == lastLine) {
+            break;
+        }
+        buffer.append(lastPath.toUtf8());
+        buffer.append(':');
+        buffer.append(QByteArray::number(static_cast<qulonglong>(match.line)));
+        buffer.append(':');
+        buffer.append(reader.line(lastPath, match));
+        buffer.append('\n');
+        break;
+    case Format::JsonLines: {
+        Finder::Entry entry = reader.read(lastPath, match);
+        buffer.append("{\"path\":");
+        appendJson(buffer, lastPath);
+        buffer.append(",\"line\":");
+        buffer.append(QByteArray::number(static_cast<qulonglong>(match.line)));
+        buffer.append(",\"offset\":");
+        buffer.append(QByteArray::number(static_cast<qulonglong>(match.offset)));
+        buffer.append(",\"pattern\":");
+        buffer.append(QByteArray::number(entry.pattern));
+        buffer.append(",\"before\":");
+        appendJson(buffer, entry.before);
+        buffer.append(",\"match\":");
+        appendJson(buffer, entry.entry);
+        buffer.append(",\"after\":");
+        appendJson(buffer, entry.after);
+        buffer.append("}\n");
+        break;
+    }
+    case Format::Html: {
+        Finder::Entry entry = reader.read(lastPath, match);
+        if (newFile) {
+            if (lastFile != UINT32_MAX) {
+                buffer.append('\n');
+            }
+            buffer.append(QString("<font color=purple>%1</font>\n").arg(lastPath.toHtmlEscaped()).toUtf8());
+        }
+        buffer.append(QString("<font color=gray>%1</font>:\t%2<font color=blue><b>%3</b></font>%4\n")
+                      .arg(entry.line)
+                      .arg(entry.before.toHtmlEscaped())
+                      .arg(entry.entry.toHtmlEscaped())
+                      .arg(entry.after.toHtmlEscaped()).toUtf8());
+        break;
+    }
+    }
+
+    lastFile = match.file;
+    lastLine = match.line;
+    written++;
+}
+
+// One line per file; match.line holds the count in ReportMode::Count.
+void ExportSink::formatFile(const Finder::Match &match)
+{
+    bool counting = reportMode == Finder::ReportMode::Count;
+    QByteArray count = QByteArray::number(static_cast<qulonglong>(match.line));
+    switch (outputFormat) {
+    case Format::Grep:
+        buffer.append(lastPath.toUtf8());
+        if (counting) {
+            buffer.append(':');
+            buffer.append(count);
+        }
+        buffer.append('\n');
+        break;
+    case Format::JsonLines:
+        buffer.append("{\"path\":");
+        appendJson(buffer, lastPath);
+        if (counting) {
+            buffer.append(",\"count\":");
+            buffer.append(count);
+        }
+        buffer.append("}\n");
+        break;
+    case Format::Html:
+        buffer.append(QString("<font color=purple>%1</font>").arg(lastPath.toHtmlEscaped()).toUtf8());
+        if (counting) {
+            buffer.append(":\t" + count);
+        }
+        buffer.append('\n');
+        break;
+    }
+}
+
+void ExportSink::flush(bool force)
+{
+    if (buffer.isEmpty() || (!force && buffer.size() < ExportSink::writeBlockSize)) {
+        return;
+    }
+
+    if (error.isEmpty() && file.write(buffer) != buffer.size()) {
+        error = file.errorString();
+    }
+    buffer.clear();
+}
+
+void ExportSink::appendJson(QByteArray &out, const QString &text)
+{
+    static const char hex[] = "0123456789abcdef";
+    QByteArray bytes = text.toUtf8();
+    out.append('"');
+    for (char c : bytes) {
+        switch (c) {
+        case '"':
+            out.append("\\\"");
+            break;
+        case '\\':
+            out.append("\\\\");
+            break;
+        case '\n':
+            out.append("\\n");
+            break;
+        case '\r':
+            out.append("\\r");
+            break;
+        case '\t':
+            out.append("\\t");
+            break;
+        default:
+            if (static_cast<uchar>(c) < 0x20) {
+                out.append("\\u00");
+                out.append(hex[static_cast<uchar>(c) >> 4]);
+                out.append(hex[c & 0xf]);
+            } else {
+                out.append(c);
+            }
+        }
+    }
+    out.append('"');
+}
@@ -0,0 +1,90 @@
+#ifndef EXPORTSINK_H
+#define EXPORTSINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include "finder.h"
+#include "matchstore.h"
+#include "pathtable.h"
+
+// Writes the matches of one search to a file while the search runs. Finder
+// hands over every batch it publishes; a writer thread reads the text of
+// each match back from its file, formats it and writes the output in large
+// blocks. At most maxQueuedMatches wait for the writer, beyond that write()
+// blocks, so a slow disk slows the scanners down instead of filling memory.
+//
+// Grep prints every matching line once as path:line:text, JSON Lines one
+// object per match with the index of the pattern it matched, Html the
+// layout the GUI always saved. When the search
+// reports files with matches or counts, each format prints one line per
+// file, path or path and count, and no text is read back.
+class ExportSink
+{
+public:
+    enum class Format
+    {
+        Grep,
+        JsonLines,
+        Html
+    };
+
+    ExportSink(const QString &filePath, Format format);
+    ExportSink(int fd, Format format);
+    ~ExportSink();
+
+    bool isValid() const;
+    QString errorString() const;
+    void start(const std::shared_ptr<const PathTable> &paths, Finder::ScanMode scanMode,
+               Finder::ReportMode reportMode = Finder::ReportMode::Matches);
+    void write(const std::vector<Finder::Match> &matches);
+    void close();
+    bool isFinished() const;
+    uint64_t count() const;
+    static Format formatFor(const QString &filePath);
+
+private:
+    explicit ExportSink(Format format);
+    void launch(bool opened);
+    void run();
+    void format(const Finder::Match &match);
+    void formatFile(const Finder::Match &match);
+    void flush(bool force);
+    static void appendJson(QByteArray &out, const QString &text);
+
+private:
+    static const size_t maxQueuedMatches = 64 * 1024;
+    static const int writeBlockSize = 1024 * 1024;
+
+    const Format outputFormat;
+    QFile file;
+    QString error;
+
+    std::shared_ptr<const PathTable> paths;
+    Finder::ReportMode reportMode;
+    ContextReader reader;
+    QByteArray buffer;
+    uint32_t lastFile;
+    QString lastPath;
+    uint64_t lastLine;
+
+    mutable std::mutex m;
+    std::condition_variable hasWorkCv;
+    std::condition_variable hasRoomCv;
+    std::deque<std::vector<Finder::Match>> queue;
+    size_t queued;
+    bool closed;
+    std::atomic<bool> finished;
+    std::atomic<uint64_t> written;
+    std::thread writer;
+};
+
+#endif // EXPORTSINK_H
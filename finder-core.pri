@@ -0,0 +1,16 @@
+# Links a target against the finder-core static library built by
+# finder-core.pro into the same output directory.
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+win32:CONFIG(release, debug|release): FINDER_CORE_DIR = $$OUT_PWD/release
+else:win32:CONFIG(debug, debug|release): FINDER_CORE_DIR = $$OUT_PWD/debug
+else: FINDER_CORE_DIR = $$OUT_PWD
+
+LIBS += -L$$FINDER_CORE_DIR -lfinder-core
+
+include(finder-deps.pri)
+
+win32-msvc*: PRE_TARGETDEPS += $$FINDER_CORE_DIR/finder-core.lib
+else: PRE_TARGETDEPS += $$FINDER_CORE_DIR/libfinder-core.a
@@ -0,0 +1,51 @@
+QT       = core
+
+TARGET = finder-core
+TEMPLATE = lib
+CONFIG += staticlib
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(finder-deps.pri)
+
+SOURCES += \
+    finder.cpp \
+    helpers.cpp \
+    automaton.cpp \
+    referenceautomaton.cpp \
+    scanner.cpp \
+    regex.cpp \
+    crawler.cpp \
+    pooltuner.cpp \
+    trigramindex.cpp \
+    watcher.cpp \
+    pathtable.cpp \
+    matchstore.cpp \
+    exportsink.cpp \
+    histogram.cpp \
+    pathfilter.cpp \
+    readahead.cpp \
+    archive.cpp \
+    sessionpool.cpp
+
+HEADERS += \
+    finder.h \
+    helpers.h \
+    automaton.h \
+    referenceautomaton.h \
+    scanner.h \
+    regex.h \
+    workstealingqueue.h \
+    crawler.h \
+    pooltuner.h \
+    trigramindex.h \
+    watcher.h \
+    spscring.h \
+    pathtable.h \
+    matchstore.h \
+    exportsink.h \
+    histogram.h \
+    pathfilter.h \
+    readahead.h \
+    archive.h \
+    sessionpool.h
@@ -0,0 +1,15 @@
+# Optional libraries finder-core decodes compressed files with; included by
+# finder-core.pro to compile against them and by finder-core.pri to link
+# them into the targets, as the static library doesn't carry them.
+
+CONFIG += link_pkgconfig
+
+packagesExist(zlib) {
+    DEFINES += FINDER_HAVE_ZLIB
+    PKGCONFIG += zlib
+}
+
+packagesExist(libzstd) {
+    DEFINES += FINDER_HAVE_ZSTD
+    PKGCONFIG += libzstd
+}
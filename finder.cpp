@@ -1,17 +1,128 @@
+#include <cstring>
+
+#include "crawler.h"
+#include "exportsink.h"
 #include "finder.h"
+#include "scanner.h"
+
+const int Finder::tuningInterval;
+const int Finder::maxCrawlThreadsCount;
+const qint64 Finder::binaryProbeSize;
+const int Finder::watchLatency;
+const int Finder::maxWatchLatency;
+const int Finder::metricsDumpInterval;
+const size_t Finder::maxQueueDepthSamples;
+
+namespace {
+
+uint64_t elapsedNs(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Locks 'm' and records how long that took; the clock is only read when
+// the lock is contended.
+std::unique_lock<std::mutex> lockTimed(std::mutex &m, Histogram &waits)
+{
+    std::unique_lock<std::mutex> lock(m, std::try_to_lock);
+    if (lock.owns_lock()) {
+        waits.record(0);
+        return lock;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    lock.lock();
+    waits.record(elapsedNs(started));
+    return lock;
+}
+
+void appendHistogram(QByteArray &out, const char *name, const Histogram::Snapshot &histogram)
+{
+    out += QString(",\"%1\":{\"count\":%2,\"mean\":%3,\"p50\":%4,\"p90\":%5,\"p99\":%6}")
+            .arg(name)
+            .arg(histogram.count)
+            .arg(histogram.mean())
+            .arg(histogram.percentile(0.5))
+            .arg(histogram.percentile(0.9))
+            .arg(histogram.percentile(0.99)).toUtf8();
+}
+
+}
 
 Finder::EntryList::EntryList()
     : first(true)
+    , scanMode(ScanMode::Mapped)
 {}
 
 Finder::Params::Params()
     : invalid(true)
     , done(true)
+    , scanMode(ScanMode::Mapped)
+    , patternSyntax(PatternSyntax::Literal)
+    , caseFolding(Automaton::CaseFolding::None)
+    , wholeWords(false)
+    , reportMode(ReportMode::Matches)
+    , scanOrder(ScanOrder::Crawl)
+    , maxCountPerFile(0)
+    , maxCount(0)
+    , indexed(false)
+    , watch(false)
+    , recrawl(false)
+    , filter(std::make_shared<PathFilter>(QStringList(), QStringList(), true))
+    , skipBinary(true)
+    , chunkSize(Finder::defaultChunkSize)
 {}
 
-bool Finder::FileSizeCmp::operator()(const QString &lhs, const QString &rhs)
+Finder::Search::Search()
+    : scanMode(ScanMode::Mapped)
+    , caseFolding(Automaton::CaseFolding::None)
+    , wholeWords(false)
+    , reportMode(ReportMode::Matches)
+    , scanOrder(ScanOrder::Crawl)
+    , maxCountPerFile(0)
+    , maxCount(0)
+    , generation(0)
+    , skipBinary(true)
+    , exportOnly(false)
+    , chunkSize(Finder::defaultChunkSize)
+{}
+
+uint64_t Finder::Search::fileLimit() const
+{
+    return reportMode == ReportMode::FilesWithMatches ? 1 : maxCountPerFile;
+}
+
+Finder::SplitFile::SplitFile(size_t chunkCount)
+    : chunks(chunkCount)
+    , published(0)
+    , lines(0)
+    , count(0)
+    , matched(false)
+{
+    for (Chunk &chunk : chunks) {
+        chunk.done = false;
+        chunk.lines = 0;
+        chunk.count = 0;
+    }
+}
+
+Finder::WorkerStats::WorkerStats()
+    : bytes(0)
+    , busyNs(0)
+    , cpuNs(0)
+{
+    reset();
+}
+
+void Finder::WorkerStats::reset()
 {
-    return QFile(rhs).size() < QFile(lhs).size();
+    readNs.store(0);
+    decodeNs.store(0);
+    matchNs.store(0);
+    idleNs.store(0);
+    taskScanNs.reset();
+    queueLockNs.reset();
+    resultLockNs.reset();
 }
 
 Finder::Finder()
@@ -23,92 +134,332 @@ Finder::Finder()
     , scannedSize(0)
     , totalCount(0)
     , totalSize(0)
+    , binaryCount(0)
+    , cores(std::max<int>(1, std::thread::hardware_concurrency()))
+    , poolCapacity(std::max(4, 2 * cores))
+    , resultGeneration(0)
+    , resultLimit(0)
+    , resultCount(0)
+    , exportGeneration(0)
+    , fileQueue(poolCapacity)
+    , readAhead(Finder::readAheadBlockSize, 4 * poolCapacity, 2 * poolCapacity)
+    , searchGeneration(0)
+    , idleScanners(0)
     , quit(false)
     , cancel(false)
+    , scanCancel(new std::atomic<bool>[poolCapacity])
+    , workerStats(new WorkerStats[poolCapacity + 1])
+    , collectors(new TrigramIndex::Collector[poolCapacity])
+    , activeThreads(cores)
+    , tuner(cores, poolCapacity)
+    , lastTotals({0, 0, 0, 0})
+    , lastSample(std::chrono::steady_clock::now())
+    , crawlNs(0)
+    , lastDump(std::chrono::steady_clock::now())
+    , watching(false)
     , crawlThread([this]
 {
     for (;;) {
         std::unique_lock<std::mutex> paramsLg(paramsM);
         crawlerHasWorkCv.wait(paramsLg, [this]
         {
-            return !params.done || quit;
+            return !params.done || params.exportSink || quit;
         });
+        if (quit) {
+            return;
+        }
+
+        // The setters only wait for this copy; compiling the search and
+        // loading the index run unlocked. A setter called meanwhile cancels
+        // the search and starts another one.
+        Params current = params;
+        bool exportOnly = params.done && current.exportSink;
+        params.done = true;
+        params.recrawl = false;
+        params.sink.reset();
+        params.exportSink.reset();
+        cancel.store(false);
+        paramsLg.unlock();
 
+        // The previous search stops scanning while this one is prepared.
         {
             std::lock_guard<std::mutex> queueLg(queueM);
-            fileQueue = FileQueue();
-            queuedPattern = params.pattern;
-            for (auto &current : scanCancel) {
-                current.store(true);
+            fileQueue.clear();
+            readAhead.clear();
+            searchGeneration++;
+            for (int i = 0; i != poolCapacity; i++) {
+                scanCancel[i].store(true);
             }
         }
 
+        if (current.recrawl || (snapshot && snapshot->directory != current.directory)) {
+            snapshot.reset();
+        }
+        // A snapshot crawled for another order lacks the physical offsets;
+        // the copy that has them is not refined from the previous search.
+        if (snapshot && current.scanOrder == ScanOrder::Physical && !snapshot->located) {
+            snapshot = locate(*snapshot);
+        }
+        std::shared_ptr<Snapshot> crawled;
+        if (!snapshot) {
+            crawled = std::make_shared<Snapshot>();
+            crawled->directory = current.directory;
+            crawled->located = false;
+        }
+
+        auto search = std::make_shared<Search>(compileSearch(current.patterns, current.patternSyntax, current.scanMode,
+                                                             current.caseFolding, current.wholeWords));
+        search->snapshot = snapshot ? snapshot : crawled;
+        search->misses = std::make_shared<Misses>();
+        search->sink = exportOnly ? current.exportSink : current.sink;
+        search->filter = current.filter;
+        search->skipBinary = current.skipBinary;
+        search->chunkSize = current.chunkSize;
+        search->reportMode = current.reportMode;
+        search->scanOrder = current.scanOrder;
+        search->maxCountPerFile = current.maxCountPerFile;
+        search->maxCount = exportOnly ? 0 : current.maxCount;
+        search->exportOnly = exportOnly;
+        bool valid = !current.invalid && (!search->regex || search->regex->isValid());
+        if (valid && current.indexed && current.scanMode == ScanMode::Mapped) {
+            search->index = std::make_shared<TrigramIndex>(current.directory);
+            search->index->load();
+            search->index->select(requiredLiterals(*search));
+        }
+
+        std::shared_ptr<const Search> previous;
         {
+            std::lock_guard<std::mutex> queueLg(queueM);
+            if (quit) {
+                return;
+            }
+            search->generation = ++searchGeneration;
+            if (search->sink) {
+                search->sink->start(search->paths, search->scanMode, search->reportMode);
+            }
+            previous = activeSearch;
+            activeSearch = search;
+            tuner.restart();
+            for (int i = 0; i <= poolCapacity; i++) {
+                workerStats[i].reset();
+            }
+            crawlNs.store(0);
+            queueDepths.clear();
+            watcher.clear();
+            watching.store(current.watch && !current.invalid && watcher.isValid());
+        }
+        if (previous) {
+            closeSink(*previous);
+        }
+
+        // A search repeated for an export leaves the results alone. An export
+        // asked for while the parameters changed follows the new results.
+        if (!exportOnly) {
             std::lock_guard<std::mutex> resultLg(resultM);
             result.first = true;
+            result.removed.clear();
             result.list.clear();
+            result.paths = search->paths;
+            result.scanMode = search->scanMode;
+            resultGeneration = search->generation;
+            resultLimit = search->maxCount;
+            resultCount = 0;
+            if (current.exportSink) {
+                current.exportSink->start(search->paths, search->scanMode, search->reportMode);
+                attachedSink = current.exportSink;
+                exportGeneration.store(search->generation);
+            }
         }
 
-        if (quit) {
-            return;
-        }
-
-        params.done = true;
-        if (params.invalid) {
+        if (current.invalid) {
             statusCode.store(0);
+            closeSink(*search);
+            continue;
+        }
+        if (!valid) {
+            statusCode.store(4);
+            closeSink(*search);
             continue;
         }
 
-        cancel.store(false);
         entryCount.store(0);
         statusCode.store(1);
         scannedCount.store(0);
         scannedSize.store(0);
         totalCount.store(0);
         totalSize.store(0);
+        binaryCount.store(0);
         crawlFinished.store(false);
 
-        QString dir = params.directory;
-        paramsLg.unlock();
+        std::vector<char> ruledOut;
+        if (snapshot && previous && previous->snapshot == snapshot && refines(*search, *previous)) {
+            ruledOut.assign(snapshot->files.size(), 0);
+            std::lock_guard<std::mutex> missesLg(previous->misses->m);
+            for (uint32_t id : previous->misses->files) {
+                ruledOut[id] = 1;
+            }
+        }
 
-        crawl(dir);
+        TrigramIndex *index = search->index.get();
+        auto crawlStarted = std::chrono::steady_clock::now();
+        if (snapshot) {
+            replay(*snapshot, ruledOut, index);
+        } else {
+            crawl(current.directory, index, *crawled);
+            if (crawlFinished.load()) {
+                snapshot = crawled;
+            }
+        }
+        crawlNs.store(elapsedNs(crawlStarted));
 
-        if (crawlFinished.load() && scannedCount.load() == totalCount.load()) {
-            statusCode.store(2);
+        int working = 1;
+        if (crawlFinished.load() && scannedCount.load() == totalCount.load()
+                && statusCode.compare_exchange_strong(working, finishedStatus(*search))) {
+            closeSink(*search);
+        }
+        if (index && crawlFinished.load()) {
+            // The scanners record the trigrams of new files as they read
+            // them, so the index is written once they are done.
+            paramsLg.lock();
+            crawlerHasWorkCv.wait(paramsLg, [this]
+            {
+                return scannedCount.load() == totalCount.load() || cancel.load() || !params.done || quit;
+            });
+            paramsLg.unlock();
+            index->update(cancel);
         }
     }
 })
 {
-    for (int i = 0; i != Finder::scanThreadsCount; i++)
+    for (int i = 0; i <= poolCapacity; i++) {
+        resultRings.emplace_back(new SpscRing<ResultBatch>(Finder::resultRingSize));
+    }
+
+    for (int i = 0; i != poolCapacity; i++)
     {
+        scanCancel[i].store(false);
         scanThreads.emplace_back([this, i]
         {
-            for (;;)
+            scanLoop(i);
+        });
+    }
+
+    tuneThread = std::thread([this]
+    {
+        std::unique_lock<std::mutex> queueLg(queueM);
+        while (!quit) {
+            tunerCv.wait_for(queueLg, std::chrono::milliseconds(Finder::tuningInterval));
+            if (!quit) {
+                tune();
+                dumpMetrics(queueLg);
+            }
+        }
+    });
+
+    watchThread = std::thread([this]
+    {
+        watch();
+    });
+}
+
+void Finder::scanLoop(int worker)
+{
+    std::unique_ptr<Regex::Dfa> dfa;
+    FileTask task;
+    WorkerStats &stats = workerStats[worker];
+    for (;;)
+    {
+        if (worker >= activeThreads.load()) {
+            std::unique_lock<std::mutex> queueLg = lockTimed(queueM, stats.queueLockNs);
+            auto parked = std::chrono::steady_clock::now();
+            poolCv.wait(queueLg, [this, worker]
             {
-                std::unique_lock<std::mutex> queueLg(queueM);
-                scannerHasWorkCv.wait(queueLg, [this]
-                {
-                    return !fileQueue.empty() || quit;
-                });
-
-                if (quit) {
-                    return;
-                }
+                return worker < activeThreads.load() || quit;
+            });
+            stats.idleNs += elapsedNs(parked);
 
-                QString filePath = fileQueue.top();
-                QString pattern = queuedPattern;
-                fileQueue.pop();
-                scanCancel[i].store(false);
-                queueLg.unlock();
+            if (quit) {
+                return;
+            }
+            continue;
+        }
 
-                scan(filePath, pattern, scanCancel[i]);
+        if (!fileQueue.pop(worker, task)) {
+            std::unique_lock<std::mutex> queueLg = lockTimed(queueM, stats.queueLockNs);
+            auto idle = std::chrono::steady_clock::now();
+            idleScanners++;
+            scannerHasWorkCv.wait(queueLg, [this, worker]
+            {
+                return !fileQueue.empty() || worker >= activeThreads.load() || quit;
+            });
+            idleScanners--;
+            stats.idleNs += elapsedNs(idle);
 
-                if (crawlFinished.load() && scannedCount.load() == totalCount.load()) {
-                    statusCode.store(2);
-                }
+            if (quit) {
+                return;
             }
-        });
+            continue;
+        }
+
+        scanCancel[worker].store(false);
+        if (task.search->generation != searchGeneration.load()) {
+            continue;
+        }
+
+        const Search &search = *task.search;
+        if (search.regex && (!dfa || dfa->regex() != search.regex.get())) {
+            dfa.reset(new Regex::Dfa(search.regex));
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        uint64_t cpuStarted = threadCpuTime();
+        qint64 scanned = task.split ? scanChunk(task, dfa.get(), scanCancel[worker], worker)
+                                    : scan(task, dfa.get(), scanCancel[worker], worker);
+        uint64_t busy = elapsedNs(started);
+        stats.bytes += scanned;
+        stats.busyNs += busy;
+        stats.taskScanNs.record(busy);
+        stats.cpuNs += threadCpuTime() - cpuStarted;
+
+        // Stopping or reaching the match limit settles the status first.
+        if (crawlFinished.load() && scannedCount.load() == totalCount.load()) {
+            int working = 1;
+            if (statusCode.compare_exchange_strong(working, finishedStatus(search))) {
+                closeSink(search);
+            }
+            if (search.index) {
+                std::lock_guard<std::mutex> paramsLg(paramsM);
+                crawlerHasWorkCv.notify_all();
+            }
+        }
+    }
+}
+
+Finder::Search Finder::compileSearch(const QStringList &patterns, PatternSyntax patternSyntax, ScanMode scanMode,
+                                     Automaton::CaseFolding caseFolding, bool wholeWords)
+{
+    Search search;
+    std::vector<QByteArray> encoded;
+    search.patterns = patterns;
+    for (const QString &pattern : patterns) {
+        encoded.push_back(pattern.toUtf8());
+    }
+    search.automaton = Automaton::fromUtf8(encoded, caseFolding);
+    search.scanMode = scanMode;
+    search.caseFolding = caseFolding;
+    search.wholeWords = wholeWords;
+    search.paths = std::make_shared<PathTable>();
+
+    if (patternSyntax == PatternSyntax::RegularExpression && !patterns.isEmpty()) {
+        QString source = patterns.first();
+        if (patterns.size() > 1) {
+            source = "(?:" + patterns.join(")|(?:") + ")";
+        }
+        search.regex = std::make_shared<Regex>(source, caseFolding);
+        search.patterns = QStringList() << source;
     }
+
+    return search;
 }
 
 Finder::~Finder()
@@ -116,11 +467,20 @@ Finder::~Finder()
     cancel.store(true);
     {
         std::lock_guard<std::mutex> paramsLg(paramsM);
+        std::lock_guard<std::mutex> queueLg(queueM);
         quit = true;
+        if (activeSearch) {
+            closeSink(*activeSearch);
+        }
         crawlerHasWorkCv.notify_all();
         scannerHasWorkCv.notify_all();
+        poolCv.notify_all();
+        tunerCv.notify_all();
     }
+    watcher.wake();
     crawlThread.join();
+    tuneThread.join();
+    watchThread.join();
     for (size_t i = 0; i != scanThreads.size(); i++)
     {
         scanThreads[i].join();
@@ -131,183 +491,1334 @@ void Finder::setDirectory(const QString &directory)
 {
     std::lock_guard<std::mutex> paramsLg(paramsM);
     params.done = false;
+    params.recrawl = true;
     params.directory = directory;
-    params.invalid = params.directory.isEmpty() || params.pattern.isEmpty();
+    params.invalid = params.directory.isEmpty() || params.patterns.isEmpty();
 
     cancel.store(true);
     crawlerHasWorkCv.notify_all();
 }
 
 void Finder::setPattern(const QString &pattern)
+{
+    setPatterns(QStringList() << pattern);
+}
+
+void Finder::setPatterns(const QStringList &patterns)
 {
     std::lock_guard<std::mutex> paramsLg(paramsM);
     params.done = false;
-    params.pattern = pattern;
-    params.invalid = params.directory.isEmpty() || params.pattern.isEmpty();
+    params.patterns.clear();
+    for (const QString &pattern : patterns) {
+        if (!pattern.isEmpty() && !params.patterns.contains(pattern)) {
+            params.patterns.append(pattern);
+        }
+    }
+    params.invalid = params.directory.isEmpty() || params.patterns.isEmpty();
 
     cancel.store(true);
     crawlerHasWorkCv.notify_all();
 }
 
-void Finder::stop() {
-    std::lock_guard<std::mutex> queueLg(queueM);
+void Finder::setScanMode(ScanMode scanMode)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.scanMode = scanMode;
 
-    statusCode.store(3);
     cancel.store(true);
-    for (size_t i = 0; i < scanCancel.size(); i++) {
-        scanCancel[i].store(true);
-    }
-
-    fileQueue = FileQueue();
+    crawlerHasWorkCv.notify_all();
 }
 
-void Finder::crawl(const QString &directory)
+void Finder::setPatternSyntax(PatternSyntax patternSyntax)
 {
-    QDirIterator dirIt(directory,
-                       QDir::Dirs | QDir::NoSymLinks | QDir::NoDotAndDotDot | QDir::Hidden,
-                       QDirIterator::Subdirectories);
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.patternSyntax = patternSyntax;
 
-    QDir current(directory);
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-    do {
-        if (cancel.load()) {
-            return;
-        }
+void Finder::setIndexed(bool indexed)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.indexed = indexed;
 
-        current.setFilter(QDir::Files | QDir::Hidden | QDir::NoSymLinks);
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-        auto files = current.entryInfoList();
+void Finder::setWatching(bool watch)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.watch = watch;
 
-        for (auto file : files) {
-            if (cancel.load()) {
-                return;
-            }
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-            if (!file.permission(QFile::ReadUser)) {
-                continue;
-            }
+void Finder::setPathFilter(const std::shared_ptr<const PathFilter> &filter)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.recrawl = true;
+    params.filter = filter;
 
-            enqueFileToScan(file.absoluteFilePath());
-        }
-    } while (dirIt.hasNext() && (current = QDir(dirIt.next())).exists());
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-    crawlFinished.store(true);
+void Finder::setSkippingBinary(bool skip)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.skipBinary = skip;
+
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
 }
 
-void Finder::enqueFileToScan(const QString &filePath)
+// Mostly for tests, which need files of several chunks without writing
+// tens of megabytes.
+void Finder::setChunkSize(qint64 size)
 {
-    std::lock_guard<std::mutex> queueLg(queueM);
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.chunkSize = size > 0 ? size : Finder::defaultChunkSize;
 
-    totalCount++;
-    totalSize += QFile(filePath).size();
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
+
+void Finder::setCaseFolding(Automaton::CaseFolding caseFolding)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.caseFolding = caseFolding;
 
-    fileQueue.push(filePath);
-    scannerHasWorkCv.notify_one();
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
 }
 
+void Finder::setWholeWords(bool wholeWords)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.wholeWords = wholeWords;
+
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-void Finder::scan(const QString &filePath, const QString &pattern, std::atomic<bool> &cancel)
+void Finder::setReportMode(ReportMode reportMode)
 {
-    QFile fileObj(filePath);
-    if (!fileObj.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        return;
-    }
-    QTextStream in(&fileObj);
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.reportMode = reportMode;
 
-    Automaton a = Automaton::fromString(pattern);
-    std::deque<QChar> que;
-    std::deque<Entry> resultQueue;
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-    uint64_t lineNo = 1;
+void Finder::setScanOrder(ScanOrder scanOrder)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.scanOrder = scanOrder;
 
-    while (!in.atEnd()) {
-        if (cancel.load()) {
-            break;
-        }
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-        QString block(in.read(Finder::readingBlockSize));
-        for (QChar &ch : block) {
-            if (cancel.load()) {
-                break;
-            }
+void Finder::setMaxCountPerFile(uint64_t count)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.maxCountPerFile = count;
 
-            que.push_back(ch);
-            a.step(ch, true);
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-            {
-                std::lock_guard<std::mutex> resultLg(resultM);
-                while (!resultQueue.empty() && (resultQueue.front().after.size() == Entry::maxAfterChars || isUnsupportedChar(ch) || isLineSeperator(ch))) {
-                    result.list.push_back(resultQueue.front());
-                    resultQueue.pop_front();
-                }
-            }
+void Finder::setMaxCount(uint64_t count)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.maxCount = count;
 
-            if (isLineSeperator(ch)) {
-                lineNo++;
-            }
+    cancel.store(true);
+    crawlerHasWorkCv.notify_all();
+}
 
-            if (isUnsupportedChar(ch) || isLineSeperator(ch)) {
-                que.clear();
-                continue;
-            }
+void Finder::setThreadsCount(int count)
+{
+    std::lock_guard<std::mutex> queueLg(queueM);
+    tuner.configure(count);
+    resizePool(tuner.threadsCount());
+}
 
-            for (Entry &entry : resultQueue) {
-                entry.after.append(ch);
-            }
+void Finder::exportResults(const std::shared_ptr<ExportSink> &sink)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    params.done = false;
+    params.sink = sink;
+    cancel.store(true);
 
-            if (a.isTerminal()) {
-                QString before;
-                for (size_t i = 0; i < que.size() - pattern.size(); i++) {
-                    before.append(que[i]);
-                }
-                resultQueue.push_back({lineNo, filePath, before, pattern, ""});
-            }
+    crawlerHasWorkCv.notify_one();
+}
 
-            if (que.size() == Entry::maxBeforeSize + pattern.size()) {
-                que.pop_front();
-            }
-        }
+// Saves the results shown, 'reported' as fetched by getResult(), without
+// restarting the search. A running search goes on feeding the export and
+// ignores the match limit until it settles; one stopped at the limit is
+// scanned again for the export alone.
+void Finder::exportResults(const std::shared_ptr<ExportSink> &sink, const EntryList &reported)
+{
+    std::lock_guard<std::mutex> paramsLg(paramsM);
+    std::lock_guard<std::mutex> queueLg(queueM);
+    bool shown = activeSearch && !activeSearch->exportOnly && reported.paths == activeSearch->paths;
+    int status = statusCode.load();
+    if (!params.done || (shown && status == 6)) {
+        params.exportSink = sink;
+        cancel.store(true);
+        crawlerHasWorkCv.notify_one();
+        return;
     }
 
-    {
-        std::lock_guard<std::mutex> resultLg(resultM);
-        while (!resultQueue.empty()) {
-            result.list.push_back(resultQueue.front());
-            resultQueue.pop_front();
-        }
+    std::lock_guard<std::mutex> resultLg(resultM);
+    drainResults();
+    sink->start(reported.paths, reported.scanMode,
+                activeSearch ? activeSearch->reportMode : ReportMode::Matches);
+    sink->write(reported.list);
+    if (result.paths == reported.paths) {
+        sink->write(result.list);
     }
-
-    if (cancel.load()) {
+    if (shown && status == 1 && resultGeneration == activeSearch->generation) {
+        attachedSink = sink;
+        exportGeneration.store(activeSearch->generation);
         return;
     }
-
-    scannedCount++;
-    scannedSize += QFile(filePath).size();
+    sink->close();
 }
 
-Finder::EntryList Finder::getResult()
+void Finder::setMetricsDump(const QString &filePath)
 {
-    std::unique_lock<std::mutex> resultLg(resultM, std::try_to_lock);
-    if (!resultLg.owns_lock()) {
-        EntryList tmp;
-        tmp.first = false;
-        return tmp;
-    }
-
-    EntryList tmp(std::move(result));
-    result.first = false;
-    result.list.clear();
-    return tmp;
+    std::lock_guard<std::mutex> queueLg(queueM);
+    metricsDumpPath = filePath;
 }
 
-int Finder::getStatus() const
-{
+void Finder::stop() {
+    std::lock_guard<std::mutex> queueLg(queueM);
+
+    statusCode.store(3);
+    if (activeSearch) {
+        closeSink(*activeSearch);
+    }
+    cancel.store(true);
+    searchGeneration++;
+    for (int i = 0; i != poolCapacity; i++) {
+        scanCancel[i].store(true);
+    }
+
+    fileQueue.clear();
+    readAhead.clear();
+}
+
+std::vector<std::string> Finder::requiredLiterals(const Search &search)
+{
+    if (search.regex) {
+        return search.regex->requiredLiterals();
+    }
+
+    // The trigram index is case sensitive, folded literals can't narrow it.
+    std::vector<std::string> literals;
+    if (search.caseFolding != Automaton::CaseFolding::None) {
+        return literals;
+    }
+    for (const QString &pattern : search.patterns) {
+        QByteArray encoded = pattern.toUtf8();
+        literals.emplace_back(encoded.constData(), encoded.size());
+    }
+    return literals;
+}
+
+bool Finder::refines(const Search &search, const Search &previous)
+{
+    if (search.regex || previous.regex || search.scanMode != previous.scanMode || previous.patterns.isEmpty()) {
+        return false;
+    }
+    // A longer whole word does not contain a shorter one as a whole word.
+    if (search.caseFolding != previous.caseFolding || search.caseFolding == Automaton::CaseFolding::Full
+            || search.wholeWords || previous.wholeWords) {
+        return false;
+    }
+
+    Qt::CaseSensitivity sensitivity = search.caseFolding == Automaton::CaseFolding::None ? Qt::CaseSensitive
+                                                                                          : Qt::CaseInsensitive;
+    for (const QString &pattern : search.patterns) {
+        bool contained = false;
+        for (const QString &previousPattern : previous.patterns) {
+            contained = contained || pattern.contains(previousPattern, sensitivity);
+        }
+        if (!contained) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Finder::crawl(const QString &directory, TrigramIndex *index, Snapshot &snapshot)
+{
+    int threadsCount = std::min<int>(std::thread::hardware_concurrency(), Finder::maxCrawlThreadsCount);
+    std::mutex snapshotM;
+    bool located = activeSearch->scanOrder == ScanOrder::Physical;
+    snapshot.located = located;
+
+    Crawler crawler(cancel, [&](const QString &filePath, qint64 size, qint64 mtime, uint64_t inode)
+    {
+        Snapshot::File file = {filePath, size, mtime, inode, 0};
+        if (located) {
+            Crawler::physicalOffset(filePath, file.physical);
+        }
+        int64_t id;
+        {
+            std::lock_guard<std::mutex> snapshotLg(snapshotM);
+            id = static_cast<int64_t>(snapshot.files.size());
+            snapshot.files.push_back(file);
+        }
+        offer(file, id, index, false);
+    }, [&](const QString &directoryPath)
+    {
+        if (watching.load()) {
+            watcher.addDirectory(directoryPath);
+        }
+        std::lock_guard<std::mutex> snapshotLg(snapshotM);
+        snapshot.directories.append(directoryPath);
+    }, activeSearch->filter);
+
+    if (crawler.crawl(directory, std::max(threadsCount, 1))) {
+        crawlFinished.store(true);
+    }
+}
+
+void Finder::replay(const Snapshot &snapshot, const std::vector<char> &ruledOut, TrigramIndex *index)
+{
+    if (watching.load()) {
+        for (const QString &directoryPath : snapshot.directories) {
+            watcher.addDirectory(directoryPath);
+        }
+    }
+
+    for (size_t id = 0; id != snapshot.files.size(); id++) {
+        if (cancel.load()) {
+            return;
+        }
+        offer(snapshot.files[id], static_cast<int64_t>(id), index, !ruledOut.empty() && ruledOut[id]);
+    }
+    crawlFinished.store(true);
+}
+
+// Copies the snapshot with the physical offsets of its files looked up; a
+// cancelled copy is left unlocated.
+std::shared_ptr<const Snapshot> Finder::locate(const Snapshot &snapshot)
+{
+    auto located = std::make_shared<Snapshot>(snapshot);
+    for (Snapshot::File &file : located->files) {
+        if (cancel.load()) {
+            return located;
+        }
+        Crawler::physicalOffset(file.path, file.physical);
+    }
+    located->located = true;
+    return located;
+}
+
+void Finder::offer(const Snapshot::File &file, int64_t id, TrigramIndex *index, bool ruledOut)
+{
+    int64_t indexSlot = -1;
+    bool candidate = index == nullptr || index->isCandidate(file.path, file.size, file.mtime, indexSlot);
+    if (candidate && !ruledOut) {
+        enqueFileToScan(file, id, indexSlot);
+        return;
+    }
+
+    totalCount++;
+    totalSize += file.size;
+    scannedCount++;
+    scannedSize += file.size;
+    recordMiss(*activeSearch, id);
+}
+
+// Hands the index the trigrams of a file the scan read whole; any other is
+// read again when the index is updated.
+void Finder::recordTrigrams(const FileTask &task, TrigramIndex::Collector *collector)
+{
+    if (collector != nullptr && collector->size() == task.size) {
+        task.search->index->record(task.indexSlot, collector->take());
+    }
+}
+
+void Finder::recordMiss(const Search &search, int64_t id)
+{
+    if (id < 0 || !search.misses) {
+        return;
+    }
+    std::lock_guard<std::mutex> missesLg(search.misses->m);
+    search.misses->files.push_back(static_cast<uint32_t>(id));
+}
+
+// Lower keys are scanned first.
+uint64_t Finder::scanKey(ScanOrder scanOrder, const Snapshot::File &file)
+{
+    uint64_t size = static_cast<uint64_t>(file.size);
+    switch (scanOrder) {
+    case ScanOrder::Crawl:
+        return 0;
+    case ScanOrder::SmallestFirst:
+        return size;
+    case ScanOrder::LargestFirst:
+        return UINT64_MAX - size;
+    case ScanOrder::Inode:
+        return file.inode;
+    case ScanOrder::Physical:
+        // Files without a known extent come first, in crawl order.
+        return file.physical;
+    }
+    return 0;
+}
+
+void Finder::enqueFileToScan(const Snapshot::File &file, int64_t id, int64_t indexSlot)
+{
+    const QString &filePath = file.path;
+    qint64 size = file.size;
+    totalCount++;
+    totalSize += size;
+
+    uint64_t key = scanKey(activeSearch->scanOrder, file);
+    size_t workers = static_cast<size_t>(activeThreads.load());
+    qint64 chunkSize = activeSearch->chunkSize;
+    // A compressed file can only be decoded from its start.
+    if (activeSearch->scanMode == ScanMode::Mapped && size >= 2 * chunkSize && !Decompressor::isArchive(filePath)) {
+        size_t chunkCount = static_cast<size_t>((size + chunkSize - 1) / chunkSize);
+        auto split = std::make_shared<SplitFile>(chunkCount);
+        for (size_t i = 0; i != chunkCount; i++) {
+            fileQueue.push({filePath, size, activeSearch, split, i, id, -1}, workers, key);
+        }
+    } else {
+        // Announced before it is queued, so a scanner can't open it first.
+        // Reads run ahead in queueing order, which only the crawl order
+        // keeps.
+        if (activeSearch->scanMode == ScanMode::Mapped && activeSearch->scanOrder == ScanOrder::Crawl) {
+            readAhead.prefetch(filePath, size);
+        }
+        fileQueue.push({filePath, size, activeSearch, nullptr, 0, id, indexSlot}, workers, key);
+    }
+    if (idleScanners.load() != 0) {
+        std::unique_lock<std::mutex> queueLg = lockTimed(queueM, workerStats[poolCapacity].queueLockNs);
+        scannerHasWorkCv.notify_one();
+    }
+}
+
+
+qint64 Finder::scan(const FileTask &task, Regex::Dfa *dfa, std::atomic<bool> &cancel, int producer)
+{
+    const Search &search = *task.search;
+    bool text = search.scanMode == ScanMode::Text;
+    ReadAhead::Stream stream = text ? ReadAhead::Stream() : readAhead.open(task.path);
+    if (stream.isOpen()) {
+        return scanStream(task, stream, dfa, cancel, producer);
+    }
+
+    // A file that went away since the crawl still counts as scanned, or the
+    // search would never finish.
+    QFile fileObj(task.path);
+    if (!fileObj.open(text ? QIODevice::ReadOnly | QIODevice::Text : QIODevice::ReadOnly)) {
+        recordMiss(search, task.file);
+        scannedCount++;
+        return 0;
+    }
+
+    Scanner scanner(task.path, search, dfa);
+    WorkerStats &stats = workerStats[producer];
+    qint64 size = fileObj.size();
+    uchar *mapped = nullptr;
+    if (!text && !fileObj.isSequential() && size >= Finder::mappingThreshold) {
+        mapped = fileObj.map(0, size);
+    }
+
+    if (!text) {
+        QByteArray head = mapped != nullptr ? QByteArray() : fileObj.peek(TarReader::blockSize);
+        const char *probe = mapped != nullptr ? reinterpret_cast<const char *>(mapped) : head.constData();
+        Decompressor::Format format;
+        if (Decompressor::isArchive(probe, mapped != nullptr ? size : head.size(), format)) {
+            qint64 from = 0;
+            QByteArray block;
+            qint64 scanned = scanArchive(task, format, [&](const char **data, size_t *blockSize)
+            {
+                if (mapped != nullptr) {
+                    *data = reinterpret_cast<const char *>(mapped) + from;
+                    *blockSize = static_cast<size_t>(std::min(size - from, Finder::mappedBlockSize));
+                    from += *blockSize;
+                    return *blockSize != 0;
+                }
+                block = fileObj.read(Finder::bufferedBlockSize);
+                *data = block.constData();
+                *blockSize = static_cast<size_t>(block.size());
+                return !block.isEmpty();
+            }, dfa, cancel, producer);
+            if (mapped != nullptr) {
+                fileObj.unmap(mapped);
+            }
+            return scanned;
+        }
+    }
+
+    if (search.skipBinary) {
+        bool binary;
+        if (mapped != nullptr) {
+            binary = isBinary(reinterpret_cast<const char *>(mapped), size);
+        } else {
+            QByteArray head = fileObj.peek(Finder::binaryProbeSize);
+            binary = isBinary(head.constData(), head.size());
+        }
+        if (binary) {
+            if (mapped != nullptr) {
+                fileObj.unmap(mapped);
+            }
+            binaryCount++;
+            recordMiss(search, task.file);
+            scannedCount++;
+            scannedSize += size;
+            return size;
+        }
+    }
+
+    TrigramIndex::Collector *collector = task.indexSlot >= 0 ? &collectors[producer] : nullptr;
+    if (collector != nullptr) {
+        collector->clear();
+    }
+
+    if (text) {
+        QTextStream in(&fileObj);
+        while (!in.atEnd() && !cancel.load() && !scanner.isFull()) {
+            auto decoding = std::chrono::steady_clock::now();
+            QByteArray block = in.read(Finder::readingBlockSize).toUtf8();
+            stats.decodeNs += elapsedNs(decoding);
+            auto matching = std::chrono::steady_clock::now();
+            scanner.feed(block.constData(), block.size());
+            stats.matchNs += elapsedNs(matching);
+            publish(producer, search, scanner.takeMatches());
+        }
+    } else if (mapped != nullptr) {
+        const char *data = reinterpret_cast<const char *>(mapped);
+        for (qint64 from = 0; from < size && !cancel.load() && !scanner.isFull(); from += Finder::mappedBlockSize) {
+            auto matching = std::chrono::steady_clock::now();
+            scanner.scanMapped(data, size, from, std::min(size, from + Finder::mappedBlockSize));
+            stats.matchNs += elapsedNs(matching);
+            if (collector != nullptr) {
+                collector->add(data + from, static_cast<size_t>(std::min(size - from, Finder::mappedBlockSize)));
+            }
+            publish(producer, search, scanner.takeMatches());
+        }
+    } else {
+        QByteArray block(Finder::bufferedBlockSize, Qt::Uninitialized);
+        qint64 read;
+        for (;;) {
+            auto reading = std::chrono::steady_clock::now();
+            if (cancel.load() || scanner.isFull() || (read = fileObj.read(block.data(), block.size())) <= 0) {
+                break;
+            }
+            stats.readNs += elapsedNs(reading);
+            auto matching = std::chrono::steady_clock::now();
+            scanner.feed(block.constData(), read);
+            stats.matchNs += elapsedNs(matching);
+            if (collector != nullptr) {
+                collector->add(block.constData(), static_cast<size_t>(read));
+            }
+            publish(producer, search, scanner.takeMatches());
+        }
+    }
+
+    if (!cancel.load()) {
+        scanner.finish();
+        publish(producer, search, scanner.takeMatches());
+    }
+
+    if (mapped != nullptr) {
+        fileObj.unmap(mapped);
+    }
+
+    if (cancel.load()) {
+        return 0;
+    }
+
+    recordTrigrams(task, collector);
+    if (scanner.matchCount() == 0) {
+        recordMiss(search, task.file);
+    }
+    scannedCount++;
+    scannedSize += size;
+    return size;
+}
+
+// Scans a file the read-ahead stage delivers block by block; waiting for a
+// block counts as reading.
+qint64 Finder::scanStream(const FileTask &task, ReadAhead::Stream &stream, Regex::Dfa *dfa, std::atomic<bool> &cancel,
+                          int producer)
+{
+    const Search &search = *task.search;
+    Scanner scanner(task.path, search, dfa);
+    WorkerStats &stats = workerStats[producer];
+    TrigramIndex::Collector *collector = task.indexSlot >= 0 ? &collectors[producer] : nullptr;
+    if (collector != nullptr) {
+        collector->clear();
+    }
+    qint64 size = 0;
+    const char *block;
+    size_t blockSize;
+    for (;;) {
+        auto reading = std::chrono::steady_clock::now();
+        if (cancel.load() || scanner.isFull() || !stream.next(&block, &blockSize)) {
+            break;
+        }
+        stats.readNs += elapsedNs(reading);
+
+        Decompressor::Format format;
+        if (size == 0 && Decompressor::isArchive(block, blockSize, format)) {
+            bool replayed = false;
+            return scanArchive(task, format, [&](const char **data, size_t *dataSize)
+            {
+                if (replayed) {
+                    return stream.next(data, dataSize);
+                }
+                replayed = true;
+                *data = block;
+                *dataSize = blockSize;
+                return true;
+            }, dfa, cancel, producer);
+        }
+        if (size == 0 && search.skipBinary && isBinary(block, static_cast<qint64>(blockSize))) {
+            binaryCount++;
+            recordMiss(search, task.file);
+            scannedCount++;
+            scannedSize += task.size;
+            return task.size;
+        }
+        size += blockSize;
+
+        auto matching = std::chrono::steady_clock::now();
+        scanner.feed(block, blockSize);
+        stats.matchNs += elapsedNs(matching);
+        if (collector != nullptr) {
+            collector->add(block, blockSize);
+        }
+        publish(producer, search, scanner.takeMatches());
+    }
+
+    if (cancel.load()) {
+        return 0;
+    }
+    scanner.finish();
+    publish(producer, search, scanner.takeMatches());
+
+    recordTrigrams(task, collector);
+    if (scanner.matchCount() == 0) {
+        recordMiss(search, task.file);
+    }
+    scannedCount++;
+    scannedSize += size;
+    return size;
+}
+
+// Scans what a compressed file decodes to, or the members of a tar archive
+// (compressed or not) as files of their own, named "archive/member". The
+// decoder runs on a thread of its own and waiting for it counts as
+// decoding.
+qint64 Finder::scanArchive(const FileTask &task, Decompressor::Format format, const Decompressor::Source &source,
+                           Regex::Dfa *dfa, std::atomic<bool> &cancel, int producer)
+{
+    const Search &search = *task.search;
+    WorkerStats &stats = workerStats[producer];
+    std::unique_ptr<DecompressedStream> decoder;
+    if (format != Decompressor::Format::Plain) {
+        decoder.reset(new DecompressedStream(format, source));
+    }
+
+    std::unique_ptr<Scanner> scanner;
+    bool probing = false;
+    bool binary = false;
+    uint64_t matchCount = 0;
+    auto startFile = [&](const QString &filePath)
+    {
+        scanner.reset(new Scanner(filePath, search, dfa));
+        probing = search.skipBinary;
+        binary = false;
+    };
+    auto finishFile = [&]()
+    {
+        if (scanner && !binary && !cancel.load()) {
+            scanner->finish();
+            publish(producer, search, scanner->takeMatches());
+            matchCount += scanner->matchCount();
+        }
+        scanner.reset();
+    };
+    auto feed = [&](const char *data, size_t size)
+    {
+        if (!scanner || binary || size == 0 || scanner->isFull()) {
+            return;
+        }
+        if (probing) {
+            probing = false;
+            binary = isBinary(data, static_cast<qint64>(size));
+            if (binary) {
+                binaryCount++;
+                return;
+            }
+        }
+        auto matching = std::chrono::steady_clock::now();
+        scanner->feed(data, size);
+        stats.matchNs += elapsedNs(matching);
+        publish(producer, search, scanner->takeMatches());
+    };
+
+    TarReader tar([&](const QByteArray &member)
+    {
+        finishFile();
+        startFile(task.path + '/' + QFile::decodeName(member));
+    }, feed, finishFile);
+
+    QByteArray decoded;
+    const char *block;
+    size_t blockSize;
+    bool archive = false;
+    for (bool first = true; !cancel.load(); first = false) {
+        auto decoding = std::chrono::steady_clock::now();
+        if (decoder) {
+            if (!decoder->next(decoded)) {
+                break;
+            }
+            block = decoded.constData();
+            blockSize = static_cast<size_t>(decoded.size());
+            stats.decodeNs += elapsedNs(decoding);
+        } else {
+            if (!source(&block, &blockSize)) {
+                break;
+            }
+            stats.readNs += elapsedNs(decoding);
+        }
+
+        if (first) {
+            archive = TarReader::isTar(block, blockSize);
+            if (!archive) {
+                startFile(task.path);
+            }
+        }
+        if (!archive) {
+            feed(block, blockSize);
+            if (scanner->isFull()) {
+                break;
+            }
+        } else if (!tar.feed(block, blockSize) || tar.atEnd()) {
+            break;
+        }
+    }
+
+    if (cancel.load()) {
+        return 0;
+    }
+    finishFile();
+
+    if (matchCount == 0) {
+        recordMiss(search, task.file);
+    }
+    scannedCount++;
+    scannedSize += task.size;
+    return task.size;
+}
+
+qint64 Finder::scanChunk(const FileTask &task, Regex::Dfa *dfa, std::atomic<bool> &cancel, int producer)
+{
+    // A chunk that can't be read, because the file went away or lost its
+    // permissions since the crawl, is scanned as empty, so that the chunks
+    // after it are still published and the file is still counted.
+    QFile fileObj(task.path);
+    bool opened = fileObj.open(QIODevice::ReadOnly);
+
+    Scanner scanner(task.path, *task.search, dfa);
+    qint64 size = opened ? fileObj.size() : 0;
+    qint64 from = std::min(size, static_cast<qint64>(task.chunk) * task.search->chunkSize);
+    qint64 to = std::min(size, from + task.search->chunkSize);
+    qint64 lo = from - std::min<qint64>(from, scanner.lookBehind());
+
+    // Every chunk looks at the head of the file, so all of them skip a binary
+    // one without waiting for each other.
+    bool binary = false;
+    if (opened && task.search->skipBinary) {
+        QByteArray head = fileObj.peek(Finder::binaryProbeSize);
+        binary = isBinary(head.constData(), head.size());
+        if (binary && task.chunk == 0) {
+            binaryCount++;
+        }
+    }
+
+    // Once the chunks published so far fill the file's limit, the rest of
+    // it has nothing to add.
+    uint64_t limit = task.search->fileLimit();
+    bool full = false;
+    if (limit != 0) {
+        std::lock_guard<std::mutex> splitLg(task.split->m);
+        full = task.split->count >= limit;
+    }
+
+    WorkerStats &stats = workerStats[producer];
+    uint64_t lines = 0;
+    uchar *mapped = !binary && !full && lo < size ? fileObj.map(lo, size - lo) : nullptr;
+    if (mapped != nullptr) {
+        auto matching = std::chrono::steady_clock::now();
+        lines = scanner.scanChunk(reinterpret_cast<const char *>(mapped), size - lo, from - lo, to - lo);
+        stats.matchNs += elapsedNs(matching);
+        fileObj.unmap(mapped);
+    } else if (!binary && !full && lo < size && fileObj.seek(lo)) {
+        auto reading = std::chrono::steady_clock::now();
+        QByteArray window = fileObj.read(std::min(size, to + static_cast<qint64>(scanner.lookAhead())) - lo);
+        if (task.search->regex) {
+            while (window.indexOf('\n', static_cast<int>(to - lo - 1)) == -1 && !fileObj.atEnd()) {
+                window.append(fileObj.read(Finder::bufferedBlockSize));
+            }
+        }
+        stats.readNs += elapsedNs(reading);
+        auto matching = std::chrono::steady_clock::now();
+        qint64 end = std::min<qint64>(to - lo, window.size());
+        lines = scanner.scanChunk(window.constData(), window.size(), std::min(from - lo, end), end);
+        stats.matchNs += elapsedNs(matching);
+    }
+
+    // A cancelled chunk is done as well, only without matches.
+    bool cancelled = cancel.load();
+    if (!cancelled) {
+        scannedSize += to - from;
+    }
+
+    SplitFile &split = *task.split;
+    std::lock_guard<std::mutex> splitLg(split.m);
+    SplitFile::Chunk &chunk = split.chunks[task.chunk];
+    chunk.done = true;
+    chunk.lines = cancelled ? 0 : lines;
+    chunk.count = cancelled ? 0 : scanner.matchCount();
+    if (!cancelled) {
+        chunk.matches = scanner.takeMatches();
+    }
+    for (Match &match : chunk.matches) {
+        match.offset += lo;
+    }
+
+    while (split.published != split.chunks.size() && split.chunks[split.published].done) {
+        SplitFile::Chunk &next = split.chunks[split.published++];
+        for (Match &match : next.matches) {
+            match.line += split.lines;
+        }
+        split.lines += next.lines;
+        split.matched = split.matched || next.count != 0;
+        if (limit != 0) {
+            uint64_t room = limit - std::min(limit, split.count);
+            next.count = std::min(next.count, room);
+            if (next.matches.size() > room) {
+                next.matches.resize(room);
+            }
+        }
+        split.count += next.count;
+        publishOrdered(producer, *task.search, std::move(next.matches));
+    }
+
+    if (split.published == split.chunks.size()) {
+        if (!split.matched) {
+            recordMiss(*task.search, task.file);
+        } else if (task.search->reportMode == ReportMode::Count) {
+            uint32_t file = task.search->paths ? task.search->paths->intern(task.path) : 0;
+            publishOrdered(producer, *task.search, {{split.count, 0, 0, file, 0}});
+        }
+        scannedCount++;
+    }
+    return cancelled ? 0 : to - from;
+}
+
+void Finder::tune()
+{
+    PoolTuner::Sample totals = {0, 0, 0, 0};
+    for (int i = 0; i != poolCapacity; i++) {
+        totals.bytes += workerStats[i].bytes.load();
+        totals.busyNs += workerStats[i].busyNs.load();
+        totals.cpuNs += workerStats[i].cpuNs.load();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    PoolTuner::Sample sample = {std::chrono::duration<double>(now - lastSample).count(),
+                                totals.bytes - lastTotals.bytes,
+                                totals.busyNs - lastTotals.busyNs,
+                                totals.cpuNs - lastTotals.cpuNs};
+    lastTotals = totals;
+    lastSample = now;
+
+    if (statusCode.load() == 1) {
+        queueDepths.push_back(static_cast<uint32_t>(fileQueue.size()));
+        if (queueDepths.size() > Finder::maxQueueDepthSamples) {
+            queueDepths.pop_front();
+        }
+    }
+
+    if (statusCode.load() == 1 && !fileQueue.empty()) {
+        resizePool(tuner.update(sample));
+    }
+}
+
+void Finder::resizePool(int count)
+{
+    int previous = activeThreads.exchange(count);
+    if (count > previous) {
+        poolCv.notify_all();
+    } else if (count < previous) {
+        scannerHasWorkCv.notify_all();
+    }
+}
+
+// Changes are applied once the events pause, or maxWatchLatency after the
+// first one pending at the latest. Rescans run in slices of watchLatency,
+// so that events keep being drained between them.
+void Finder::watch()
+{
+    std::unique_ptr<Regex::Dfa> dfa;
+    QSet<QString> changed;
+    QSet<QString> removed;
+    QSet<QString> directories;
+    bool overflow = false;
+    auto firstPending = std::chrono::steady_clock::now();
+    uint64_t generation = searchGeneration.load();
+    for (;;) {
+        Watcher::Changes changes;
+        if (!watcher.wait(changes, Finder::watchLatency)) {
+            return;
+        }
+
+        if (generation != searchGeneration.load() || !watching.load()) {
+            generation = searchGeneration.load();
+            changed.clear();
+            removed.clear();
+            directories.clear();
+            overflow = false;
+            continue;
+        }
+
+        bool quiet = changes.changed.isEmpty() && changes.removed.isEmpty()
+                && changes.directories.isEmpty() && !changes.overflow;
+        if (changed.isEmpty() && removed.isEmpty() && directories.isEmpty() && !overflow) {
+            firstPending = std::chrono::steady_clock::now();
+        }
+        for (const QString &path : changes.changed) {
+            changed.insert(path);
+        }
+        for (const QString &path : changes.removed) {
+            removed.insert(path);
+        }
+        for (const QString &path : changes.directories) {
+            directories.insert(path);
+        }
+        overflow = overflow || changes.overflow;
+
+        int status = 2;
+        if (!statusCode.compare_exchange_strong(status, 5) && status != 5) {
+            continue;
+        }
+        bool overdue = elapsedNs(firstPending) >= uint64_t(Finder::maxWatchLatency) * 1000000;
+        if (!quiet && !overdue) {
+            continue;
+        }
+
+        if (overflow) {
+            std::lock_guard<std::mutex> paramsLg(paramsM);
+            params.done = false;
+            params.recrawl = true;
+            cancel.store(true);
+            crawlerHasWorkCv.notify_all();
+            changed.clear();
+            removed.clear();
+            directories.clear();
+            overflow = false;
+        } else if (!changed.isEmpty() || !removed.isEmpty() || !directories.isEmpty()) {
+            {
+                std::lock_guard<std::mutex> paramsLg(paramsM);
+                params.recrawl = true;
+            }
+            // What is left for the next slice stays overdue.
+            applyChanges(removed, directories, changed, dfa);
+            removed.clear();
+            directories.clear();
+        }
+    }
+}
+
+// Rescans the files in 'changed' for at most watchLatency and removes those
+// done; the files found in new directories join them.
+void Finder::applyChanges(const QSet<QString> &removed, const QSet<QString> &directories, QSet<QString> &changed,
+                          std::unique_ptr<Regex::Dfa> &dfa)
+{
+    std::shared_ptr<const Search> search;
+    {
+        std::lock_guard<std::mutex> queueLg(queueM);
+        search = activeSearch;
+    }
+    if (!search || search->generation != searchGeneration.load()) {
+        changed.clear();
+        return;
+    }
+
+    for (const QString &path : removed) {
+        invalidate(path);
+    }
+
+    // New files are judged against the whole chain of ignore files from the
+    // search root down, which a crawl of their directory alone can not see.
+    const PathFilter *filter = search->filter.get();
+    QString root = search->snapshot->directory;
+    for (const QString &directory : directories) {
+        if (filter && !filter->acceptsPath(root, directory, true)) {
+            continue;
+        }
+        Crawler crawler(cancel, [&changed](const QString &filePath, qint64, qint64, uint64_t)
+        {
+            changed.insert(filePath);
+        }, [this](const QString &directoryPath)
+        {
+            watcher.addDirectory(directoryPath);
+        });
+        crawler.crawl(directory, 1);
+    }
+
+    if (search->regex && (!dfa || dfa->regex() != search->regex.get())) {
+        dfa.reset(new Regex::Dfa(search->regex));
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    for (auto it = changed.begin(); it != changed.end();) {
+        if (cancel.load()) {
+            changed.clear();
+            return;
+        }
+        if (elapsedNs(started) >= uint64_t(Finder::watchLatency) * 1000000) {
+            return;
+        }
+
+        QString filePath = *it;
+        it = changed.erase(it);
+        if (filter && !filter->acceptsPath(root, filePath, false)) {
+            continue;
+        }
+
+        invalidate(filePath);
+        QFileInfo info(filePath);
+        if (!info.isFile() || info.isSymLink() || !info.isReadable()) {
+            continue;
+        }
+
+        totalCount++;
+        totalSize += info.size();
+        scan({filePath, info.size(), search, nullptr, 0, -1, -1}, dfa.get(), cancel, poolCapacity);
+    }
+}
+
+void Finder::invalidate(const QString &path)
+{
+    bool directory = path.endsWith('/');
+    std::lock_guard<std::mutex> resultLg(resultM);
+    drainResults();
+    result.removed.append(path);
+    if (!result.paths) {
+        return;
+    }
+
+    std::vector<char> stale(result.paths->size(), 0);
+    for (uint32_t id = 0; id != stale.size(); id++) {
+        QString filePath = result.paths->path(id);
+        // Members of an archive are named after it.
+        stale[id] = directory ? filePath.startsWith(path) : filePath == path || filePath.startsWith(path + '/');
+    }
+    auto end = std::remove_if(result.list.begin(), result.list.end(), [&](const Match &match)
+    {
+        return match.file < stale.size() && stale[match.file];
+    });
+    result.list.erase(end, result.list.end());
+}
+
+void Finder::publish(int producer, const Search &search, std::vector<Match> &&matches)
+{
+    if (matches.empty() || !admit(search, matches)) {
+        return;
+    }
+
+    if (search.sink) {
+        search.sink->write(matches);
+    }
+    ResultBatch batch = {search.generation, std::move(matches)};
+    if (!resultRings[producer]->push(std::move(batch))) {
+        std::unique_lock<std::mutex> resultLg = lockTimed(resultM, workerStats[producer].resultLockNs);
+        drainResults();
+        if (batch.generation == resultGeneration) {
+            appendResults(std::move(batch.matches));
+        }
+    }
+}
+
+void Finder::publishOrdered(int producer, const Search &search, std::vector<Match> &&matches)
+{
+    admit(search, matches);
+    if (search.sink) {
+        search.sink->write(matches);
+    }
+    std::unique_lock<std::mutex> resultLg = lockTimed(resultM, workerStats[producer].resultLockNs);
+    drainResults();
+    if (search.generation == resultGeneration) {
+        appendResults(std::move(matches));
+    }
+}
+
+// Counts matches against the limit of the whole search and drops the ones
+// beyond it; reaching the limit stops the search, unless an export needs
+// the rest.
+bool Finder::admit(const Search &search, std::vector<Match> &matches)
+{
+    if (search.maxCount == 0 || matches.empty() || search.generation != searchGeneration.load()) {
+        return true;
+    }
+
+    uint64_t before = entryCount.fetch_add(matches.size());
+    if (before + matches.size() < search.maxCount || !stopAtLimit(search)) {
+        return true;
+    }
+    matches.resize(before < search.maxCount ? search.maxCount - before : 0);
+    return !matches.empty();
+}
+
+// Like stop(), except that the results stay current and the search reports
+// "Too many matches". False when an attached export keeps it running.
+bool Finder::stopAtLimit(const Search &search)
+{
+    if (exportGeneration.load() == search.generation) {
+        return false;
+    }
+    std::lock_guard<std::mutex> queueLg(queueM);
+    if (exportGeneration.load() == search.generation) {
+        return false;
+    }
+    int working = 1;
+    if (search.generation != searchGeneration.load() || !statusCode.compare_exchange_strong(working, 6)) {
+        return true;
+    }
+
+    closeSink(search);
+    cancel.store(true);
+    for (int i = 0; i != poolCapacity; i++) {
+        scanCancel[i].store(true);
+    }
+    fileQueue.clear();
+    readAhead.clear();
+}
+
+// A search that went on past its match limit for an export, or was repeated
+// for one, still reports "Too many matches".
+int Finder::finishedStatus(const Search &search) const
+{
+    bool cut = search.maxCount != 0 && search.generation == exportGeneration.load()
+            && entryCount.load() >= search.maxCount;
+    return search.exportOnly || cut ? 6 : 2;
+}
+
+void Finder::closeSink(const Search &search)
+{
+    if (search.sink) {
+        search.sink->close();
+    }
+
+    // What the scanners published so far still goes to an attached export.
+    std::lock_guard<std::mutex> resultLg(resultM);
+    if (attachedSink && exportGeneration.load() == search.generation) {
+        drainResults();
+        attachedSink->close();
+        attachedSink.reset();
+    }
+}
+
+void Finder::drainResults()
+{
+    ResultBatch batch;
+    for (auto &ring : resultRings) {
+        while (ring->pop(batch)) {
+            if (batch.generation == resultGeneration) {
+                appendResults(std::move(batch.matches));
+            }
+        }
+    }
+}
+
+// Runs under resultM. An attached export gets every match, the results only
+// those within resultLimit.
+void Finder::appendResults(std::vector<Match> &&matches)
+{
+    if (attachedSink) {
+        attachedSink->write(matches);
+    }
+    if (resultLimit != 0 && resultCount + matches.size() > resultLimit) {
+        matches.resize(resultCount < resultLimit ? resultLimit - resultCount : 0);
+    }
+    resultCount += matches.size();
+
+    if (result.list.empty()) {
+        result.list = std::move(matches);
+    } else {
+        result.list.insert(result.list.end(), matches.begin(), matches.end());
+    }
+}
+
+Finder::EntryList Finder::getResult()
+{
+    std::unique_lock<std::mutex> resultLg(resultM, std::try_to_lock);
+    if (!resultLg.owns_lock()) {
+        EntryList tmp;
+        tmp.first = false;
+        return tmp;
+    }
+
+    drainResults();
+    EntryList tmp(std::move(result));
+    result.first = false;
+    result.removed.clear();
+    result.list.clear();
+    result.paths = tmp.paths;
+    result.scanMode = tmp.scanMode;
+    return tmp;
+}
+
+int Finder::getStatus() const
+{
     return statusCode.load();
 }
 
 Finder::Metrics Finder::getMetrics() const
 {
-    return {scannedCount.load(), scannedSize.load(), totalCount.load(), totalSize.load()};
+    std::lock_guard<std::mutex> queueLg(queueM);
+    return collectMetrics();
+}
+
+Finder::Metrics Finder::collectMetrics() const
+{
+    Metrics metrics;
+    metrics.scannedCount = scannedCount.load();
+    metrics.scannedSize = scannedSize.load();
+    metrics.totalCount = totalCount.load();
+    metrics.totalSize = totalSize.load();
+    metrics.binaryCount = binaryCount.load();
+    metrics.threadsCount = activeThreads.load();
+    metrics.threadsReason = PoolTuner::describe(tuner.reason());
+    metrics.scanOrder = activeSearch ? activeSearch->scanOrder : ScanOrder::Crawl;
+    metrics.crawlNs = crawlNs.load();
+    metrics.readNs = 0;
+    metrics.decodeNs = 0;
+    metrics.matchNs = 0;
+    metrics.idleNs = 0;
+    for (int i = 0; i <= poolCapacity; i++) {
+        const WorkerStats &stats = workerStats[i];
+        metrics.readNs += stats.readNs.load();
+        metrics.decodeNs += stats.decodeNs.load();
+        metrics.matchNs += stats.matchNs.load();
+        metrics.idleNs += stats.idleNs.load();
+        stats.taskScanNs.addTo(metrics.taskScanNs);
+        stats.queueLockNs.addTo(metrics.queueLockNs);
+        stats.resultLockNs.addTo(metrics.resultLockNs);
+    }
+    metrics.queueDepths.assign(queueDepths.begin(), queueDepths.end());
+    return metrics;
+}
+
+// Like grep, a NUL byte within the first binaryProbeSize bytes marks a file
+// as binary.
+bool Finder::isBinary(const char *data, qint64 size)
+{
+    return memchr(data, '\0', static_cast<size_t>(std::min(size, Finder::binaryProbeSize))) != nullptr;
+}
+
+QByteArray Finder::formatMetrics(const Metrics &metrics)
+{
+    QByteArray out = QString("{\"scannedCount\":%1,\"scannedSize\":%2,\"totalCount\":%3,\"totalSize\":%4,"
+                             "\"threads\":%5,\"crawlNs\":%6,\"readNs\":%7,\"decodeNs\":%8,\"matchNs\":%9,")
+            .arg(metrics.scannedCount)
+            .arg(metrics.scannedSize)
+            .arg(metrics.totalCount)
+            .arg(metrics.totalSize)
+            .arg(metrics.threadsCount)
+            .arg(metrics.crawlNs)
+            .arg(metrics.readNs)
+            .arg(metrics.decodeNs)
+            .arg(metrics.matchNs).toUtf8();
+    out += QString("\"idleNs\":%1,\"binaryCount\":%2,\"scanOrder\":\"%3\"")
+            .arg(metrics.idleNs)
+            .arg(metrics.binaryCount)
+            .arg(describe(metrics.scanOrder)).toUtf8();
+    appendHistogram(out, "taskScanNs", metrics.taskScanNs);
+    appendHistogram(out, "queueLockNs", metrics.queueLockNs);
+    appendHistogram(out, "resultLockNs", metrics.resultLockNs);
+    out += ",\"queueDepths\":[";
+    for (size_t i = 0; i != metrics.queueDepths.size(); i++) {
+        if (i != 0) {
+            out += ',';
+        }
+        out += QByteArray::number(metrics.queueDepths[i]);
+    }
+    out += "]}\n";
+    return out;
+}
+
+QString Finder::describe(ScanOrder scanOrder)
+{
+    switch (scanOrder) {
+    case ScanOrder::Crawl:
+        return "crawl";
+    case ScanOrder::SmallestFirst:
+        return "smallest";
+    case ScanOrder::LargestFirst:
+        return "largest";
+    case ScanOrder::Inode:
+        return "inode";
+    case ScanOrder::Physical:
+        return "physical";
+    }
+    return QString();
+}
+
+// Called by the tuning thread with queueM held; the file is written after
+// releasing it.
+void Finder::dumpMetrics(std::unique_lock<std::mutex> &queueLg)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (metricsDumpPath.isEmpty() || statusCode.load() != 1
+            || now - lastDump < std::chrono::milliseconds(Finder::metricsDumpInterval)) {
+        return;
+    }
+
+    lastDump = now;
+    QString filePath = metricsDumpPath;
+    QByteArray line = formatMetrics(collectMetrics());
+    queueLg.unlock();
+
+    if (filePath == "-") {
+        fprintf(stderr, "%s", line.constData());
+    } else {
+        QFile file(filePath);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            file.write(line);
+        }
+    }
+    queueLg.lock();
 }
 
 bool Finder::isCrawlingFinished() const
@@ -1,22 +1,37 @@
 #ifndef FINDER_H
 #define FINDER_H
 
-#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 #include <QDir>
 #include <QDirIterator>
 #include <QFile>
 #include <QObject>
+#include <QSet>
+#include <QStringList>
 #include <QTextStream>
 
+#include "archive.h"
 #include "automaton.h"
 #include "helpers.h"
+#include "histogram.h"
+#include "pathfilter.h"
+#include "pathtable.h"
+#include "pooltuner.h"
+#include "readahead.h"
+#include "regex.h"
+#include "spscring.h"
+#include "trigramindex.h"
+#include "watcher.h"
+#include "workstealingqueue.h"
+
+class ExportSink;
 
 class Finder : public QObject
 {
@@ -32,14 +47,137 @@ public:
         QString before;
         QString entry;
         QString after;
+        int pattern;
+    };
+
+    // What a scanner records per hit: the file as an id into the search's
+    // PathTable, the matched bytes as an offset and a length (into the
+    // decoded text in ScanMode::Text) and the index of the pattern that
+    // matched (0 for a regular expression). Line and pattern share a word,
+    // so a record stays at 24 bytes. MatchStore turns it into an Entry when
+    // it is displayed.
+    struct Match
+    {
+        uint64_t line : 48;
+        uint64_t pattern : 16;
+        uint64_t offset;
+        uint32_t file;
+        uint32_t length;
+    };
+
+    enum class ScanMode
+    {
+        Mapped,
+        Text
+    };
+
+    // What a search reports per file: every match, only the first one, or
+    // a single Match, once the file is done, with the number of matches in
+    // 'line' and neither offset nor length.
+    enum class ReportMode
+    {
+        Matches,
+        FilesWithMatches,
+        Count
+    };
+
+    // Order in which the queued files of a search are scanned, keyed on what
+    // the crawl recorded once per file: as found, smallest first (results
+    // come soonest), largest first (no big file is left to scan alone at the
+    // end), by inode number (close to the on-disk order on many file
+    // systems) or by where the first extent lies on the device (FIEMAP).
+    // Each scanning thread follows the order within its own share.
+    enum class ScanOrder
+    {
+        Crawl,
+        SmallestFirst,
+        LargestFirst,
+        Inode,
+        Physical
     };
 
+    // Matches of the paths in 'removed' are stale and must be dropped before
+    // 'list' is applied; a path ending with '/' stands for a whole directory.
     struct EntryList
     {
         EntryList();
 
         bool first;
-        std::vector<Entry> list;
+        QStringList removed;
+        std::vector<Match> list;
+        std::shared_ptr<const PathTable> paths;
+        ScanMode scanMode;
+    };
+
+    enum class PatternSyntax
+    {
+        Literal,
+        RegularExpression
+    };
+
+    // Files found by the last complete crawl of a directory, replayed instead
+    // of crawling again while only the patterns change.
+    struct Snapshot
+    {
+        struct File
+        {
+            QString path;
+            qint64 size;
+            qint64 mtime;
+            uint64_t inode;
+            // Where the file starts on its device, 0 where unknown; only
+            // looked up when the snapshot is 'located'.
+            uint64_t physical;
+        };
+
+        QString directory;
+        QStringList directories;
+        std::vector<File> files;
+        bool located;
+    };
+
+    // Ids of the snapshot files a search has ruled out, either by scanning
+    // them completely without a match or by inheriting them from the search
+    // it refines.
+    struct Misses
+    {
+        std::mutex m;
+        std::vector<uint32_t> files;
+    };
+
+    struct Search
+    {
+        Search();
+
+        QStringList patterns;
+        Automaton automaton;
+        std::shared_ptr<const Regex> regex;
+        ScanMode scanMode;
+        Automaton::CaseFolding caseFolding;
+        bool wholeWords;
+        ReportMode reportMode;
+        ScanOrder scanOrder;
+        // Matches counted per file and reported by the whole search at
+        // most; 0 for no limit.
+        uint64_t maxCountPerFile;
+        uint64_t maxCount;
+        uint64_t generation;
+        std::shared_ptr<PathTable> paths;
+        std::shared_ptr<const Snapshot> snapshot;
+        std::shared_ptr<Misses> misses;
+        std::shared_ptr<ExportSink> sink;
+        std::shared_ptr<const PathFilter> filter;
+        bool skipBinary;
+        // Scans again a search stopped at maxCount, only for 'sink'; the
+        // results of the search it repeats stay as they are.
+        bool exportOnly;
+        // Files of at least twice this size are split into chunks of it,
+        // which several scanners take in parallel.
+        qint64 chunkSize;
+        // Takes the trigrams of the new files the scanners read whole.
+        std::shared_ptr<TrigramIndex> index;
+
+        uint64_t fileLimit() const;
     };
 
     struct Metrics
@@ -48,6 +186,23 @@ public:
         uint64_t scannedSize;
         uint64_t totalCount;
         uint64_t totalSize;
+        uint64_t binaryCount;
+        int threadsCount;
+        QString threadsReason;
+        ScanOrder scanOrder;
+
+        // Time spent by the scanners since the search started, by stage;
+        // crawlNs is the duration of the crawl, which overlaps scanning.
+        uint64_t crawlNs;
+        uint64_t readNs;
+        uint64_t decodeNs;
+        uint64_t matchNs;
+        uint64_t idleNs;
+        Histogram::Snapshot taskScanNs;
+        Histogram::Snapshot queueLockNs;
+        Histogram::Snapshot resultLockNs;
+        // File queue length, sampled every tuningInterval ms, oldest first.
+        std::vector<uint32_t> queueDepths;
     };
 
 private:
@@ -58,15 +213,90 @@ private:
         bool invalid;
         bool done;
         QString directory;
-        QString pattern;
+        QStringList patterns;
+        ScanMode scanMode;
+        PatternSyntax patternSyntax;
+        Automaton::CaseFolding caseFolding;
+        bool wholeWords;
+        ReportMode reportMode;
+        ScanOrder scanOrder;
+        uint64_t maxCountPerFile;
+        uint64_t maxCount;
+        bool indexed;
+        bool watch;
+        bool recrawl;
+        std::shared_ptr<ExportSink> sink;
+        // Asked for by exportResults() with the results shown; repeats the
+        // last search for it alone unless the parameters changed since.
+        std::shared_ptr<ExportSink> exportSink;
+        std::shared_ptr<const PathFilter> filter;
+        bool skipBinary;
+        qint64 chunkSize;
     };
 
-    struct FileSizeCmp
+
+    struct SplitFile
     {
-        bool operator()(const QString &lhs, const QString &rhs);
+        struct Chunk
+        {
+            bool done;
+            uint64_t lines;
+            uint64_t count;
+            std::vector<Match> matches;
+        };
+
+        explicit SplitFile(size_t chunkCount);
+
+        std::mutex m;
+        std::vector<Chunk> chunks;
+        size_t published;
+        uint64_t lines;
+        uint64_t count;
+        bool matched;
     };
 
-    typedef std::priority_queue<QString, std::vector<QString>, FileSizeCmp> FileQueue;
+    // Written by one thread each (the last one is shared by the crawl and
+    // watch threads); bytes, busyNs and cpuNs feed the tuner and are never
+    // reset, the rest restarts with every search.
+    struct WorkerStats
+    {
+        WorkerStats();
+
+        void reset();
+
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> busyNs;
+        std::atomic<uint64_t> cpuNs;
+        std::atomic<uint64_t> readNs;
+        std::atomic<uint64_t> decodeNs;
+        std::atomic<uint64_t> matchNs;
+        std::atomic<uint64_t> idleNs;
+        Histogram taskScanNs;
+        Histogram queueLockNs;
+        Histogram resultLockNs;
+        char padding[64];
+    };
+
+    // Matches travel from each scanning thread to getResult() through a ring
+    // of its own; the rings are only drained under resultM. Chunks of a split
+    // file are appended directly after draining, as consecutive chunks are
+    // published by different threads.
+    struct ResultBatch
+    {
+        uint64_t generation;
+        std::vector<Match> matches;
+    };
+
+    struct FileTask
+    {
+        QString path;
+        qint64 size;
+        std::shared_ptr<const Search> search;
+        std::shared_ptr<SplitFile> split;
+        size_t chunk;
+        int64_t file;
+        int64_t indexSlot;
+    };
 
 public:
     Finder();
@@ -75,44 +305,143 @@ public:
     int getStatus() const;
     Metrics getMetrics() const;
     bool isCrawlingFinished() const;
+    static QByteArray formatMetrics(const Metrics &metrics);
+    static QString describe(ScanOrder scanOrder);
+    static bool isBinary(const char *data, qint64 size);
+    static Search compileSearch(const QStringList &patterns, PatternSyntax patternSyntax, ScanMode scanMode,
+                                Automaton::CaseFolding caseFolding = Automaton::CaseFolding::None,
+                                bool wholeWords = false);
 
 private:
-    void crawl(const QString &directory);
-    void enqueFileToScan(const QString &filePath);
-    void scan(const QString &filePath, const QString &pattern, std::atomic<bool> &cancel);
+    static std::vector<std::string> requiredLiterals(const Search &search);
+    static bool refines(const Search &search, const Search &previous);
+    void crawl(const QString &directory, TrigramIndex *index, Snapshot &snapshot);
+    void replay(const Snapshot &snapshot, const std::vector<char> &ruledOut, TrigramIndex *index);
+    std::shared_ptr<const Snapshot> locate(const Snapshot &snapshot);
+    void offer(const Snapshot::File &file, int64_t id, TrigramIndex *index, bool ruledOut);
+    void recordMiss(const Search &search, int64_t id);
+    void recordTrigrams(const FileTask &task, TrigramIndex::Collector *collector);
+    static uint64_t scanKey(ScanOrder scanOrder, const Snapshot::File &file);
+    void enqueFileToScan(const Snapshot::File &file, int64_t id, int64_t indexSlot);
+    void scanLoop(int worker);
+    qint64 scan(const FileTask &task, Regex::Dfa *dfa, std::atomic<bool> &cancel, int producer);
+    qint64 scanChunk(const FileTask &task, Regex::Dfa *dfa, std::atomic<bool> &cancel, int producer);
+    qint64 scanStream(const FileTask &task, ReadAhead::Stream &stream, Regex::Dfa *dfa, std::atomic<bool> &cancel,
+                      int producer);
+    qint64 scanArchive(const FileTask &task, Decompressor::Format format, const Decompressor::Source &source,
+                       Regex::Dfa *dfa, std::atomic<bool> &cancel, int producer);
+    void tune();
+    Metrics collectMetrics() const;
+    void dumpMetrics(std::unique_lock<std::mutex> &queueLg);
+    void watch();
+    void applyChanges(const QSet<QString> &removed, const QSet<QString> &directories, QSet<QString> &changed,
+                      std::unique_ptr<Regex::Dfa> &dfa);
+    void invalidate(const QString &path);
+    void resizePool(int count);
+    void publish(int producer, const Search &search, std::vector<Match> &&matches);
+    void publishOrdered(int producer, const Search &search, std::vector<Match> &&matches);
+    bool admit(const Search &search, std::vector<Match> &matches);
+    bool stopAtLimit(const Search &search);
+    int finishedStatus(const Search &search) const;
+    void closeSink(const Search &search);
+    void drainResults();
+    void appendResults(std::vector<Match> &&matches);
 
 public slots:
     void setDirectory(const QString &directory);
     void setPattern(const QString &pattern);
+    void setPatterns(const QStringList &patterns);
+    void setScanMode(ScanMode scanMode);
+    void setPatternSyntax(PatternSyntax patternSyntax);
+    void setCaseFolding(Automaton::CaseFolding caseFolding);
+    void setWholeWords(bool wholeWords);
+    void setReportMode(ReportMode reportMode);
+    void setScanOrder(ScanOrder scanOrder);
+    void setMaxCountPerFile(uint64_t count);
+    void setMaxCount(uint64_t count);
+    void setThreadsCount(int count);
+    void setIndexed(bool indexed);
+    void setWatching(bool watch);
+    void setPathFilter(const std::shared_ptr<const PathFilter> &filter);
+    void setSkippingBinary(bool skip);
+    void setChunkSize(qint64 size);
+    void exportResults(const std::shared_ptr<ExportSink> &sink);
+    void exportResults(const std::shared_ptr<ExportSink> &sink, const EntryList &reported);
+    void setMetricsDump(const QString &filePath);
     void stop();
 
 private:
-    static const int scanThreadsCount = 4;
+    static const int tuningInterval = 500;
+    static const int watchLatency = 100;
+    static const int maxWatchLatency = 1000;
+    static const int metricsDumpInterval = 1000;
+    static const size_t maxQueueDepthSamples = 240;
+    static const int maxCrawlThreadsCount = 8;
     static const int readingBlockSize = 4096;
+    static const qint64 binaryProbeSize = 8 * 1024;
+    static const int bufferedBlockSize = 64 * 1024;
+    static const qint64 mappingThreshold = 64 * 1024;
+    static const qint64 mappedBlockSize = 1024 * 1024;
+    static const size_t readAheadBlockSize = 256 * 1024;
+    static const qint64 defaultChunkSize = 8 * 1024 * 1024;
+    static const size_t resultRingSize = 256;
 
-    std::atomic<int> entryCount;
+    std::atomic<uint64_t> entryCount;
     std::atomic<int> statusCode;
     std::atomic<bool> crawlFinished;
     std::atomic<uint64_t> scannedCount;
     std::atomic<uint64_t> scannedSize;
     std::atomic<uint64_t> totalCount;
     std::atomic<uint64_t> totalSize;
+    std::atomic<uint64_t> binaryCount;
+    const int cores;
+    const int poolCapacity;
 
     Params params;
     EntryList result;
-    FileQueue fileQueue;
-    QString queuedPattern;
+    uint64_t resultGeneration;
+    // The match limit of the results and how many were added to them; the
+    // scanners enforce the limit themselves unless an export is attached.
+    uint64_t resultLimit;
+    uint64_t resultCount;
+    // Gets every match added to the results of the search exportGeneration
+    // until that search settles.
+    std::shared_ptr<ExportSink> attachedSink;
+    std::atomic<uint64_t> exportGeneration;
+    std::vector<std::unique_ptr<SpscRing<ResultBatch>>> resultRings;
+    WorkStealingQueue<FileTask> fileQueue;
+    ReadAhead readAhead;
+    std::shared_ptr<const Search> activeSearch;
+    std::atomic<uint64_t> searchGeneration;
+    std::atomic<int> idleScanners;
     bool quit;
     std::atomic<bool> cancel;
-    std::array<std::atomic<bool>, scanThreadsCount> scanCancel;
+    std::unique_ptr<std::atomic<bool>[]> scanCancel;
+    std::unique_ptr<WorkerStats[]> workerStats;
+    std::unique_ptr<TrigramIndex::Collector[]> collectors;
+    std::atomic<int> activeThreads;
+    PoolTuner tuner;
+    PoolTuner::Sample lastTotals;
+    std::chrono::steady_clock::time_point lastSample;
+    std::atomic<uint64_t> crawlNs;
+    std::deque<uint32_t> queueDepths;
+    QString metricsDumpPath;
+    std::chrono::steady_clock::time_point lastDump;
+    Watcher watcher;
+    std::atomic<bool> watching;
+    std::shared_ptr<const Snapshot> snapshot;
 
     mutable std::mutex paramsM;
     mutable std::mutex queueM;
     mutable std::mutex resultM;
     std::condition_variable crawlerHasWorkCv;
     std::condition_variable scannerHasWorkCv;
+    std::condition_variable poolCv;
+    std::condition_variable tunerCv;
 
     std::thread crawlThread;
+    std::thread tuneThread;
+    std::thread watchThread;
     std::vector<std::thread> scanThreads;
 };
 
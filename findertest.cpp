@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtTest>
+
+#include "findertest.h"
+
+namespace {
+
+const uint seed = 1;
+
+const char *const fillerWords[] = {"alpha", "beta", "gamma", "gammaa", "delta", "ne", "edle", "needle"};
+// Words in which the patterns of multiplePatterns overlap and nest.
+const char *const overlappingWords[] = {"he", "she", "his", "hers", "ushers", "this", "shis"};
+const int overlappingCount = 400;
+
+// Written over the filler around every seam between chunks, 'offset' bytes
+// from it, so that each seam cuts through one of them.
+struct Planted
+{
+    int offset;
+    const char *text;
+};
+
+const Planted planted[] = {
+    // A word cut in the middle.
+    {-4, " needle "},
+    // A longer word, which only holds a literal match.
+    {-4, " needles "},
+    // A line that starts in one chunk and matches in both.
+    {-10, "\ngammaa neeedle needle\n"},
+    // A line ending right before the seam and a word starting right at it.
+    {-8, " needle\nneedle "},
+    // A word ending right before the seam with a letter right at it.
+    {-7, " needlex "},
+    // A two-byte letter cut in half right in front of a word.
+    {-2, " \xc3\xa9needle "},
+};
+
+std::tuple<uint64_t, uint64_t, uint32_t, uint64_t> matchKey(const Finder::Match &match)
+{
+    return std::make_tuple(match.offset, static_cast<uint64_t>(match.pattern), match.length,
+                           static_cast<uint64_t>(match.line));
+}
+
+bool matchBefore(const Finder::Match &a, const Finder::Match &b)
+{
+    return matchKey(a) < matchKey(b);
+}
+
+bool matchEquals(const Finder::Match &a, const Finder::Match &b)
+{
+    return matchKey(a) == matchKey(b);
+}
+
+}
+
+// Random words and lines of chunkCount small chunks, with one of 'planted'
+// across every seam.
+QByteArray FinderTest::seamedText()
+{
+    std::mt19937 rng(seed);
+    const int size = chunkCount * static_cast<int>(smallChunkSize);
+    QByteArray text;
+    while (text.size() < size) {
+        text += fillerWords[rng() % (sizeof(fillerWords) / sizeof(fillerWords[0]))];
+        text += rng() % 8 == 0 ? '\n' : ' ';
+    }
+    text.resize(size - 1);
+    text += '\n';
+
+    const int plantedCount = sizeof(planted) / sizeof(planted[0]);
+    for (int seam = 1; seam < chunkCount; seam++) {
+        QByteArray plant(planted[(seam - 1) % plantedCount].text);
+        int at = seam * static_cast<int>(smallChunkSize) + planted[(seam - 1) % plantedCount].offset;
+        text.replace(at, plant.size(), plant);
+    }
+    return text;
+}
+
+// Random words of overlappingWords on a few lines.
+QByteArray FinderTest::overlappingText()
+{
+    std::mt19937 rng(seed);
+    QByteArray text;
+    for (int i = 0; i < overlappingCount; i++) {
+        text += overlappingWords[rng() % (sizeof(overlappingWords) / sizeof(overlappingWords[0]))];
+        text += rng() % 8 == 0 ? '\n' : ' ';
+    }
+    return text;
+}
+
+// Every match of one search, once it has finished.
+std::vector<Finder::Match> FinderTest::search(const QString &directory, const QStringList &patterns,
+                                              Finder::PatternSyntax patternSyntax, bool wholeWords, qint64 chunkSize)
+{
+    Finder finder;
+    finder.setPatternSyntax(patternSyntax);
+    finder.setWholeWords(wholeWords);
+    finder.setChunkSize(chunkSize);
+    finder.setPatterns(patterns);
+    // Only the directory makes the search valid, so no search before the
+    // last one finishes.
+    finder.setDirectory(directory);
+
+    std::vector<Finder::Match> matches;
+    QElapsedTimer timer;
+    timer.start();
+    for (;;) {
+        bool finished = finder.getStatus() == 2;
+        Finder::EntryList result = finder.getResult();
+        if (result.first) {
+            matches.clear();
+        }
+        matches.insert(matches.end(), result.list.begin(), result.list.end());
+        if (finished || timer.elapsed() > FinderTest::timeout) {
+            return matches;
+        }
+        QThread::msleep(10);
+    }
+}
+
+// Searches a file of several chunks once split into them and once scanned
+// in one go, and describes the first difference, if any.
+QString FinderTest::compareSplit(const QStringList &patterns, Finder::PatternSyntax patternSyntax, bool wholeWords)
+{
+    QTemporaryDir directory;
+    QFile file(directory.filePath("seamed.txt"));
+    if (!directory.isValid() || !file.open(QIODevice::WriteOnly) || file.write(seamedText()) == -1) {
+        return "cannot write " + file.fileName();
+    }
+    file.close();
+
+    std::vector<Finder::Match> split = search(directory.path(), patterns, patternSyntax, wholeWords,
+                                              FinderTest::smallChunkSize);
+    std::vector<Finder::Match> whole = search(directory.path(), patterns, patternSyntax, wholeWords, 0);
+    std::sort(split.begin(), split.end(), matchBefore);
+    std::sort(whole.begin(), whole.end(), matchBefore);
+
+    auto straddles = [](const Finder::Match &match)
+    {
+        return match.offset / FinderTest::smallChunkSize
+                != (match.offset + match.length - 1) / FinderTest::smallChunkSize;
+    };
+    if (std::none_of(whole.begin(), whole.end(), straddles)) {
+        return "no match across a seam";
+    }
+    auto duplicate = std::adjacent_find(split.begin(), split.end(), matchEquals);
+    if (duplicate != split.end()) {
+        return QString("match at offset %1 reported twice").arg(duplicate->offset);
+    }
+
+    auto differs = std::mismatch(split.begin(), split.end(), whole.begin(), whole.end(), matchEquals);
+    if (differs.first != split.end() || differs.second != whole.end()) {
+        const Finder::Match &match = differs.second != whole.end() ? *differs.second : *differs.first;
+        return QString("%1 matches split, %2 in one go; first difference at offset %3, line %4")
+                .arg(split.size()).arg(whole.size()).arg(match.offset).arg(static_cast<uint64_t>(match.line));
+    }
+    return QString();
+}
+
+void FinderTest::splitLiterals()
+{
+    QStringList patterns = QStringList() << "needle" << "dle ne" << "beta" << QString::fromUtf8("éneedle");
+    QString mismatch = compareSplit(patterns, Finder::PatternSyntax::Literal, false);
+    QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+}
+
+void FinderTest::splitRegularExpression()
+{
+    QStringList patterns = QStringList() << "ne+dle|^gam+a";
+    QString mismatch = compareSplit(patterns, Finder::PatternSyntax::RegularExpression, false);
+    QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+}
+
+void FinderTest::splitWholeWords()
+{
+    QStringList patterns = QStringList() << "needle" << "beta";
+    QString mismatch = compareSplit(patterns, Finder::PatternSyntax::Literal, true);
+    QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+}
+
+void FinderTest::splitWholeWordRegularExpression()
+{
+    QStringList patterns = QStringList() << "ne+dle";
+    QString mismatch = compareSplit(patterns, Finder::PatternSyntax::RegularExpression, true);
+    QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+}
+
+void FinderTest::multiplePatterns()
+{
+    QTemporaryDir directory;
+    QFile file(directory.filePath("overlapping.txt"));
+    QByteArray text = overlappingText();
+    QVERIFY(directory.isValid() && file.open(QIODevice::WriteOnly) && file.write(text) != -1);
+    file.close();
+
+    // The empty and the repeated pattern are dropped, so that matches
+    // number the distinct ones in order.
+    QStringList patterns = QStringList() << "he" << "" << "she" << "he" << "hers" << "his";
+    QStringList distinct = QStringList() << "he" << "she" << "hers" << "his";
+    std::vector<Finder::Match> expected;
+    for (int pattern = 0; pattern < distinct.size(); pattern++) {
+        QByteArray word = distinct.at(pattern).toUtf8();
+        for (int at = text.indexOf(word); at != -1; at = text.indexOf(word, at + 1)) {
+            uint64_t line = 1 + static_cast<uint64_t>(text.left(at).count('\n'));
+            expected.push_back({line, static_cast<uint64_t>(pattern), static_cast<uint64_t>(at), 0,
+                                static_cast<uint32_t>(word.size())});
+        }
+    }
+
+    std::vector<Finder::Match> matches = search(directory.path(), patterns, Finder::PatternSyntax::Literal, false, 0);
+    std::sort(matches.begin(), matches.end(), matchBefore);
+    std::sort(expected.begin(), expected.end(), matchBefore);
+    auto differs = std::mismatch(matches.begin(), matches.end(), expected.begin(), expected.end(), matchEquals);
+    if (differs.first != matches.end() || differs.second != expected.end()) {
+        const Finder::Match &match = differs.second != expected.end() ? *differs.second : *differs.first;
+        QFAIL(qPrintable(QString("%1 matches, %2 expected; first difference at offset %3, pattern %4")
+                         .arg(matches.size()).arg(expected.size()).arg(match.offset)
+                         .arg(static_cast<uint64_t>(match.pattern))));
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef FINDERTEST_H
+#define FINDERTEST_H
+
+#include <vector>
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include "finder.h"
+
+// Runs whole searches with Finder on files written to a temporary
+// directory. A file split into chunks, made small so that a short file
+// has many, has to give the matches of a file scanned in one go, among
+// them matches across the seams between chunks. Several patterns found in
+// one pass have to report which of them matched.
+class FinderTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static QByteArray seamedText();
+    static std::vector<Finder::Match> search(const QString &directory, const QStringList &patterns,
+                                             Finder::PatternSyntax patternSyntax, bool wholeWords, qint64 chunkSize);
+    static QString compareSplit(const QStringList &patterns, Finder::PatternSyntax patternSyntax, bool wholeWords);
+    static QByteArray overlappingText();
+
+private slots:
+    void splitLiterals();
+    void splitRegularExpression();
+    void splitWholeWords();
+    void splitWholeWordRegularExpression();
+    void multiplePatterns();
+
+private:
+    static const qint64 smallChunkSize = 4096;
+    static const int chunkCount = 12;
+    static const int timeout = 10000;
+};
+
+#endif // FINDERTEST_H
@@ -1,5 +1,9 @@
 #include "helpers.h"
 
+#ifdef Q_OS_UNIX
+#include <time.h>
+#endif
+
 QString humanizeSize(uint64_t size)
 {
     float num = size;
@@ -25,3 +29,19 @@ bool isLineSeperator(const QChar &c)
 {
     return c == '\n';
 }
+
+bool isUtf8Continuation(char c)
+{
+    return (static_cast<uchar>(c) & 0xc0) == 0x80;
+}
+
+uint64_t threadCpuTime()
+{
+#ifdef Q_OS_UNIX
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
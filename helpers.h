@@ -8,5 +8,7 @@
 QString humanizeSize(const uint64_t size);
 bool isUnsupportedChar(const QChar &c);
 bool isLineSeperator(const QChar &c);
+bool isUtf8Continuation(char c);
+uint64_t threadCpuTime();
 
 #endif // HELPERS_H
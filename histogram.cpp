@@ -0,0 +1,68 @@
+#include <algorithm>
+
+#include "histogram.h"
+
+const int Histogram::bucketCount;
+
+Histogram::Snapshot::Snapshot()
+    : count(0)
+    , sum(0)
+{
+    std::fill(buckets, buckets + bucketCount, 0);
+}
+
+Histogram::Snapshot &Histogram::Snapshot::operator+=(const Snapshot &other)
+{
+    for (int i = 0; i != bucketCount; i++) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    return *this;
+}
+
+// The upper bound of the bucket holding the requested fraction of values.
+uint64_t Histogram::Snapshot::percentile(double fraction) const
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * count + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i != bucketCount; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return i == 0 ? 0 : uint64_t(1) << i;
+        }
+    }
+    return uint64_t(1) << (bucketCount - 1);
+}
+
+uint64_t Histogram::Snapshot::mean() const
+{
+    return count == 0 ? 0 : sum / count;
+}
+
+Histogram::Histogram()
+{
+    reset();
+}
+
+void Histogram::addTo(Snapshot &snapshot) const
+{
+    for (int i = 0; i != bucketCount; i++) {
+        uint64_t value = buckets[i].load(std::memory_order_relaxed);
+        snapshot.buckets[i] += value;
+        snapshot.count += value;
+    }
+    snapshot.sum += sum.load(std::memory_order_relaxed);
+}
+
+void Histogram::reset()
+{
+    for (std::atomic<uint64_t> &bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    sum.store(0, std::memory_order_relaxed);
+}
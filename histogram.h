@@ -0,0 +1,50 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <QtAlgorithms>
+
+// Log2-bucketed histogram of non-negative values such as latencies in
+// nanoseconds: bucket 0 counts zeros, bucket i the values in
+// [2^(i-1), 2^i). Recording is a couple of relaxed increments, so every
+// thread owns its histograms and readers take snapshots at any time and add
+// them up.
+class Histogram
+{
+public:
+    static const int bucketCount = 48;
+
+    struct Snapshot
+    {
+        Snapshot();
+
+        Snapshot &operator+=(const Snapshot &other);
+        uint64_t percentile(double fraction) const;
+        uint64_t mean() const;
+
+        uint64_t buckets[bucketCount];
+        uint64_t count;
+        uint64_t sum;
+    };
+
+    Histogram();
+
+    void record(uint64_t value);
+    void addTo(Snapshot &snapshot) const;
+    void reset();
+
+private:
+    std::atomic<uint64_t> buckets[bucketCount];
+    std::atomic<uint64_t> sum;
+};
+
+inline void Histogram::record(uint64_t value)
+{
+    int bucket = value == 0 ? 0 : std::min(bucketCount - 1, 64 - static_cast<int>(qCountLeadingZeroBits(value)));
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+#endif // HISTOGRAM_H
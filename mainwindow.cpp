@@ -6,12 +6,19 @@ MainWindow::MainWindow(QWidget *parent)
     , ui(new Ui::MainWindow)
     , pollingTimer(this)
     , statusAnimationTimer(this)
-    , listSize(0)
 {
     ui->setupUi(this);
 
+    ui->tableView_result->setModel(&results);
+    ui->tableView_result->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    ui->tableView_result->verticalHeader()->setDefaultSectionSize(ui->tableView_result->fontMetrics().height() + 4);
+
     connect(ui->lineEdit_directory, &QLineEdit::textChanged, this, &MainWindow::onDirectoryChange);
     connect(ui->lineEdit_pattern, &QLineEdit::textChanged, this, &MainWindow::onPatternChange);
+    connect(ui->checkBox_regex, &QCheckBox::toggled, this, &MainWindow::onRegexToggle);
+    connect(ui->checkBox_ignoreCase, &QCheckBox::toggled, this, &MainWindow::onIgnoreCaseToggle);
+    connect(ui->checkBox_wholeWords, &QCheckBox::toggled, this, &MainWindow::onWholeWordsToggle);
+    connect(ui->checkBox_watch, &QCheckBox::toggled, this, &MainWindow::onWatchToggle);
     connect(ui->pushButton_browse, &QPushButton::clicked, this, &MainWindow::onBrowseClick);
     connect(ui->pushButton_restart, &QPushButton::clicked, this, &MainWindow::onRestartClick);
     connect(ui->pushButton_stop, &QPushButton::clicked, this, &MainWindow::onStopClick);
@@ -23,8 +30,9 @@ MainWindow::MainWindow(QWidget *parent)
     ui->statusBar->addPermanentWidget(ui->label_metrics);
 
     ui->lineEdit_directory->setText(QDir::homePath());
-    ui->label_forList->setText(QString("First %1 entries:").arg(maxListSize));
+    ui->label_forList->setText(QString("Matches: %1").arg(results.size()));
 
+    bgFinder.setMaxCount(MainWindow::maxMatches);
     statusAnimationTimer.setSingleShot(true);
     pollingTimer.start(pollingInterval);
 }
@@ -37,29 +45,12 @@ MainWindow::~MainWindow()
 void MainWindow::updateList()
 {
     auto result = bgFinder.getResult();
-
-    if (result.first) {
-        ui->textBrowser_result->clear();
-        store.clear();
-        listSize = 0;
+    if (!result.first && result.removed.isEmpty() && result.list.empty()) {
+        return;
     }
 
-    QString fileFormat = "<font color=purple>%1</font>:%2";
-    QString fragmentFormat = "%1<font color=blue><b>%2</b></font>%3";
-
-    for (auto &item : result.list) {
-        store[item.filePath].push_back(item);
-
-        if (maxListSize <= listSize) continue;
-
-        listSize++;
-        ui->textBrowser_result->append(fileFormat.arg(item.filePath).arg(item.line));
-        ui->textBrowser_result->append(fragmentFormat
-                                .arg(item.before.toHtmlEscaped())
-                                .arg(item.entry.toHtmlEscaped())
-                                .arg(item.after.toHtmlEscaped()));
-        ui->textBrowser_result->append("");
-    }
+    results.apply(result);
+    ui->label_forList->setText(QString("Matches: %1").arg(results.size()));
 }
 
 void MainWindow::updateStatus()
@@ -78,6 +69,15 @@ void MainWindow::updateStatus()
     case 3:
         setStatus("Stopped by user");
         break;
+    case 4:
+        setStatus("Invalid pattern");
+        break;
+    case 5:
+        setStatus("Watching for changes");
+        break;
+    case 6:
+        setStatus("Too many matches");
+        break;
     default:
         setStatus("");
     }
@@ -91,44 +91,64 @@ void MainWindow::updateMetrics()
         color = "green";
     }
 
-    QString format = "Scanned: %1 (%2) | Found: <font color=" + color + ">%3 (%4)</font>";
+    QString format = "Scanned: %1 (%2) | Found: <font color=" + color + ">%3 (%4)</font> | Threads: %5 (%6)";
 
     ui->label_metrics->setText(format
                                .arg(humanizeSize(metrics.scannedSize))
                                .arg(metrics.scannedCount)
                                .arg(humanizeSize(metrics.totalSize))
-                               .arg(metrics.totalCount));
+                               .arg(metrics.totalCount)
+                               .arg(metrics.threadsCount)
+                               .arg(metrics.threadsReason));
+
+    QString details = "Crawl: %1 ms\nRead: %2 ms\nDecode: %3 ms\nMatch: %4 ms\nIdle: %5 ms\n"
+                      "Scan per file p50/p99: %6/%7 us\nQueue lock wait p99: %8 us\nResult lock wait p99: %9 us\n"
+                      "Scan order: %10";
+    ui->label_metrics->setToolTip(details
+                                  .arg(metrics.crawlNs / 1000000)
+                                  .arg(metrics.readNs / 1000000)
+                                  .arg(metrics.decodeNs / 1000000)
+                                  .arg(metrics.matchNs / 1000000)
+                                  .arg(metrics.idleNs / 1000000)
+                                  .arg(metrics.taskScanNs.percentile(0.5) / 1000)
+                                  .arg(metrics.taskScanNs.percentile(0.99) / 1000)
+                                  .arg(metrics.queueLockNs.percentile(0.99) / 1000)
+                                  .arg(metrics.resultLockNs.percentile(0.99) / 1000)
+                                  .arg(Finder::describe(metrics.scanOrder)));
 }
 
 void MainWindow::saveResults()
 {
-    QString filePath = QFileDialog::getSaveFileName(this, "Select Destination", QDir::homePath());
+    QString filePath = QFileDialog::getSaveFileName(this, "Select Destination", QDir::homePath(),
+                                                    "Text (*.txt);;JSON Lines (*.jsonl);;HTML (*.html)");
+    if (filePath.isEmpty()) {
+        return;
+    }
 
-    QFile file(filePath);
-    if (!file.open(QIODevice::WriteOnly)) {
-        QMessageBox::information(this, "Save Results", "Unsuccessfully");
+    auto sink = std::make_shared<ExportSink>(filePath, ExportSink::formatFor(filePath));
+    if (!sink->isValid()) {
+        QMessageBox::information(this, "Save Results", "Unsuccessfully: " + sink->errorString());
         return;
     }
-    QTextStream fstream(&file);
-
-    QString fileFormat = "<font color=purple>%1</font>";
-    QString fragmentFormat = "<font color=gray>%1</font>:\t%2<font color=blue><b>%3</b></font>%4";
-
-    fstream << "<pre>";
-    for (auto &filePath : store.keys()) {
-        fstream << fileFormat.arg(filePath) << endl;
-        for (Finder::Entry &item : store[filePath]) {
-            fstream << fragmentFormat
-                       .arg(item.line)
-                       .arg(item.before.toHtmlEscaped())
-                       .arg(item.entry.toHtmlEscaped())
-                       .arg(item.after.toHtmlEscaped()) << endl;
-        }
-        fstream << endl;
+
+    exportSink = sink;
+    ui->pushButton_saveResults->setEnabled(false);
+    bgFinder.exportResults(sink, results.snapshot());
+}
+
+void MainWindow::updateExport()
+{
+    if (!exportSink || !exportSink->isFinished()) {
+        return;
     }
-    fstream << "</pre>";
 
-    QMessageBox::information(this, "Save Results", "Success");
+    std::shared_ptr<ExportSink> sink = std::move(exportSink);
+    ui->pushButton_saveResults->setEnabled(true);
+    if (sink->isValid()) {
+        QMessageBox::information(this, "Save Results", QString("Success: %1 matches").arg(sink->count()));
+    } else {
+        QMessageBox::information(this, "Save Results", "Unsuccessfully: " + sink->errorString());
+    }
 }
 
 void MainWindow::onDirectoryChange(const QString &value)
@@ -145,6 +165,26 @@ void MainWindow::onPatternChange(const QString &value)
     bgFinder.setPattern(value);
 }
 
+void MainWindow::onRegexToggle(bool checked)
+{
+    bgFinder.setPatternSyntax(checked ? Finder::PatternSyntax::RegularExpression : Finder::PatternSyntax::Literal);
+}
+
+void MainWindow::onIgnoreCaseToggle(bool checked)
+{
+    bgFinder.setCaseFolding(checked ? Automaton::CaseFolding::Simple : Automaton::CaseFolding::None);
+}
+
+void MainWindow::onWholeWordsToggle(bool checked)
+{
+    bgFinder.setWholeWords(checked);
+}
+
+void MainWindow::onWatchToggle(bool checked)
+{
+    bgFinder.setWatching(checked);
+}
+
 void MainWindow::onBrowseClick()
 {
     QString dir = QFileDialog::getExistingDirectory(this, "Select Directory",
@@ -172,6 +212,7 @@ void MainWindow::onPollingTimeout()
     updateList();
     updateStatus();
     updateMetrics();
+    updateExport();
 }
 
 void MainWindow::onStatusAnimationTimeout()
@@ -198,6 +239,10 @@ void MainWindow::setStatus(const QString &status)
         color = "red";
     } else if (status == "Too many matches") {
         color = "purple";
+    } else if (status == "Invalid pattern") {
+        color = "darkred";
+    } else if (status == "Watching for changes") {
+        color = "darkgreen";
     }
 
     QString format("<span style=\"font-weight: bold; color: %1\">%2</span>");
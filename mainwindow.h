@@ -5,13 +5,15 @@
 #include <QtGui/qtextdocument.h>
 #include <QDir>
 #include <QFileDialog>
-#include <QHash>
+#include <QHeaderView>
 #include <QMainWindow>
 #include <QMessageBox>
 #include <QTimer>
 
+#include "exportsink.h"
 #include "finder.h"
 #include "helpers.h"
+#include "resultmodel.h"
 
 namespace Ui {
 class MainWindow;
@@ -24,6 +26,7 @@ private:
     void updateList();
     void updateStatus();
     void updateMetrics();
+    void updateExport();
     void saveResults();
 
 public:
@@ -33,6 +36,10 @@ public:
 private slots:
     void onDirectoryChange(const QString &value);
     void onPatternChange(const QString &value);
+    void onRegexToggle(bool checked);
+    void onIgnoreCaseToggle(bool checked);
+    void onWholeWordsToggle(bool checked);
+    void onWatchToggle(bool checked);
     void onBrowseClick();
     void onRestartClick();
     void onStopClick();
@@ -44,14 +51,14 @@ private slots:
 private:
     static const int pollingInterval = 200;
     static const int statusAnimationInterval = 200;
-    static const int maxListSize = 100;
+    static const int maxMatches = 1000000;
 
     Ui::MainWindow *ui;
     QTimer pollingTimer;
     QTimer statusAnimationTimer;
     Finder bgFinder;
-    size_t listSize;
-    QHash<QString, std::vector<Finder::Entry>> store;
+    ResultModel results;
+    std::shared_ptr<ExportSink> exportSink;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <cstring>
+#include <QFileInfo>
+#include <QTextStream>
+
+#include "archive.h"
+#include "helpers.h"
+#include "matchstore.h"
+
+const size_t ContextReader::maxBeforeBytes;
+const size_t ContextReader::maxAfterBytes;
+const qint64 ContextReader::lineBlockSize;
+const int ContextReader::decodingBlockSize;
+const qint64 ContextReader::textBlockSize;
+const uint64_t ContextReader::retainedSize;
+
+ContextReader::ContextReader()
+    : scanMode(Finder::ScanMode::Mapped)
+    , opened(false)
+    , streamed(false)
+    , format(Decompressor::Format::Plain)
+    , inMember(false)
+    , found(false)
+    , textOffset(0)
+{}
+
+void ContextReader::setScanMode(Finder::ScanMode scanMode)
+{
+    this->scanMode = scanMode;
+    openPath.clear();
+    opened = false;
+    close();
+}
+
+void ContextReader::close()
+{
+    streamed = false;
+    stream.reset();
+    tar.reset();
+    decompressor.reset();
+    member.clear();
+    file.close();
+    text.clear();
+    textOffset = 0;
+}
+
+bool ContextReader::open(const QString &filePath)
+{
+    if (filePath == openPath) {
+        return opened;
+    }
+
+    close();
+    openPath = filePath;
+    file.setFileName(filePath);
+    if (scanMode == Finder::ScanMode::Text) {
+        opened = streamed = file.open(QIODevice::ReadOnly | QIODevice::Text) && rewind();
+    } else if (file.open(QIODevice::ReadOnly)) {
+        // The offsets in a plain tar are those of the file.
+        opened = true;
+        QByteArray head = file.peek(TarReader::blockSize);
+        streamed = Decompressor::isArchive(head.constData(), head.size(), format)
+                && format != Decompressor::Format::Plain && rewind();
+    } else {
+        opened = streamed = openMember(filePath);
+    }
+    return opened;
+}
+
+// The archive is the longest leading part of the path that is a file.
+bool ContextReader::openMember(const QString &filePath)
+{
+    for (int slash = filePath.indexOf('/', 1); slash != -1; slash = filePath.indexOf('/', slash + 1)) {
+        QString archivePath = filePath.left(slash);
+        if (!QFileInfo(archivePath).isFile()) {
+            continue;
+        }
+        file.setFileName(archivePath);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        QByteArray head = file.peek(TarReader::blockSize);
+        member = QFile::encodeName(filePath.mid(slash + 1));
+        return Decompressor::isArchive(head.constData(), head.size(), format) && rewind();
+    }
+    return false;
+}
+
+// Starts decoding over from the start of the file.
+bool ContextReader::rewind()
+{
+    text.clear();
+    textOffset = 0;
+    stream.reset();
+    tar.reset();
+    decompressor.reset();
+    if (!file.seek(0)) {
+        return false;
+    }
+
+    if (scanMode == Finder::ScanMode::Text) {
+        stream.reset(new QTextStream(&file));
+        return true;
+    }
+
+    block.resize(ContextReader::decodingBlockSize);
+    decompressor.reset(new Decompressor(format, [this](const char **data, size_t *size)
+    {
+        input = file.read(ContextReader::decodingBlockSize);
+        *data = input.constData();
+        *size = static_cast<size_t>(input.size());
+        return !input.isEmpty();
+    }));
+    if (!member.isEmpty()) {
+        inMember = false;
+        found = false;
+        tar.reset(new TarReader([this](const QByteArray &path)
+        {
+            inMember = path == member;
+            found = found || inMember;
+        }, [this](const char *data, size_t size)
+        {
+            if (inMember) {
+                text.append(data, static_cast<int>(size));
+            }
+        }, []
+        {
+        }));
+    }
+    return true;
+}
+
+// Appends the next decoded block to 'text', which for a tar member may be
+// nothing while other members go by; false at the end.
+bool ContextReader::pull()
+{
+    if (stream) {
+        if (stream->atEnd()) {
+            return false;
+        }
+        text.append(stream->read(ContextReader::textBlockSize).toUtf8());
+        return true;
+    }
+    if (!decompressor) {
+        return false;
+    }
+
+    qint64 read = decompressor->read(block.data(), block.size());
+    bool more = read > 0;
+    if (more && !tar) {
+        text.append(block.constData(), static_cast<int>(read));
+    } else if (more) {
+        more = tar->feed(block.constData(), static_cast<size_t>(read)) && !tar->atEnd() && (!found || inMember);
+    }
+    if (!more) {
+        decompressor.reset();
+    }
+    return more;
+}
+
+Finder::Entry ContextReader::read(const QString &filePath, const Finder::Match &match)
+{
+    Finder::Entry entry = {match.line, filePath, QString(), QString(), QString(), static_cast<int>(match.pattern)};
+    if (!open(filePath)) {
+        return entry;
+    }
+
+    uint64_t lo = match.offset - std::min<uint64_t>(match.offset, maxBeforeBytes);
+    QByteArray bytes = window(lo, match.offset + match.length + maxAfterBytes);
+
+    size_t begin = match.offset - lo;
+    if (begin > static_cast<size_t>(bytes.size())) {
+        return entry;
+    }
+    size_t end = std::min<size_t>(begin + match.length, bytes.size());
+    const char *data = bytes.constData();
+    entry.before = contextBefore(data, data + begin);
+    entry.entry = QString::fromUtf8(data + begin, static_cast<int>(end - begin));
+    entry.after = contextAfter(data + end, data + bytes.size());
+    return entry;
+}
+
+QByteArray ContextReader::line(const QString &filePath, const Finder::Match &match)
+{
+    if (!open(filePath)) {
+        return QByteArray();
+    }
+
+    uint64_t begin = match.offset;
+    while (begin != 0) {
+        uint64_t lo = begin - std::min<uint64_t>(begin, ContextReader::lineBlockSize);
+        QByteArray bytes = window(lo, begin);
+        int newline = bytes.lastIndexOf('\n');
+        if (newline != -1) {
+            begin = lo + newline + 1;
+            break;
+        }
+        if (bytes.size() != static_cast<int>(begin - lo)) {
+            return QByteArray();
+        }
+        begin = lo;
+    }
+
+    QByteArray result;
+    for (uint64_t from = match.offset;;) {
+        QByteArray bytes = window(from, from + ContextReader::lineBlockSize);
+        int newline = bytes.indexOf('\n');
+        if (newline != -1) {
+            bytes.truncate(newline);
+        }
+        result.append(bytes);
+        if (newline != -1 || bytes.size() != ContextReader::lineBlockSize) {
+            break;
+        }
+        from += ContextReader::lineBlockSize;
+    }
+    return window(begin, match.offset) + result;
+}
+
+QByteArray ContextReader::window(uint64_t from, uint64_t to)
+{
+    if (streamed) {
+        if (from < textOffset && !rewind()) {
+            return QByteArray();
+        }
+        // Earlier bytes are kept for the windows before this one, which
+        // line() and the context before the next match ask for.
+        while (textOffset + text.size() < to && pull()) {
+            uint64_t end = textOffset + text.size();
+            uint64_t keep = std::min(from, end - std::min(end, ContextReader::retainedSize));
+            if (keep > textOffset) {
+                text.remove(0, static_cast<int>(keep - textOffset));
+                textOffset = keep;
+            }
+        }
+        uint64_t end = std::min<uint64_t>(to, textOffset + text.size());
+        if (from >= end) {
+            return QByteArray();
+        }
+        return text.mid(static_cast<int>(from - textOffset), static_cast<int>(end - from));
+    }
+    if (!file.seek(static_cast<qint64>(from))) {
+        return QByteArray();
+    }
+    return file.read(static_cast<qint64>(to - from));
+}
+
+QString ContextReader::contextBefore(const char *lo, const char *matchBegin)
+{
+    const char *start = matchBegin - std::min<size_t>(matchBegin - lo, maxBeforeBytes);
+    for (const char *p = matchBegin; p != start; p--) {
+        if (p[-1] == '\n') {
+            start = p;
+            break;
+        }
+    }
+    while (start != matchBegin && isUtf8Continuation(*start)) {
+        start++;
+    }
+
+    QString text = QString::fromUtf8(start, static_cast<int>(matchBegin - start));
+    int first = text.size();
+    while (first != 0 && !isUnsupportedChar(text.at(first - 1)) && text.size() - first < static_cast<int>(Finder::Entry::maxBeforeSize)) {
+        first--;
+    }
+    return text.mid(first);
+}
+
+QString ContextReader::contextAfter(const char *matchEnd, const char *hi)
+{
+    const char *end = matchEnd + std::min<size_t>(hi - matchEnd, maxAfterBytes);
+    const char *newline = static_cast<const char *>(std::memchr(matchEnd, '\n', end - matchEnd));
+    if (newline != nullptr) {
+        end = newline;
+    }
+    while (end != hi && end != matchEnd && isUtf8Continuation(*end)) {
+        end--;
+    }
+
+    QString text = QString::fromUtf8(matchEnd, static_cast<int>(end - matchEnd));
+    int last = 0;
+    while (last != text.size() && !isUnsupportedChar(text.at(last)) && last < static_cast<int>(Finder::Entry::maxAfterChars)) {
+        last++;
+    }
+    return text.left(last);
+}
+
+MatchStore::MatchStore()
+    : scanMode(Finder::ScanMode::Mapped)
+    , count(0)
+{}
+
+void MatchStore::reset(const std::shared_ptr<const PathTable> &paths, Finder::ScanMode scanMode)
+{
+    this->paths = paths;
+    this->scanMode = scanMode;
+    chunks.clear();
+    count = 0;
+    reader.setScanMode(scanMode);
+}
+
+void MatchStore::append(const std::vector<Finder::Match> &matches)
+{
+    for (const Finder::Match &match : matches) {
+        if (count == chunks.size() * MatchStore::chunkSize) {
+            chunks.emplace_back(new Finder::Match[MatchStore::chunkSize]);
+        }
+        slot(count++) = match;
+    }
+}
+
+void MatchStore::remove(const QStringList &removed)
+{
+    if (!paths || removed.isEmpty()) {
+        return;
+    }
+
+    std::vector<char> stale(paths->size(), 0);
+    for (uint32_t id = 0; id != stale.size(); id++) {
+        QString filePath = paths->path(id);
+        for (const QString &path : removed) {
+            bool directory = path.endsWith('/');
+            bool member = !directory && filePath.startsWith(path + '/');
+            stale[id] = stale[id] || member || (directory ? filePath.startsWith(path) : filePath == path);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i != count; i++) {
+        const Finder::Match &match = slot(i);
+        if (match.file >= stale.size() || !stale[match.file]) {
+            slot(kept++) = match;
+        }
+    }
+    count = kept;
+    chunks.resize((count + MatchStore::chunkSize - 1) / MatchStore::chunkSize);
+}
+
+size_t MatchStore::size() const
+{
+    return count;
+}
+
+const Finder::Match &MatchStore::at(size_t index) const
+{
+    return chunks[index / MatchStore::chunkSize][index % MatchStore::chunkSize];
+}
+
+Finder::Match &MatchStore::slot(size_t index)
+{
+    return chunks[index / MatchStore::chunkSize][index % MatchStore::chunkSize];
+}
+
+QString MatchStore::filePath(size_t index) const
+{
+    return paths ? paths->path(at(index).file) : QString();
+}
+
+Finder::Entry MatchStore::entry(size_t index)
+{
+    return reader.read(filePath(index), at(index));
+}
+
+// Every match, in the form Finder::exportResults() takes the results shown.
+Finder::EntryList MatchStore::snapshot() const
+{
+    Finder::EntryList list;
+    list.first = false;
+    list.paths = paths;
+    list.scanMode = scanMode;
+    list.list.reserve(count);
+    for (size_t i = 0; i != count; i++) {
+        list.list.push_back(at(i));
+    }
+    return list;
+}
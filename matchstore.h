@@ -0,0 +1,103 @@
+#ifndef MATCHSTORE_H
+#define MATCHSTORE_H
+
+#include <memory>
+#include <vector>
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+
+#include "archive.h"
+#include "finder.h"
+#include "pathtable.h"
+
+// Reads the text around a Finder::Match back from its file and builds the
+// Entry shown to the user, or returns the whole line for exports. The last
+// file stays open, since consecutive matches mostly come from the same
+// file. In ScanMode::Text match offsets refer to the decoded text, in
+// compressed files and archive members ("archive/member") to the
+// decompressed stream. Those are decoded forward up to the window asked
+// for; only the last retainedSize bytes are kept, and an earlier window
+// decodes the file again from its start.
+class ContextReader
+{
+public:
+    ContextReader();
+
+    void setScanMode(Finder::ScanMode scanMode);
+    Finder::Entry read(const QString &filePath, const Finder::Match &match);
+    QByteArray line(const QString &filePath, const Finder::Match &match);
+
+private:
+    void close();
+    bool open(const QString &filePath);
+    bool openMember(const QString &filePath);
+    bool rewind();
+    bool pull();
+    QByteArray window(uint64_t from, uint64_t to);
+    static QString contextBefore(const char *lo, const char *matchBegin);
+    static QString contextAfter(const char *matchEnd, const char *hi);
+
+private:
+    static const size_t maxBeforeBytes = Finder::Entry::maxBeforeSize * 4;
+    static const size_t maxAfterBytes = Finder::Entry::maxAfterChars * 4;
+    static const qint64 lineBlockSize = 4096;
+    static const int decodingBlockSize = 256 * 1024;
+    // Finder reads text in blocks of this many characters, which the text
+    // has to be encoded in alike for the offsets to match.
+    static const qint64 textBlockSize = 4096;
+    static const uint64_t retainedSize = 1024 * 1024;
+
+    Finder::ScanMode scanMode;
+    QString openPath;
+    bool opened;
+    bool streamed;
+    QFile file;
+    std::unique_ptr<QTextStream> stream;
+    Decompressor::Format format;
+    std::unique_ptr<Decompressor> decompressor;
+    QByteArray input;
+    QByteArray block;
+    // The tar member wanted and whether the reader is in it or past it.
+    QByteArray member;
+    std::unique_ptr<TarReader> tar;
+    bool inMember;
+    bool found;
+    // Decoded bytes from textOffset on.
+    QByteArray text;
+    uint64_t textOffset;
+};
+
+// All matches of one search, kept as fixed records in chunks that are
+// allocated once and never moved. Paths and context are only materialized
+// by filePath() and entry().
+class MatchStore
+{
+public:
+    MatchStore();
+
+    void reset(const std::shared_ptr<const PathTable> &paths, Finder::ScanMode scanMode);
+    void append(const std::vector<Finder::Match> &matches);
+    void remove(const QStringList &removed);
+    size_t size() const;
+    const Finder::Match &at(size_t index) const;
+    QString filePath(size_t index) const;
+    Finder::Entry entry(size_t index);
+    Finder::EntryList snapshot() const;
+
+private:
+    Finder::Match &slot(size_t index);
+
+private:
+    static const size_t chunkSize = 4096;
+
+    std::shared_ptr<const PathTable> paths;
+    Finder::ScanMode scanMode;
+    std::vector<std::unique_ptr<Finder::Match[]>> chunks;
+    size_t count;
+    ContextReader reader;
+};
+
+#endif // MATCHSTORE_H
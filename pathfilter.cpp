@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <QDir>
+#include <QFile>
+
+#include "pathfilter.h"
+
+namespace {
+
+bool hasWildcards(const QByteArray &glob)
+{
+    for (char c : glob) {
+        if (c == '*' || c == '?' || c == '[' || c == '\\') {
+            return true;
+        }
+    }
+    return false;
+}
+
+QByteArray relativeTo(const QByteArray &base, const QByteArray &path)
+{
+    return path.mid(base == "/" ? 1 : base.size() + 1);
+}
+
+QByteArray nameOf(const QByteArray &path)
+{
+    return path.mid(path.lastIndexOf('/') + 1);
+}
+
+}
+
+GlobSet::GlobSet()
+{}
+
+void GlobSet::add(const QByteArray &glob, int index)
+{
+    bool anchored = glob.contains('/');
+    QByteArray pattern = glob.startsWith('/') ? glob.mid(1) : glob;
+    if (!anchored && !hasWildcards(pattern)) {
+        names[pattern] = index;
+    } else if (!anchored && pattern.startsWith("*.") && !hasWildcards(pattern.mid(2)) && !pattern.mid(2).contains('.')) {
+        extensions[pattern.mid(2)] = index;
+    } else {
+        globs.push_back({pattern, anchored, index});
+    }
+}
+
+int GlobSet::match(const QByteArray &relativePath, const QByteArray &name) const
+{
+    int best = names.value(name, -1);
+    int dot = name.lastIndexOf('.');
+    if (dot != -1 && !extensions.isEmpty()) {
+        best = std::max(best, extensions.value(name.mid(dot + 1), -1));
+    }
+
+    for (auto it = globs.rbegin(); it != globs.rend() && it->index > best; ++it) {
+        const QByteArray &subject = it->anchored ? relativePath : name;
+        if (matches(it->pattern.constData(), it->pattern.constData() + it->pattern.size(),
+                    subject.constData(), subject.constData() + subject.size())) {
+            best = it->index;
+            break;
+        }
+    }
+    return best;
+}
+
+bool GlobSet::isEmpty() const
+{
+    return names.isEmpty() && extensions.isEmpty() && globs.empty();
+}
+
+// '*' and '?' never match a slash; "**/" matches any number of leading
+// directories and any other "**" everything, slashes included.
+bool GlobSet::matches(const char *glob, const char *globEnd, const char *path, const char *pathEnd)
+{
+    while (glob != globEnd) {
+        char c = *glob;
+        if (c == '*') {
+            if (glob + 1 != globEnd && glob[1] == '*') {
+                const char *rest = glob + 2;
+                if (rest != globEnd && *rest == '/') {
+                    rest++;
+                    for (const char *from = path;;) {
+                        if (matches(rest, globEnd, from, pathEnd)) {
+                            return true;
+                        }
+                        from = std::find(from, pathEnd, '/');
+                        if (from == pathEnd) {
+                            return false;
+                        }
+                        from++;
+                    }
+                }
+                for (const char *from = path;; from++) {
+                    if (matches(rest, globEnd, from, pathEnd)) {
+                        return true;
+                    }
+                    if (from == pathEnd) {
+                        return false;
+                    }
+                }
+            }
+
+            glob++;
+            for (const char *from = path;; from++) {
+                if (matches(glob, globEnd, from, pathEnd)) {
+                    return true;
+                }
+                if (from == pathEnd || *from == '/') {
+                    return false;
+                }
+            }
+        }
+
+        if (path == pathEnd) {
+            return false;
+        }
+
+        uchar ch = static_cast<uchar>(*path);
+        if (c == '?') {
+            if (ch == '/') {
+                return false;
+            }
+        } else if (c == '[') {
+            const char *p = glob + 1;
+            bool negate = p != globEnd && (*p == '!' || *p == '^');
+            if (negate) {
+                p++;
+            }
+            bool found = false;
+            for (bool first = true; p != globEnd && (*p != ']' || first); first = false) {
+                char lo = *p;
+                if (lo == '\\' && p + 1 != globEnd) {
+                    lo = *++p;
+                }
+                p++;
+                char hi = lo;
+                if (p + 1 < globEnd && *p == '-' && p[1] != ']') {
+                    hi = p[1];
+                    p += 2;
+                }
+                found = found || (static_cast<uchar>(lo) <= ch && ch <= static_cast<uchar>(hi));
+            }
+
+            if (p == globEnd) {
+                if (ch != '[') {
+                    return false;
+                }
+            } else {
+                if (found == negate || ch == '/') {
+                    return false;
+                }
+                glob = p;
+            }
+        } else {
+            if (c == '\\' && glob + 1 != globEnd) {
+                c = *++glob;
+            }
+            if (static_cast<uchar>(c) != ch) {
+                return false;
+            }
+        }
+        glob++;
+        path++;
+    }
+    return path == pathEnd;
+}
+
+PathFilter::Rules::Rules(const std::shared_ptr<const Rules> &parent, const QByteArray &directory)
+    : parent(parent)
+    , directory(directory)
+{}
+
+bool PathFilter::Rules::isIgnored(const QByteArray &path, const QByteArray &name, bool directory) const
+{
+    for (const Rules *rules = this; rules != nullptr; rules = rules->parent.get()) {
+        QByteArray relativePath = relativeTo(rules->directory, path);
+        int best = rules->any.match(relativePath, name);
+        if (directory) {
+            best = std::max(best, rules->directoriesOnly.match(relativePath, name));
+        }
+        if (best != -1) {
+            return !rules->negated[best];
+        }
+    }
+    return false;
+}
+
+void PathFilter::Rules::load(const QByteArray &filePath)
+{
+    QFile file(QFile::decodeName(filePath));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    for (QByteArray line : file.readAll().split('\n')) {
+        if (line.endsWith('\r')) {
+            line.chop(1);
+        }
+        while (line.endsWith(' ') && !line.endsWith("\\ ")) {
+            line.chop(1);
+        }
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+
+        bool negate = line.startsWith('!');
+        if (negate) {
+            line.remove(0, 1);
+        }
+        bool directoryOnly = line.endsWith('/');
+        if (directoryOnly) {
+            line.chop(1);
+        }
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        int index = static_cast<int>(negated.size());
+        negated.push_back(negate);
+        (directoryOnly ? directoriesOnly : any).add(line, index);
+    }
+}
+
+PathFilter::PathFilter()
+    : ignoreFiles(false)
+{}
+
+PathFilter::PathFilter(const QStringList &include, const QStringList &exclude, bool ignoreFiles)
+    : ignoreFiles(ignoreFiles)
+{
+    int index = 0;
+    for (const QString &glob : include) {
+        QByteArray encoded = QFile::encodeName(glob);
+        while (encoded.endsWith('/')) {
+            encoded.chop(1);
+        }
+        if (!encoded.isEmpty()) {
+            this->include.add(encoded, index++);
+        }
+    }
+    for (const QString &glob : exclude) {
+        QByteArray encoded = QFile::encodeName(glob);
+        while (encoded.endsWith('/')) {
+            encoded.chop(1);
+        }
+        if (!encoded.isEmpty()) {
+            this->exclude.add(encoded, index++);
+        }
+    }
+}
+
+bool PathFilter::isEmpty() const
+{
+    return include.isEmpty() && exclude.isEmpty() && !ignoreFiles;
+}
+
+std::shared_ptr<const PathFilter::Rules> PathFilter::enter(const std::shared_ptr<const Rules> &parent,
+                                                           const QByteArray &directory) const
+{
+    if (!ignoreFiles) {
+        return parent;
+    }
+
+    QByteArray prefix = directory == "/" ? directory : directory + '/';
+    auto rules = std::make_shared<Rules>(parent, directory);
+    rules->load(prefix + ".gitignore");
+    rules->load(prefix + ".ignore");
+    if (rules->negated.empty()) {
+        return parent;
+    }
+    return rules;
+}
+
+bool PathFilter::acceptsFile(const Rules *rules, const QByteArray &root, const QByteArray &path, const QByteArray &name) const
+{
+    QByteArray relativePath = relativeTo(root, path);
+    if (!include.isEmpty() && include.match(relativePath, name) == -1) {
+        return false;
+    }
+    if (!exclude.isEmpty() && exclude.match(relativePath, name) != -1) {
+        return false;
+    }
+    return rules == nullptr || !rules->isIgnored(path, name, false);
+}
+
+bool PathFilter::acceptsDirectory(const Rules *rules, const QByteArray &root, const QByteArray &path, const QByteArray &name) const
+{
+    if (ignoreFiles && name == ".git") {
+        return false;
+    }
+    if (!exclude.isEmpty() && exclude.match(relativeTo(root, path), name) != -1) {
+        return false;
+    }
+    return rules == nullptr || !rules->isIgnored(path, name, true);
+}
+
+// Replays the decisions of a crawl from 'root' for a single path, loading
+// the ignore files of every directory on the way.
+bool PathFilter::acceptsPath(const QString &root, const QString &path, bool directory) const
+{
+    QByteArray rootPath = QFile::encodeName(QDir(root).absolutePath());
+    while (rootPath.size() > 1 && rootPath.endsWith('/')) {
+        rootPath.chop(1);
+    }
+    QByteArray encoded = QFile::encodeName(path);
+    while (encoded.size() > 1 && encoded.endsWith('/')) {
+        encoded.chop(1);
+    }
+    QByteArray prefix = rootPath == "/" ? rootPath : rootPath + '/';
+    if (isEmpty() || !encoded.startsWith(prefix)) {
+        return true;
+    }
+
+    std::shared_ptr<const Rules> rules = enter(nullptr, rootPath);
+    for (int slash = encoded.indexOf('/', prefix.size()); slash != -1; slash = encoded.indexOf('/', slash + 1)) {
+        QByteArray parent = encoded.left(slash);
+        if (!acceptsDirectory(rules.get(), rootPath, parent, nameOf(parent))) {
+            return false;
+        }
+        rules = enter(rules, parent);
+    }
+    return directory ? acceptsDirectory(rules.get(), rootPath, encoded, nameOf(encoded))
+                     : acceptsFile(rules.get(), rootPath, encoded, nameOf(encoded));
+}
@@ -0,0 +1,87 @@
+#ifndef PATHFILTER_H
+#define PATHFILTER_H
+
+#include <memory>
+#include <vector>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+// A set of gitignore-style globs compiled for matching many paths. Globs
+// without a slash are matched against the last path component, the others
+// against the whole path relative to the directory they were defined in.
+// Plain names and "*.ext" globs are looked up in hash tables, only the rest
+// are interpreted. match() returns the index of the last glob matching the
+// path, or -1.
+class GlobSet
+{
+public:
+    GlobSet();
+
+    void add(const QByteArray &glob, int index);
+    int match(const QByteArray &relativePath, const QByteArray &name) const;
+    bool isEmpty() const;
+
+    static bool matches(const char *glob, const char *globEnd, const char *path, const char *pathEnd);
+
+private:
+    struct Glob
+    {
+        QByteArray pattern;
+        bool anchored;
+        int index;
+    };
+
+    QHash<QByteArray, int> names;
+    QHash<QByteArray, int> extensions;
+    std::vector<Glob> globs;
+};
+
+// Decides which files and directories the crawler visits. Include globs
+// restrict the files reported (directories are always entered), exclude
+// globs drop files and whole directories; both are relative to the search
+// root. When ignore files are honored, the .gitignore and .ignore files of
+// every directory entered apply to everything below it with the usual
+// precedence: the deeper file wins and within a file the last rule wins.
+// .git directories are skipped then as well.
+class PathFilter
+{
+public:
+    // The ignore rules in effect in one directory, linked to those of its
+    // parent; shared by every pending subdirectory of the crawl.
+    class Rules
+    {
+    public:
+        Rules(const std::shared_ptr<const Rules> &parent, const QByteArray &directory);
+
+        bool isIgnored(const QByteArray &path, const QByteArray &name, bool directory) const;
+
+    private:
+        friend class PathFilter;
+
+        void load(const QByteArray &filePath);
+
+        std::shared_ptr<const Rules> parent;
+        QByteArray directory;
+        GlobSet any;
+        GlobSet directoriesOnly;
+        std::vector<bool> negated;
+    };
+
+    PathFilter();
+    PathFilter(const QStringList &include, const QStringList &exclude, bool ignoreFiles);
+
+    bool isEmpty() const;
+    std::shared_ptr<const Rules> enter(const std::shared_ptr<const Rules> &parent, const QByteArray &directory) const;
+    bool acceptsFile(const Rules *rules, const QByteArray &root, const QByteArray &path, const QByteArray &name) const;
+    bool acceptsDirectory(const Rules *rules, const QByteArray &root, const QByteArray &path, const QByteArray &name) const;
+    bool acceptsPath(const QString &root, const QString &path, bool directory) const;
+
+private:
+    GlobSet include;
+    GlobSet exclude;
+    bool ignoreFiles;
+};
+
+#endif // PATHFILTER_H
@@ -0,0 +1,26 @@
+#include "pathtable.h"
+
+uint32_t PathTable::intern(const QString &path)
+{
+    std::lock_guard<std::mutex> lg(m);
+    uint32_t id = ids.value(path, static_cast<uint32_t>(paths.size()));
+    if (id != paths.size()) {
+        return id;
+    }
+
+    ids.insert(path, id);
+    paths.push_back(path);
+    return id;
+}
+
+QString PathTable::path(uint32_t id) const
+{
+    std::lock_guard<std::mutex> lg(m);
+    return id < paths.size() ? paths[id] : QString();
+}
+
+size_t PathTable::size() const
+{
+    std::lock_guard<std::mutex> lg(m);
+    return paths.size();
+}
@@ -0,0 +1,27 @@
+#ifndef PATHTABLE_H
+#define PATHTABLE_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <QHash>
+#include <QString>
+
+// Interned file paths of one search. Scanners intern the path of every file
+// with a match and matches refer to it by id, so each path is stored once no
+// matter how many matches it has. Ids are dense and stable for the lifetime
+// of the table; scanning the same file again yields the same id.
+class PathTable
+{
+public:
+    uint32_t intern(const QString &path);
+    QString path(uint32_t id) const;
+    size_t size() const;
+
+private:
+    mutable std::mutex m;
+    QHash<QString, uint32_t> ids;
+    std::vector<QString> paths;
+};
+
+#endif // PATHTABLE_H
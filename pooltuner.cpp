@@ -0,0 +1,111 @@
+#include <algorithm>
+
+#include "pooltuner.h"
+
+constexpr double PoolTuner::cpuBoundWait;
+constexpr double PoolTuner::significantChange;
+
+PoolTuner::PoolTuner(int cores, int capacity)
+    : cores(std::max(1, std::min(cores, capacity)))
+    , capacity(std::max(1, capacity))
+    , configured(0)
+    , count(this->cores)
+    , why(Reason::Default)
+    , lastStep(0)
+    , hold(0)
+    , lastThroughput(0)
+{}
+
+void PoolTuner::configure(int count)
+{
+    configured = std::max(0, std::min(count, capacity));
+    this->count = configured > 0 ? configured : cores;
+    why = configured > 0 ? Reason::Configured : Reason::Default;
+    restart();
+}
+
+int PoolTuner::update(const Sample &sample)
+{
+    if (configured > 0 || sample.seconds <= 0) {
+        return count;
+    }
+
+    double throughput = sample.bytes / sample.seconds;
+    double busyWorkers = sample.busyNs / (sample.seconds * 1e9);
+    double wait = sample.busyNs > sample.cpuNs
+            ? static_cast<double>(sample.busyNs - sample.cpuNs) / sample.busyNs : 0;
+    double previous = lastThroughput;
+    int step = lastStep;
+    lastThroughput = throughput;
+    lastStep = 0;
+
+    if (hold > 0) {
+        hold--;
+        return count;
+    }
+
+    if (step != 0 && throughput < previous * (1 - significantChange)) {
+        count -= step;
+        why = Reason::ThroughputDropped;
+        hold = holdIntervals;
+        return count;
+    }
+
+    if (busyWorkers < count / 2.0) {
+        why = Reason::CrawlerBound;
+        return count;
+    }
+
+    if (wait < cpuBoundWait) {
+        why = Reason::CpuBound;
+        lastStep = cores - count;
+        count = cores;
+        return count;
+    }
+
+    why = Reason::IoBound;
+    if (step > 0 && throughput < previous * (1 + significantChange)) {
+        count -= step;
+        hold = holdIntervals;
+    } else if (count < capacity) {
+        lastStep = 1;
+        count++;
+    }
+    return count;
+}
+
+void PoolTuner::restart()
+{
+    lastStep = 0;
+    hold = 0;
+    lastThroughput = 0;
+}
+
+int PoolTuner::threadsCount() const
+{
+    return count;
+}
+
+PoolTuner::Reason PoolTuner::reason() const
+{
+    return why;
+}
+
+QString PoolTuner::describe(Reason reason)
+{
+    switch (reason) {
+    case Reason::Default:
+        return "one per core";
+    case Reason::Configured:
+        return "configured";
+    case Reason::CpuBound:
+        return "CPU bound";
+    case Reason::IoBound:
+        return "I/O bound";
+    case Reason::ThroughputDropped:
+        return "more threads were slower";
+    case Reason::CrawlerBound:
+        return "waiting for crawler";
+    }
+    return QString();
+}
@@ -0,0 +1,59 @@
+#ifndef POOLTUNER_H
+#define POOLTUNER_H
+
+#include <cstdint>
+#include <QString>
+
+// Decides how many scanner threads should be active. Every sample covers
+// one tuning interval: the bytes scanned, the wall time the workers spent
+// scanning and the CPU time they consumed; the difference of the latter two
+// is time blocked on I/O. CPU bound scans run one thread per core. I/O bound
+// scans probe one more thread at a time while throughput keeps improving and
+// step back and hold when an added thread made it worse. A count set through
+// configure() disables tuning.
+class PoolTuner
+{
+public:
+    enum class Reason
+    {
+        Default,
+        Configured,
+        CpuBound,
+        IoBound,
+        ThroughputDropped,
+        CrawlerBound
+    };
+
+    struct Sample
+    {
+        double seconds;
+        uint64_t bytes;
+        uint64_t busyNs;
+        uint64_t cpuNs;
+    };
+
+    PoolTuner(int cores, int capacity);
+
+    void configure(int count);
+    int update(const Sample &sample);
+    void restart();
+    int threadsCount() const;
+    Reason reason() const;
+    static QString describe(Reason reason);
+
+private:
+    static const int holdIntervals = 10;
+    static constexpr double cpuBoundWait = 0.2;
+    static constexpr double significantChange = 0.1;
+
+    int cores;
+    int capacity;
+    int configured;
+    int count;
+    Reason why;
+    int lastStep;
+    int hold;
+    double lastThroughput;
+};
+
+#endif // POOLTUNER_H
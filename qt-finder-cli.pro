@@ -0,0 +1,13 @@
+QT       = core
+
+TARGET = qt-finder-cli
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(finder-core.pri)
+
+SOURCES += \
+    cli.cpp
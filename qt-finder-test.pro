@@ -0,0 +1,25 @@
+QT       = core testlib
+
+TARGET = finder-test
+TEMPLATE = app
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(finder-core.pri)
+
+SOURCES += \
+    testmain.cpp \
+    automatontest.cpp \
+    regextest.cpp \
+    spscringtest.cpp \
+    findertest.cpp \
+    sessionpooltest.cpp
+
+HEADERS += \
+    automatontest.h \
+    regextest.h \
+    spscringtest.h \
+    findertest.h \
+    sessionpooltest.h
@@ -0,0 +1,757 @@
+#include <algorithm>
+#include <chrono>
+#include <QFile>
+
+#include "readahead.h"
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#define READAHEAD_IO_URING
+#endif
+#endif
+#endif
+
+const size_t ReadAhead::blocksPerFile;
+const size_t ReadAhead::prefetchBlocks;
+const uint64_t ReadAhead::wakeToken;
+const int ReadAhead::maxAnnounced;
+
+struct ReadAhead::File
+{
+    explicit File(const QByteArray &path)
+        : path(path)
+        , fd(-1)
+        , size(0)
+        , submitted(0)
+        , started(false)
+        , opening(false)
+        , taken(false)
+        , abandoned(false)
+        , failed(false)
+        , synchronous(false)
+    {}
+
+    ~File()
+    {
+#ifdef READAHEAD_IO_URING
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+    }
+
+    void openNow()
+    {
+#ifdef READAHEAD_IO_URING
+        fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            failed = true;
+            return;
+        }
+        size = st.st_size;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    QByteArray path;
+    int fd;
+    qint64 size;
+    // Offset of the next read to queue and the blocks queued so far, in
+    // file order.
+    qint64 submitted;
+    std::deque<int> blocks;
+    bool started;
+    bool opening;
+    bool taken;
+    bool abandoned;
+    bool failed;
+    // The ring refused a read of the file, its stream reads the rest.
+    bool synchronous;
+};
+
+#ifdef READAHEAD_IO_URING
+
+// A bare io_uring set up with the raw system calls, so there is no library
+// to link. Submissions are serialized by ReadAhead::m, completions are only
+// reaped by the background thread.
+struct ReadAhead::Ring
+{
+    static std::unique_ptr<Ring> create(unsigned entries, size_t blockCount);
+    ~Ring();
+
+    bool read(int block, int fd, char *data, size_t length, qint64 offset);
+    bool nop(uint64_t token);
+    bool wait();
+    template <typename Handler>
+    void reap(const Handler &handler);
+
+private:
+    io_uring_sqe *nextSqe();
+    bool submit();
+
+    int fd;
+    void *sqRing;
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+    std::vector<iovec> vectors;
+};
+
+std::unique_ptr<ReadAhead::Ring> ReadAhead::Ring::create(unsigned entries, size_t blockCount)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    std::unique_ptr<Ring> ring(new Ring);
+    ring->fd = fd;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        ring->sqRingSize = ring->cqRingSize = std::max(ring->sqRingSize, ring->cqRingSize);
+    }
+    ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    ring->sqRing = mmap(nullptr, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    ring->cqRing = single ? ring->sqRing
+                          : mmap(nullptr, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 fd, IORING_OFF_CQ_RING);
+    ring->sqes = static_cast<io_uring_sqe *>(mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sqRing != MAP_FAILED) {
+            munmap(ring->sqRing, ring->sqRingSize);
+        }
+        if (!single && ring->cqRing != MAP_FAILED) {
+            munmap(ring->cqRing, ring->cqRingSize);
+        }
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqesSize);
+        }
+        ::close(fd);
+        ring->fd = -1;
+        ring->sqRing = ring->cqRing = nullptr;
+        ring->sqes = nullptr;
+        return nullptr;
+    }
+
+    char *sq = static_cast<char *>(ring->sqRing);
+    char *cq = static_cast<char *>(ring->cqRing);
+    ring->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    ring->sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    ring->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    ring->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    ring->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    ring->cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    ring->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    ring->vectors.resize(blockCount);
+    return ring;
+}
+
+ReadAhead::Ring::~Ring()
+{
+    if (fd < 0) {
+        return;
+    }
+    munmap(sqes, sqesSize);
+    if (cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    munmap(sqRing, sqRingSize);
+    ::close(fd);
+}
+
+io_uring_sqe *ReadAhead::Ring::nextSqe()
+{
+    unsigned tail = *sqTail;
+    unsigned index = tail & *sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    return sqe;
+}
+
+// False when the kernel refuses the entry (EAGAIN, EBUSY while completions
+// overflow, ENOMEM); it takes none then, so the entry is withdrawn.
+bool ReadAhead::Ring::submit()
+{
+    __atomic_store_n(sqTail, *sqTail + 1, __ATOMIC_RELEASE);
+    for (;;) {
+        if (syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) >= 0) {
+            return true;
+        }
+        if (errno != EINTR) {
+            break;
+        }
+    }
+    __atomic_store_n(sqTail, *sqTail - 1, __ATOMIC_RELEASE);
+    return false;
+}
+
+bool ReadAhead::Ring::read(int block, int file, char *data, size_t length, qint64 offset)
+{
+    vectors[block].iov_base = data;
+    vectors[block].iov_len = length;
+
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = file;
+    sqe->addr = reinterpret_cast<uint64_t>(&vectors[block]);
+    sqe->len = 1;
+    sqe->off = static_cast<uint64_t>(offset);
+    sqe->user_data = static_cast<uint64_t>(block);
+    return submit();
+}
+
+bool ReadAhead::Ring::nop(uint64_t token)
+{
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = token;
+    return submit();
+}
+
+// Waits for a completion; false on an error other than EINTR.
+bool ReadAhead::Ring::wait()
+{
+    return syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0 || errno == EINTR;
+}
+
+template <typename Handler>
+void ReadAhead::Ring::reap(const Handler &handler)
+{
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const io_uring_cqe &cqe = cqes[head & *cqMask];
+        handler(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+#else
+
+struct ReadAhead::Ring
+{
+    static std::unique_ptr<Ring> create(unsigned, size_t)
+    {
+        return nullptr;
+    }
+
+    bool read(int, int, char *, size_t, qint64)
+    {
+        return false;
+    }
+
+    bool nop(uint64_t)
+    {
+        return false;
+    }
+
+    bool wait()
+    {
+        return false;
+    }
+
+    template <typename Handler>
+    void reap(const Handler &)
+    {}
+};
+
+#endif
+
+ReadAhead::Stream::Stream()
+    : owner(nullptr)
+    , current(-1)
+{}
+
+ReadAhead::Stream::Stream(Stream &&other)
+    : owner(other.owner)
+    , file(std::move(other.file))
+    , current(other.current)
+{
+    other.owner = nullptr;
+    other.current = -1;
+}
+
+ReadAhead::Stream &ReadAhead::Stream::operator=(Stream &&other)
+{
+    if (this != &other) {
+        close();
+        owner = other.owner;
+        file = std::move(other.file);
+        current = other.current;
+        other.owner = nullptr;
+        other.current = -1;
+    }
+    return *this;
+}
+
+ReadAhead::Stream::~Stream()
+{
+    close();
+}
+
+bool ReadAhead::Stream::isOpen() const
+{
+    return owner != nullptr;
+}
+
+bool ReadAhead::Stream::failed() const
+{
+    return file && file->failed;
+}
+
+// Waits for the next block of the file and hands it out until the next
+// call; false at the end of the file or on a read error.
+bool ReadAhead::Stream::next(const char **data, size_t *size)
+{
+    return owner != nullptr && owner->advance(*this, data, size);
+}
+
+void ReadAhead::Stream::close()
+{
+    if (owner == nullptr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lg(owner->m);
+    if (current != -1) {
+        owner->release(current);
+        current = -1;
+    }
+    owner->abandon(file);
+    owner = nullptr;
+}
+
+ReadAhead::ReadAhead(size_t blockSize, size_t blockCount, size_t maxFilesAhead)
+    : blockBytes(blockSize)
+    , maxFilesAhead(maxFilesAhead)
+    , filesAhead(0)
+    , reading(0)
+    , wakePending(false)
+    , quit(false)
+{
+    // Every block has at most one read in flight and there is at most one
+    // wake-up besides them, so the submission queue never fills.
+    unsigned entries = 1;
+    while (entries < blockCount + 1 && entries < 4096) {
+        entries *= 2;
+    }
+    blockCount = std::min<size_t>(blockCount, entries - 1);
+    ring = Ring::create(entries, blockCount);
+    if (ring) {
+        memory.reset(new char[blockSize * blockCount]);
+        blocks.resize(blockCount);
+        for (size_t i = 0; i != blockCount; i++) {
+            blocks[i] = {memory.get() + i * blockSize, 0, 0, 0, BlockState::Free, nullptr};
+            freeBlocks.push_back(static_cast<int>(blockCount - 1 - i));
+        }
+    }
+
+    worker = std::thread([this]
+    {
+        run();
+    });
+}
+
+ReadAhead::~ReadAhead()
+{
+    {
+        std::lock_guard<std::mutex> lg(m);
+        quit = true;
+        if (ring) {
+            submitWake();
+        }
+    }
+    announcedCv.notify_all();
+    worker.join();
+}
+
+bool ReadAhead::isAsynchronous() const
+{
+    return ring != nullptr;
+}
+
+size_t ReadAhead::blockSize() const
+{
+    return blockBytes;
+}
+
+void ReadAhead::prefetch(const QString &path, qint64 size)
+{
+#ifdef Q_OS_LINUX
+    if (size <= 0) {
+        return;
+    }
+
+    QByteArray encoded = QFile::encodeName(path);
+    std::lock_guard<std::mutex> lg(m);
+    while (!announced.empty() && (announced.front()->taken || announced.front()->abandoned)) {
+        announced.pop_front();
+    }
+    if (quit || pending.contains(encoded) || announced.size() >= static_cast<size_t>(ReadAhead::maxAnnounced)
+            || pending.size() >= ReadAhead::maxAnnounced) {
+        return;
+    }
+    auto file = std::make_shared<File>(encoded);
+    file->size = size;
+    pending.insert(encoded, file);
+    announced.push_back(file);
+    if (filesAhead < maxFilesAhead) {
+        if (ring && !wakePending) {
+            submitWake();
+        }
+        announcedCv.notify_one();
+    }
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(size);
+#endif
+}
+
+// Takes over the file if it was announced, otherwise opens it on the spot;
+// the stream is closed when reads are not asynchronous or the file can't
+// be opened.
+ReadAhead::Stream ReadAhead::open(const QString &path)
+{
+    QByteArray encoded = QFile::encodeName(path);
+    Stream stream;
+    std::unique_lock<std::mutex> lg(m);
+    std::shared_ptr<File> file = pending.take(encoded);
+    if (file) {
+        file->taken = true;
+        if (file->started) {
+            filesAhead--;
+            if (ring && !wakePending) {
+                submitWake();
+            }
+            announcedCv.notify_one();
+        }
+    }
+    if (!ring) {
+        return stream;
+    }
+
+    if (file && file->started) {
+        filledCv.wait(lg, [&file]
+        {
+            return !file->opening;
+        });
+    } else {
+        lg.unlock();
+        file = std::make_shared<File>(encoded);
+        file->started = true;
+        file->taken = true;
+        file->openNow();
+        lg.lock();
+    }
+
+    if (file->failed) {
+        abandon(file);
+        return stream;
+    }
+    stream.owner = this;
+    stream.file = file;
+    return stream;
+}
+
+// Drops every announced file; reads already in flight finish into blocks
+// that go straight back to the pool.
+void ReadAhead::clear()
+{
+    std::lock_guard<std::mutex> lg(m);
+    for (const std::shared_ptr<File> &file : pending) {
+        abandon(file);
+    }
+    pending.clear();
+    announced.clear();
+    filesAhead = 0;
+}
+
+void ReadAhead::run()
+{
+    std::unique_lock<std::mutex> lg(m);
+    if (ring) {
+        while (!quit || reading != 0) {
+            // With no read in flight and no wake-up queued, as when the
+            // ring refused one, nothing would end a wait on the ring.
+            if (reading == 0 && !wakePending) {
+                announcedCv.wait(lg, [this]
+                {
+                    return quit || reading != 0 || wakePending
+                            || (filesAhead < maxFilesAhead && !announced.empty()
+                                && freeBlocks.size() > blocks.size() / 2);
+                });
+                startNext(lg);
+                continue;
+            }
+
+            lg.unlock();
+            if (!ring->wait()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            lg.lock();
+            ring->reap([this](uint64_t token, int result)
+            {
+                complete(token, result);
+            });
+            filledCv.notify_all();
+            startNext(lg);
+        }
+        return;
+    }
+
+    for (;;) {
+        announcedCv.wait(lg, [this]
+        {
+            return quit || (filesAhead < maxFilesAhead && !announced.empty());
+        });
+        if (quit) {
+            return;
+        }
+        startNext(lg);
+    }
+}
+
+// Opens announced files and queues their first reads while the budget
+// lasts; without a ring it only has the kernel read them ahead.
+void ReadAhead::startNext(std::unique_lock<std::mutex> &lg)
+{
+    while (!quit && filesAhead < maxFilesAhead && !announced.empty()
+           && (!ring || freeBlocks.size() > blocks.size() / 2)) {
+        std::shared_ptr<File> file = announced.front();
+        announced.pop_front();
+        if (file->taken || file->abandoned) {
+            continue;
+        }
+        file->started = true;
+        file->opening = true;
+        filesAhead++;
+
+        lg.unlock();
+        if (ring) {
+            file->openNow();
+        } else {
+#ifdef Q_OS_LINUX
+            int fd = ::open(file->path.constData(), O_RDONLY | O_CLOEXEC);
+            if (fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                ::close(fd);
+            }
+#endif
+        }
+        lg.lock();
+
+        file->opening = false;
+        filledCv.notify_all();
+        if (ring && !file->failed && !file->taken && !file->abandoned) {
+            fill(file, ReadAhead::prefetchBlocks, blocks.size() / 2);
+        }
+    }
+}
+
+// Queues reads of the file until 'depth' of its blocks are queued or
+// filled, leaving at least 'reserve' blocks in the pool.
+void ReadAhead::fill(const std::shared_ptr<File> &file, size_t depth, size_t reserve)
+{
+    while (file->blocks.size() < depth && file->submitted < file->size && freeBlocks.size() > reserve) {
+        int index = freeBlocks.back();
+        freeBlocks.pop_back();
+
+        Block &block = blocks[index];
+        block.offset = file->submitted;
+        block.length = static_cast<size_t>(std::min<qint64>(blockBytes, file->size - file->submitted));
+        block.filled = 0;
+        block.state = BlockState::Reading;
+        block.file = file;
+        file->submitted += block.length;
+        file->blocks.push_back(index);
+        submitRead(index);
+    }
+}
+
+// Queues the rest of the block; when the ring refuses it, the block is
+// left for its stream to read.
+void ReadAhead::submitRead(int index)
+{
+    Block &block = blocks[index];
+    if (!block.file->synchronous
+            && ring->read(index, block.file->fd, block.data + block.filled, block.length - block.filled,
+                          block.offset + static_cast<qint64>(block.filled))) {
+        if (reading++ == 0) {
+            announcedCv.notify_one();
+        }
+        return;
+    }
+    block.file->synchronous = true;
+    block.state = BlockState::Deferred;
+}
+
+void ReadAhead::readNow(int fd, Block &block)
+{
+#ifdef READAHEAD_IO_URING
+    while (block.filled < block.length) {
+        ssize_t result = pread(fd, block.data + block.filled, block.length - block.filled,
+                               static_cast<off_t>(block.offset + static_cast<qint64>(block.filled)));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            block.state = result < 0 ? BlockState::Failed : BlockState::Ready;
+            return;
+        }
+        block.filled += static_cast<size_t>(result);
+    }
+#else
+    Q_UNUSED(fd);
+#endif
+    block.state = BlockState::Ready;
+}
+
+void ReadAhead::submitWake()
+{
+    wakePending = ring->nop(ReadAhead::wakeToken);
+}
+
+void ReadAhead::complete(uint64_t token, int result)
+{
+    if (token == ReadAhead::wakeToken) {
+        wakePending = false;
+        return;
+    }
+
+    int index = static_cast<int>(token);
+    Block &block = blocks[index];
+    reading--;
+    bool again = false;
+#ifdef READAHEAD_IO_URING
+    again = result == -EINTR || result == -EAGAIN;
+#endif
+    if (!again && result < 0) {
+        block.state = BlockState::Failed;
+    } else if (!again) {
+        // A short read in the middle of a file is continued; nothing read
+        // means the file shrank since it was stat'ed.
+        block.filled += static_cast<size_t>(result);
+        again = result != 0 && block.filled < block.length;
+        if (!again) {
+            block.state = BlockState::Ready;
+        }
+    }
+    if (again) {
+        submitRead(index);
+        if (block.state == BlockState::Reading) {
+            return;
+        }
+    }
+
+    if (block.file->abandoned) {
+        release(index);
+    }
+}
+
+void ReadAhead::release(int index)
+{
+    Block &block = blocks[index];
+    block.state = BlockState::Free;
+    block.file.reset();
+    freeBlocks.push_back(index);
+    filledCv.notify_all();
+    if (!announced.empty() && filesAhead < maxFilesAhead && !wakePending) {
+        submitWake();
+        announcedCv.notify_one();
+    }
+}
+
+// Gives back the blocks of a file nobody is going to read; those still
+// being read are released when their reads complete.
+void ReadAhead::abandon(const std::shared_ptr<File> &file)
+{
+    file->abandoned = true;
+    for (int index : file->blocks) {
+        if (blocks[index].state != BlockState::Reading) {
+            release(index);
+        }
+    }
+    file->blocks.clear();
+}
+
+bool ReadAhead::advance(Stream &stream, const char **data, size_t *size)
+{
+    std::unique_lock<std::mutex> lg(m);
+    const std::shared_ptr<File> &file = stream.file;
+    if (stream.current != -1) {
+        release(stream.current);
+        stream.current = -1;
+    }
+
+    fill(file, ReadAhead::blocksPerFile, 0);
+    if (file->blocks.empty()) {
+        if (file->failed || file->submitted >= file->size) {
+            return false;
+        }
+        // Other files hold the whole pool; at least half of it never goes
+        // to announced files, so some block is released soon.
+        filledCv.wait(lg, [this]
+        {
+            return !freeBlocks.empty();
+        });
+        fill(file, ReadAhead::blocksPerFile, 0);
+    }
+
+    int index = file->blocks.front();
+    filledCv.wait(lg, [this, index]
+    {
+        return blocks[index].state != BlockState::Reading;
+    });
+    file->blocks.pop_front();
+    stream.current = index;
+
+    Block &block = blocks[index];
+    if (block.state == BlockState::Deferred) {
+        // The block is the stream's now, no other thread touches it.
+        lg.unlock();
+        readNow(file->fd, block);
+        lg.lock();
+    }
+    if (block.state == BlockState::Failed) {
+        file->failed = true;
+        return false;
+    }
+    if (block.filled == 0) {
+        return false;
+    }
+
+    // Queue the replacement read right away, so it overlaps with matching
+    // the block handed out.
+    fill(file, ReadAhead::blocksPerFile, 0);
+    *data = block.data;
+    *size = block.filled;
+    return true;
+}
@@ -0,0 +1,126 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+// Reads files ahead of the scanners. prefetch() announces a file that is
+// about to be scanned; in announcement order, and while no more than
+// maxFilesAhead announced files and half of the block pool are committed to
+// them, a background thread opens them and queues reads of their first
+// blocks. A scanner picks a file up with open() and consumes it block by
+// block through a Stream: every consumed block goes back to the pool and
+// another read of the file is queued in its place, keeping up to
+// blocksPerFile reads in flight per file. Blocks come from a fixed pool, so
+// memory stays bounded however far the crawl runs ahead; at most
+// maxAnnounced files wait to be started, later ones are read when opened.
+//
+// Reads are submitted to an io_uring and reaped by the background thread.
+// Where io_uring is missing or refused (old kernels, seccomp filters, other
+// systems) isAsynchronous() is false: the background thread then only asks
+// the kernel to read the announced files ahead (posix_fadvise WILLNEED),
+// open() returns a closed stream and the caller reads the file itself. When
+// the ring refuses a read (EAGAIN, EBUSY, ENOMEM) the stream reads that
+// block and the rest of its file with pread() instead.
+class ReadAhead
+{
+private:
+    struct File;
+    struct Ring;
+
+    enum class BlockState
+    {
+        Free,
+        Reading,
+        Ready,
+        Failed,
+        Deferred
+    };
+
+    struct Block
+    {
+        char *data;
+        size_t length;
+        size_t filled;
+        qint64 offset;
+        BlockState state;
+        std::shared_ptr<File> file;
+    };
+
+public:
+    class Stream
+    {
+    public:
+        Stream();
+        Stream(Stream &&other);
+        Stream &operator=(Stream &&other);
+        ~Stream();
+
+        bool isOpen() const;
+        bool failed() const;
+        bool next(const char **data, size_t *size);
+
+    private:
+        friend class ReadAhead;
+
+        void close();
+
+        ReadAhead *owner;
+        std::shared_ptr<File> file;
+        int current;
+    };
+
+    ReadAhead(size_t blockSize, size_t blockCount, size_t maxFilesAhead);
+    ~ReadAhead();
+
+    bool isAsynchronous() const;
+    size_t blockSize() const;
+    void prefetch(const QString &path, qint64 size);
+    Stream open(const QString &path);
+    void clear();
+
+private:
+    void run();
+    void startNext(std::unique_lock<std::mutex> &lg);
+    void fill(const std::shared_ptr<File> &file, size_t depth, size_t reserve);
+    void submitRead(int block);
+    static void readNow(int fd, Block &block);
+    void submitWake();
+    void complete(uint64_t token, int result);
+    void release(int block);
+    void abandon(const std::shared_ptr<File> &file);
+    bool advance(Stream &stream, const char **data, size_t *size);
+
+private:
+    static const size_t blocksPerFile = 4;
+    static const size_t prefetchBlocks = 2;
+    static const uint64_t wakeToken = ~0ull;
+    static const int maxAnnounced = 64 * 1024;
+
+    const size_t blockBytes;
+    const size_t maxFilesAhead;
+    std::unique_ptr<Ring> ring;
+    std::unique_ptr<char[]> memory;
+    std::vector<Block> blocks;
+    std::vector<int> freeBlocks;
+    std::deque<std::shared_ptr<File>> announced;
+    QHash<QByteArray, std::shared_ptr<File>> pending;
+    size_t filesAhead;
+    size_t reading;
+    bool wakePending;
+    bool quit;
+
+    std::mutex m;
+    std::condition_variable filledCv;
+    std::condition_variable announcedCv;
+    std::thread worker;
+};
+
+#endif // READAHEAD_H
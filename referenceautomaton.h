@@ -0,0 +1,32 @@
+#ifndef REFERENCEAUTOMATON_H
+#define REFERENCEAUTOMATON_H
+
+#include <map>
+#include <vector>
+#include <QChar>
+#include <QString>
+
+class ReferenceAutomaton
+{
+private:
+    struct State
+    {
+        bool terminal;
+        std::map<QChar, int> transitions;
+    };
+
+private:
+    explicit ReferenceAutomaton(size_t size);
+
+public:
+    static ReferenceAutomaton fromString(const QString &string);
+    bool step(const QChar &current, bool autoReset = false);
+    void reset();
+    bool isTerminal() const;
+
+private:
+    int activeStateIdx;
+    std::vector<State> states;
+};
+
+#endif // REFERENCEAUTOMATON_H
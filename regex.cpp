@@ -0,0 +1,1172 @@
+#include <algorithm>
+
+#include "regex.h"
+
+namespace {
+
+typedef std::pair<uint32_t, uint32_t> CodeRange;
+typedef std::vector<std::pair<uint8_t, uint8_t>> ByteSequence;
+
+const uint32_t maxCodePoint = 0x10ffff;
+const int maxRepeat = 1000;
+const size_t maxLiterals = 64;
+const uint32_t maxLiteralClass = 16;
+
+std::string encodeUtf8(uint32_t c)
+{
+    std::string result;
+    if (c < 0x80) {
+        result += static_cast<char>(c);
+    } else if (c < 0x800) {
+        result += static_cast<char>(0xc0 | (c >> 6));
+        result += static_cast<char>(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        result += static_cast<char>(0xe0 | (c >> 12));
+        result += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+        result += static_cast<char>(0x80 | (c & 0x3f));
+    } else {
+        result += static_cast<char>(0xf0 | (c >> 18));
+        result += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+        result += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+        result += static_cast<char>(0x80 | (c & 0x3f));
+    }
+    return result;
+}
+
+// Splits a code point range into byte sequences whose UTF-8 encodings are
+// exactly the cartesian products of per-position byte ranges.
+void utf8Sequences(uint32_t lo, uint32_t hi, std::vector<ByteSequence> &out)
+{
+    if (lo > hi) {
+        return;
+    }
+    if (lo <= 0xdfff && hi >= 0xd800) {
+        if (lo < 0xd800) {
+            utf8Sequences(lo, 0xd7ff, out);
+        }
+        if (hi > 0xdfff) {
+            utf8Sequences(0xe000, hi, out);
+        }
+        return;
+    }
+
+    static const uint32_t limits[] = {0x7f, 0x7ff, 0xffff};
+    for (uint32_t limit : limits) {
+        if (lo <= limit && hi > limit) {
+            utf8Sequences(lo, limit, out);
+            utf8Sequences(limit + 1, hi, out);
+            return;
+        }
+    }
+
+    for (int i = 1; i < 4; i++) {
+        uint32_t mask = (1u << (6 * i)) - 1;
+        if ((lo & ~mask) != (hi & ~mask)) {
+            if ((lo & mask) != 0) {
+                utf8Sequences(lo, lo | mask, out);
+                utf8Sequences((lo | mask) + 1, hi, out);
+                return;
+            }
+            if ((hi & mask) != mask) {
+                utf8Sequences(lo, (hi & ~mask) - 1, out);
+                utf8Sequences(hi & ~mask, hi, out);
+                return;
+            }
+        }
+    }
+
+    std::string first = encodeUtf8(lo);
+    std::string last = encodeUtf8(hi);
+    ByteSequence sequence;
+    for (size_t i = 0; i < first.size(); i++) {
+        sequence.emplace_back(static_cast<uint8_t>(first[i]), static_cast<uint8_t>(last[i]));
+    }
+    out.push_back(sequence);
+}
+
+std::vector<CodeRange> normalize(std::vector<CodeRange> ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<CodeRange> result;
+    for (const CodeRange &range : ranges) {
+        if (!result.empty() && range.first <= result.back().second + 1) {
+            result.back().second = std::max(result.back().second, range.second);
+        } else {
+            result.push_back(range);
+        }
+    }
+    return result;
+}
+
+std::vector<CodeRange> complement(const std::vector<CodeRange> &ranges)
+{
+    std::vector<CodeRange> result;
+    uint32_t next = 0;
+    for (const CodeRange &range : normalize(ranges)) {
+        if (range.first > next) {
+            result.emplace_back(next, range.first - 1);
+        }
+        next = range.second + 1;
+    }
+    if (next <= maxCodePoint) {
+        result.emplace_back(next, maxCodePoint);
+    }
+    return result;
+}
+
+// Adds every code point that folds to the same case as one already in the
+// ranges; code points beyond the supplementary multilingual plane have no
+// case and are left alone.
+std::vector<CodeRange> foldCase(const std::vector<CodeRange> &ranges)
+{
+    std::vector<CodeRange> result = ranges;
+    for (const CodeRange &range : ranges) {
+        for (uint32_t c = range.first; c <= std::min<uint32_t>(range.second, 0x1ffff); c++) {
+            for (uint variant : Automaton::caseVariants(c)) {
+                if (variant != c) {
+                    result.emplace_back(variant, variant);
+                }
+            }
+        }
+    }
+    return normalize(result);
+}
+
+std::vector<std::string> cross(const std::vector<std::string> &lhs, const std::vector<std::string> &rhs)
+{
+    std::vector<std::string> result;
+    if (lhs.size() * rhs.size() > maxLiterals) {
+        return result;
+    }
+    for (const std::string &head : lhs) {
+        for (const std::string &tail : rhs) {
+            result.push_back(head + tail);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+size_t score(const std::vector<std::string> &strings)
+{
+    if (strings.empty()) {
+        return 0;
+    }
+    size_t shortest = strings.front().size();
+    for (const std::string &str : strings) {
+        shortest = std::min(shortest, str.size());
+    }
+    return shortest;
+}
+
+std::vector<std::string> best(const std::vector<std::vector<std::string>> &candidates)
+{
+    std::vector<std::string> result;
+    for (const std::vector<std::string> &candidate : candidates) {
+        size_t current = score(result);
+        size_t next = score(candidate);
+        if (next > current || (next == current && next != 0 && candidate.size() < result.size())) {
+            result = candidate;
+        }
+    }
+    return result;
+}
+
+}
+
+struct Regex::Node
+{
+    enum Type
+    {
+        Empty,
+        Ranges,
+        Concat,
+        Alternate,
+        Repeat,
+        Bol,
+        Eol
+    };
+
+    explicit Node(Type type)
+        : type(type)
+        , min(0)
+        , max(0)
+    {}
+
+    Type type;
+    std::vector<CodeRange> ranges;
+    std::vector<NodePtr> children;
+    int min;
+    int max;
+};
+
+struct Regex::Literals
+{
+    bool exact;
+    std::vector<std::string> strings;
+};
+
+struct Regex::Parser
+{
+    Parser(const QString &pattern, bool fold);
+
+    NodePtr parseAlternate();
+    NodePtr parseConcat();
+    NodePtr parseRepeat();
+    NodePtr parseAtom();
+    NodePtr parseClass();
+    bool parseEscape(std::vector<CodeRange> &ranges);
+    bool parseBounds(int &min, int &max);
+    bool parseNumber(int &value);
+    NodePtr fail(const QString &message);
+
+    bool atEnd() const;
+    uint32_t peek() const;
+
+    std::vector<uint32_t> text;
+    size_t pos;
+    bool fold;
+    QString error;
+};
+
+Regex::Parser::Parser(const QString &pattern, bool fold)
+    : pos(0)
+    , fold(fold)
+{
+    for (int i = 0; i < pattern.size(); i++) {
+        uint32_t c = pattern.at(i).unicode();
+        if (QChar::isHighSurrogate(c) && i + 1 < pattern.size() && pattern.at(i + 1).isLowSurrogate()) {
+            c = QChar::surrogateToUcs4(static_cast<ushort>(c), pattern.at(++i).unicode());
+        }
+        text.push_back(c);
+    }
+}
+
+bool Regex::Parser::atEnd() const
+{
+    return pos == text.size();
+}
+
+uint32_t Regex::Parser::peek() const
+{
+    return text[pos];
+}
+
+Regex::NodePtr Regex::Parser::fail(const QString &message)
+{
+    if (error.isEmpty()) {
+        error = QString("%1 at position %2").arg(message).arg(static_cast<int>(pos));
+    }
+    return NodePtr();
+}
+
+Regex::NodePtr Regex::Parser::parseAlternate()
+{
+    NodePtr first = parseConcat();
+    if (!first || atEnd() || peek() != '|') {
+        return first;
+    }
+
+    auto node = std::make_shared<Node>(Node::Alternate);
+    node->children.push_back(first);
+    while (!atEnd() && peek() == '|') {
+        pos++;
+        NodePtr next = parseConcat();
+        if (!next) {
+            return next;
+        }
+        node->children.push_back(next);
+    }
+    return node;
+}
+
+Regex::NodePtr Regex::Parser::parseConcat()
+{
+    auto node = std::make_shared<Node>(Node::Concat);
+    while (!atEnd() && peek() != '|' && peek() != ')') {
+        NodePtr next = parseRepeat();
+        if (!next) {
+            return next;
+        }
+        node->children.push_back(next);
+    }
+
+    if (node->children.empty()) {
+        return std::make_shared<Node>(Node::Empty);
+    }
+    if (node->children.size() == 1) {
+        return node->children.front();
+    }
+    return node;
+}
+
+Regex::NodePtr Regex::Parser::parseRepeat()
+{
+    NodePtr atom = parseAtom();
+    if (!atom) {
+        return atom;
+    }
+
+    while (!atEnd()) {
+        int min;
+        int max;
+        size_t start = pos;
+        uint32_t c = peek();
+        if (c == '*') {
+            min = 0;
+            max = -1;
+            pos++;
+        } else if (c == '+') {
+            min = 1;
+            max = -1;
+            pos++;
+        } else if (c == '?') {
+            min = 0;
+            max = 1;
+            pos++;
+        } else if (c == '{') {
+            pos++;
+            if (!parseBounds(min, max)) {
+                if (!error.isEmpty()) {
+                    return NodePtr();
+                }
+                pos = start;
+                break;
+            }
+        } else {
+            break;
+        }
+
+        if (!atEnd() && peek() == '?') {
+            pos++;
+        }
+
+        auto node = std::make_shared<Node>(Node::Repeat);
+        node->children.push_back(atom);
+        node->min = min;
+        node->max = max;
+        atom = node;
+    }
+
+    return atom;
+}
+
+bool Regex::Parser::parseNumber(int &value)
+{
+    size_t start = pos;
+    value = 0;
+    while (!atEnd() && peek() >= '0' && peek() <= '9') {
+        value = std::min(value * 10 + static_cast<int>(peek() - '0'), maxRepeat + 1);
+        pos++;
+    }
+    return pos != start;
+}
+
+bool Regex::Parser::parseBounds(int &min, int &max)
+{
+    if (!parseNumber(min)) {
+        return false;
+    }
+    max = min;
+    if (!atEnd() && peek() == ',') {
+        pos++;
+        if (!parseNumber(max)) {
+            max = -1;
+        }
+    }
+    if (atEnd() || peek() != '}') {
+        return false;
+    }
+    pos++;
+
+    if (min > maxRepeat || max > maxRepeat) {
+        fail("Repetition count is too large");
+        return false;
+    }
+    if (max != -1 && max < min) {
+        fail("Invalid repetition range");
+        return false;
+    }
+    return true;
+}
+
+Regex::NodePtr Regex::Parser::parseAtom()
+{
+    uint32_t c = peek();
+    switch (c) {
+    case '(': {
+        pos++;
+        if (pos + 1 < text.size() && peek() == '?') {
+            if (text[pos + 1] != ':') {
+                return fail("Unsupported group syntax");
+            }
+            pos += 2;
+        }
+        NodePtr inner = parseAlternate();
+        if (!inner) {
+            return inner;
+        }
+        if (atEnd() || peek() != ')') {
+            return fail("Missing closing parenthesis");
+        }
+        pos++;
+        return inner;
+    }
+    case '[':
+        pos++;
+        return parseClass();
+    case '*':
+    case '+':
+    case '?':
+        return fail("Nothing to repeat");
+    case '.': {
+        pos++;
+        auto node = std::make_shared<Node>(Node::Ranges);
+        node->ranges = complement({CodeRange('\n', '\n')});
+        return node;
+    }
+    case '^':
+        pos++;
+        return std::make_shared<Node>(Node::Bol);
+    case '$':
+        pos++;
+        return std::make_shared<Node>(Node::Eol);
+    case '\\': {
+        pos++;
+        auto node = std::make_shared<Node>(Node::Ranges);
+        if (!parseEscape(node->ranges)) {
+            return NodePtr();
+        }
+        if (fold) {
+            node->ranges = foldCase(node->ranges);
+        }
+        return node;
+    }
+    default: {
+        pos++;
+        auto node = std::make_shared<Node>(Node::Ranges);
+        node->ranges.emplace_back(c, c);
+        if (fold) {
+            node->ranges = foldCase(node->ranges);
+        }
+        return node;
+    }
+    }
+}
+
+Regex::NodePtr Regex::Parser::parseClass()
+{
+    bool negated = false;
+    if (!atEnd() && peek() == '^') {
+        negated = true;
+        pos++;
+    }
+
+    std::vector<CodeRange> ranges;
+    bool first = true;
+    for (;;) {
+        if (atEnd()) {
+            return fail("Missing closing bracket");
+        }
+        uint32_t c = peek();
+        if (c == ']' && !first) {
+            pos++;
+            break;
+        }
+        first = false;
+
+        std::vector<CodeRange> item;
+        pos++;
+        if (c == '\\') {
+            if (!parseEscape(item)) {
+                return NodePtr();
+            }
+        } else {
+            item.emplace_back(c, c);
+        }
+
+        if (item.size() == 1 && item.front().first == item.front().second
+                && pos + 1 < text.size() && peek() == '-' && text[pos + 1] != ']') {
+            pos++;
+            uint32_t hi = peek();
+            pos++;
+            if (hi == '\\') {
+                std::vector<CodeRange> escaped;
+                if (!parseEscape(escaped)) {
+                    return NodePtr();
+                }
+                if (escaped.size() != 1 || escaped.front().first != escaped.front().second) {
+                    return fail("Invalid class range");
+                }
+                hi = escaped.front().first;
+            }
+            if (hi < item.front().first) {
+                return fail("Invalid class range");
+            }
+            item.front().second = hi;
+        }
+        ranges.insert(ranges.end(), item.begin(), item.end());
+    }
+
+    if (fold) {
+        ranges = foldCase(ranges);
+    }
+    auto node = std::make_shared<Node>(Node::Ranges);
+    node->ranges = negated ? complement(ranges) : normalize(ranges);
+    return node;
+}
+
+bool Regex::Parser::parseEscape(std::vector<CodeRange> &ranges)
+{
+    if (atEnd()) {
+        fail("Trailing backslash");
+        return false;
+    }
+
+    static const std::vector<CodeRange> digit = {{'0', '9'}};
+    static const std::vector<CodeRange> word = {{'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'}};
+    static const std::vector<CodeRange> space = {{'\t', '\r'}, {' ', ' '}};
+
+    uint32_t c = peek();
+    pos++;
+    switch (c) {
+    case 'd':
+        ranges = digit;
+        return true;
+    case 'D':
+        ranges = complement(digit);
+        return true;
+    case 'w':
+        ranges = word;
+        return true;
+    case 'W':
+        ranges = complement(word);
+        return true;
+    case 's':
+        ranges = space;
+        return true;
+    case 'S':
+        ranges = complement(space);
+        return true;
+    case 't':
+        c = '\t';
+        break;
+    case 'n':
+        c = '\n';
+        break;
+    case 'r':
+        c = '\r';
+        break;
+    case 'f':
+        c = '\f';
+        break;
+    case 'v':
+        c = '\v';
+        break;
+    case 'x': {
+        bool braced = !atEnd() && peek() == '{';
+        if (braced) {
+            pos++;
+        }
+        c = 0;
+        int digits = 0;
+        while (!atEnd() && (braced || digits < 2)) {
+            uint32_t h = peek();
+            int value = h >= '0' && h <= '9' ? h - '0'
+                      : h >= 'a' && h <= 'f' ? h - 'a' + 10
+                      : h >= 'A' && h <= 'F' ? h - 'A' + 10 : -1;
+            if (value < 0) {
+                break;
+            }
+            c = c * 16 + value;
+            digits++;
+            pos++;
+            if (c > maxCodePoint) {
+                fail("Code point out of range");
+                return false;
+            }
+        }
+        if (digits == 0 || (!braced && digits != 2)) {
+            fail("Invalid hexadecimal escape");
+            return false;
+        }
+        if (braced) {
+            if (atEnd() || peek() != '}') {
+                fail("Invalid hexadecimal escape");
+                return false;
+            }
+            pos++;
+        }
+        break;
+    }
+    default:
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+            pos--;
+            fail("Unsupported escape sequence");
+            return false;
+        }
+    }
+
+    ranges.assign(1, CodeRange(c, c));
+    return true;
+}
+
+Regex::Regex(const QString &pattern, Automaton::CaseFolding folding)
+    : source(pattern)
+    , nfaStart(-1)
+    , classCount(0)
+{
+    Parser parser(pattern, folding != Automaton::CaseFolding::None);
+    NodePtr root = parser.parseAlternate();
+    if (root && !parser.atEnd()) {
+        root = parser.fail("Unmatched closing parenthesis");
+    }
+    if (!root) {
+        error = parser.error;
+        return;
+    }
+
+    Fragment fragment = compile(root);
+    patch(fragment, addNfaState(NfaState::Match));
+    nfaStart = fragment.start;
+    if (nfa.size() > maxNfaStates) {
+        error = "Pattern is too complex";
+        nfa.clear();
+        return;
+    }
+    buildByteClasses();
+
+    Literals top = literals(root);
+    if (score(top.strings) != 0) {
+        required = top.strings;
+        std::vector<QByteArray> encoded;
+        for (const std::string &literal : required) {
+            encoded.emplace_back(literal.data(), static_cast<int>(literal.size()));
+        }
+        literalFilter = Automaton::fromUtf8(encoded);
+    }
+}
+
+bool Regex::isValid() const
+{
+    return error.isEmpty();
+}
+
+QString Regex::errorString() const
+{
+    return error;
+}
+
+QString Regex::pattern() const
+{
+    return source;
+}
+
+bool Regex::hasPrefilter() const
+{
+    return !required.empty();
+}
+
+const Automaton &Regex::prefilter() const
+{
+    return literalFilter;
+}
+
+const std::vector<std::string> &Regex::requiredLiterals() const
+{
+    return required;
+}
+
+int Regex::addNfaState(NfaState::Type type, uint8_t lo, uint8_t hi, int out, int out1)
+{
+    nfa.push_back({type, lo, hi, out, out1});
+    return static_cast<int>(nfa.size() - 1);
+}
+
+void Regex::patch(const Fragment &fragment, int target)
+{
+    for (const std::pair<int, bool> &out : fragment.outs) {
+        if (out.second) {
+            nfa[out.first].out1 = target;
+        } else {
+            nfa[out.first].out = target;
+        }
+    }
+}
+
+Regex::Fragment Regex::compileSequence(const std::vector<std::pair<uint8_t, uint8_t>> &bytes)
+{
+    Fragment fragment = {-1, {}};
+    for (const std::pair<uint8_t, uint8_t> &range : bytes) {
+        int state = addNfaState(NfaState::Range, range.first, range.second);
+        if (fragment.start == -1) {
+            fragment.start = state;
+        } else {
+            patch(fragment, state);
+        }
+        fragment.outs.assign(1, std::make_pair(state, false));
+    }
+    return fragment;
+}
+
+Regex::Fragment Regex::compileRanges(const std::vector<std::pair<uint32_t, uint32_t>> &ranges)
+{
+    std::vector<ByteSequence> sequences;
+    for (const CodeRange &range : ranges) {
+        utf8Sequences(range.first, std::min(range.second, maxCodePoint), sequences);
+    }
+
+    if (sequences.empty()) {
+        int never = addNfaState(NfaState::Range, 1, 0);
+        return {never, {std::make_pair(never, false)}};
+    }
+
+    Fragment result = compileSequence(sequences.back());
+    for (size_t i = sequences.size() - 1; i-- > 0;) {
+        Fragment branch = compileSequence(sequences[i]);
+        int split = addNfaState(NfaState::Split, 0, 0, branch.start, result.start);
+        branch.outs.insert(branch.outs.end(), result.outs.begin(), result.outs.end());
+        result = {split, branch.outs};
+    }
+    return result;
+}
+
+Regex::Fragment Regex::compile(const NodePtr &node)
+{
+    if (nfa.size() > maxNfaStates) {
+        int state = addNfaState(NfaState::Split);
+        return {state, {std::make_pair(state, false)}};
+    }
+
+    switch (node->type) {
+    case Node::Ranges:
+        return compileRanges(node->ranges);
+    case Node::Bol:
+    case Node::Eol: {
+        int state = addNfaState(node->type == Node::Bol ? NfaState::Bol : NfaState::Eol);
+        return {state, {std::make_pair(state, false)}};
+    }
+    case Node::Concat: {
+        Fragment result = compile(node->children.front());
+        for (size_t i = 1; i < node->children.size(); i++) {
+            Fragment next = compile(node->children[i]);
+            patch(result, next.start);
+            result.outs = next.outs;
+        }
+        return result;
+    }
+    case Node::Alternate: {
+        Fragment result = compile(node->children.back());
+        for (size_t i = node->children.size() - 1; i-- > 0;) {
+            Fragment branch = compile(node->children[i]);
+            int split = addNfaState(NfaState::Split, 0, 0, branch.start, result.start);
+            branch.outs.insert(branch.outs.end(), result.outs.begin(), result.outs.end());
+            result = {split, branch.outs};
+        }
+        return result;
+    }
+    case Node::Repeat: {
+        const NodePtr &child = node->children.front();
+        int start = addNfaState(NfaState::Split);
+        Fragment result = {start, {std::make_pair(start, false)}};
+
+        for (int i = 0; i < node->min; i++) {
+            Fragment next = compile(child);
+            patch(result, next.start);
+            result.outs = next.outs;
+        }
+
+        if (node->max == -1) {
+            Fragment body = compile(child);
+            int loop = addNfaState(NfaState::Split, 0, 0, body.start);
+            patch(body, loop);
+            patch(result, loop);
+            result.outs.assign(1, std::make_pair(loop, true));
+        } else {
+            std::vector<std::pair<int, bool>> exits;
+            for (int i = node->min; i < node->max; i++) {
+                Fragment body = compile(child);
+                int optional = addNfaState(NfaState::Split, 0, 0, body.start);
+                patch(result, optional);
+                exits.emplace_back(optional, true);
+                result.outs = body.outs;
+            }
+            result.outs.insert(result.outs.end(), exits.begin(), exits.end());
+        }
+        return result;
+    }
+    case Node::Empty:
+    default: {
+        int state = addNfaState(NfaState::Split);
+        return {state, {std::make_pair(state, false)}};
+    }
+    }
+}
+
+void Regex::buildByteClasses()
+{
+    bool boundary[257] = {};
+    for (const NfaState &state : nfa) {
+        if (state.type == NfaState::Range && state.lo <= state.hi) {
+            boundary[state.lo] = true;
+            boundary[state.hi + 1] = true;
+        }
+    }
+
+    classCount = 0;
+    classRepresentatives.clear();
+    for (int byte = 0; byte < 256; byte++) {
+        if (byte == 0 || boundary[byte]) {
+            classRepresentatives.push_back(static_cast<uint8_t>(byte));
+            classCount++;
+        }
+        byteClasses[byte] = static_cast<uint8_t>(classCount - 1);
+    }
+}
+
+void Regex::closure(std::vector<int> &set, std::vector<uint32_t> &marks, uint32_t mark, int state) const
+{
+    std::vector<int> stack(1, state);
+    while (!stack.empty()) {
+        int current = stack.back();
+        stack.pop_back();
+        if (current == -1 || marks[current] == mark) {
+            continue;
+        }
+        marks[current] = mark;
+
+        const NfaState &ns = nfa[current];
+        if (ns.type == NfaState::Split) {
+            stack.push_back(ns.out1);
+            stack.push_back(ns.out);
+        } else {
+            set.push_back(current);
+        }
+    }
+}
+
+// Marks tell which states a pass has visited; when the counter wraps
+// around, older marks could be mistaken for the current one, so they are
+// cleared.
+uint32_t Regex::nextMark(std::vector<uint32_t> &marks, uint32_t &mark)
+{
+    if (++mark == 0) {
+        std::fill(marks.begin(), marks.end(), 0);
+        mark = 1;
+    }
+    return mark;
+}
+
+bool Regex::find(const char *lineBegin, const char *lineEnd, const char *from,
+                 const char **matchBegin, const char **matchEnd, Scratch &scratch) const
+{
+    std::vector<uint32_t> &marks = scratch.marks;
+    if (marks.size() != nfa.size()) {
+        marks.assign(nfa.size(), 0);
+        scratch.mark = 0;
+    }
+    uint32_t &mark = scratch.mark;
+    nextMark(marks, mark);
+    std::vector<Thread> &current = scratch.current;
+    std::vector<Thread> &next = scratch.next;
+    std::vector<int> &stack = scratch.stack;
+    current.clear();
+
+    auto add = [&](std::vector<Thread> &list, int state, const char *start, const char *pos)
+    {
+        stack.assign(1, state);
+        while (!stack.empty()) {
+            int idx = stack.back();
+            stack.pop_back();
+            if (idx == -1 || marks[idx] == mark) {
+                continue;
+            }
+            marks[idx] = mark;
+
+            const NfaState &ns = nfa[idx];
+            switch (ns.type) {
+            case NfaState::Split:
+                stack.push_back(ns.out1);
+                stack.push_back(ns.out);
+                break;
+            case NfaState::Bol:
+                if (pos == lineBegin) {
+                    stack.push_back(ns.out);
+                }
+                break;
+            case NfaState::Eol:
+                if (pos == lineEnd) {
+                    stack.push_back(ns.out);
+                }
+                break;
+            default:
+                list.push_back({idx, start});
+            }
+        }
+    };
+
+    const char *bestBegin = nullptr;
+    const char *bestEnd = nullptr;
+    for (const char *pos = from;; pos++) {
+        if (bestBegin == nullptr) {
+            add(current, nfaStart, pos, pos);
+        }
+
+        for (const Thread &thread : current) {
+            if (nfa[thread.state].type == NfaState::Match
+                    && (bestBegin == nullptr || thread.start < bestBegin || (thread.start == bestBegin && pos > bestEnd))) {
+                bestBegin = thread.start;
+                bestEnd = pos;
+            }
+        }
+
+        if (pos == lineEnd) {
+            break;
+        }
+
+        nextMark(marks, mark);
+        next.clear();
+        uint8_t byte = static_cast<uint8_t>(*pos);
+        for (const Thread &thread : current) {
+            const NfaState &ns = nfa[thread.state];
+            if (ns.type == NfaState::Range && ns.lo <= byte && byte <= ns.hi
+                    && (bestBegin == nullptr || thread.start <= bestBegin)) {
+                add(next, ns.out, thread.start, pos + 1);
+            }
+        }
+        current.swap(next);
+
+        if (current.empty() && bestBegin != nullptr) {
+            break;
+        }
+    }
+
+    if (bestBegin == nullptr) {
+        return false;
+    }
+    *matchBegin = bestBegin;
+    *matchEnd = bestEnd;
+    return true;
+}
+
+Regex::Literals Regex::literals(const NodePtr &node)
+{
+    switch (node->type) {
+    case Node::Empty:
+    case Node::Bol:
+    case Node::Eol:
+        return {true, {std::string()}};
+    case Node::Ranges: {
+        uint32_t count = 0;
+        for (const CodeRange &range : node->ranges) {
+            count += range.second - range.first + 1;
+            if (count > maxLiteralClass) {
+                return {false, {}};
+            }
+        }
+        Literals result = {true, {}};
+        for (const CodeRange &range : node->ranges) {
+            for (uint32_t c = range.first; c <= range.second; c++) {
+                result.strings.push_back(encodeUtf8(c));
+            }
+        }
+        return result;
+    }
+    case Node::Concat: {
+        std::vector<std::string> run(1, std::string());
+        std::vector<std::vector<std::string>> candidates;
+        bool exact = true;
+        for (const NodePtr &child : node->children) {
+            Literals sub = literals(child);
+            if (sub.exact) {
+                std::vector<std::string> product = cross(run, sub.strings);
+                if (!product.empty()) {
+                    run = product;
+                    continue;
+                }
+            }
+            exact = false;
+            candidates.push_back(run);
+            candidates.push_back(sub.strings);
+            run.assign(1, std::string());
+        }
+        if (exact) {
+            return {true, run};
+        }
+        candidates.push_back(run);
+        return {false, best(candidates)};
+    }
+    case Node::Alternate: {
+        Literals result = {true, {}};
+        for (const NodePtr &child : node->children) {
+            Literals sub = literals(child);
+            if (sub.strings.empty()) {
+                return {false, {}};
+            }
+            result.exact = result.exact && sub.exact;
+            result.strings.insert(result.strings.end(), sub.strings.begin(), sub.strings.end());
+        }
+        std::sort(result.strings.begin(), result.strings.end());
+        result.strings.erase(std::unique(result.strings.begin(), result.strings.end()), result.strings.end());
+        if (result.strings.size() > maxLiterals) {
+            return {false, {}};
+        }
+        return result;
+    }
+    case Node::Repeat: {
+        Literals sub = literals(node->children.front());
+        if (node->min == 0) {
+            if (node->max == 1 && sub.exact) {
+                sub.strings.push_back(std::string());
+                return sub;
+            }
+            return {false, {}};
+        }
+        if (sub.exact && node->min == node->max) {
+            std::vector<std::string> product(1, std::string());
+            for (int i = 0; i < node->min && !product.empty(); i++) {
+                product = cross(product, sub.strings);
+            }
+            if (!product.empty()) {
+                return {true, product};
+            }
+        }
+        return {false, sub.strings};
+    }
+    }
+    return {false, {}};
+}
+
+Regex::Scratch::Scratch()
+    : mark(0)
+{}
+
+Regex::Dfa::Dfa(const std::shared_ptr<const Regex> &regex)
+    : re(regex)
+    , stride(regex->classCount + 3)
+    , start(0)
+    , cacheBytes(0)
+    , marks(regex->nfa.size(), 0)
+    , mark(0)
+{
+    flush();
+}
+
+const Regex *Regex::Dfa::regex() const
+{
+    return re.get();
+}
+
+size_t Regex::Dfa::stateCount() const
+{
+    return sets.size();
+}
+
+void Regex::Dfa::flush()
+{
+    sets.clear();
+    accepting.clear();
+    table.clear();
+    index.clear();
+    cacheBytes = 0;
+
+    std::vector<int> set;
+    re->closure(set, marks, nextMark(marks, mark), re->nfaStart);
+    std::sort(set.begin(), set.end());
+    start = addState(std::move(set));
+}
+
+int Regex::Dfa::addState(std::vector<int> &&set)
+{
+    bool match = false;
+    for (int state : set) {
+        match = match || re->nfa[state].type == NfaState::Match;
+    }
+
+    int idx = static_cast<int>(sets.size());
+    cacheBytes += stride * sizeof(int32_t) + 2 * set.size() * sizeof(int) + 128;
+    index.emplace(set, idx);
+    sets.push_back(std::move(set));
+    accepting.push_back(match);
+    table.resize(table.size() + stride, -1);
+    return idx;
+}
+
+int Regex::Dfa::next(int state, int symbol)
+{
+    int32_t cached = table[state * stride + symbol];
+    if (cached != -1) {
+        return cached;
+    }
+
+    // Past the byte classes come three assertion symbols: the start of the
+    // line, its end, and both at once for an empty line.
+    bool bol = symbol == re->classCount || symbol == re->classCount + 2;
+    bool eol = symbol == re->classCount + 1 || symbol == re->classCount + 2;
+    std::vector<int> target;
+    nextMark(marks, mark);
+    for (int idx : sets[state]) {
+        const NfaState &ns = re->nfa[idx];
+        bool follow;
+        if (symbol < re->classCount) {
+            uint8_t byte = re->classRepresentatives[symbol];
+            follow = ns.type == NfaState::Range && ns.lo <= byte && byte <= ns.hi;
+        } else {
+            follow = (bol && ns.type == NfaState::Bol) || (eol && ns.type == NfaState::Eol);
+        }
+        if (follow) {
+            re->closure(target, marks, mark, ns.out);
+        }
+    }
+    re->closure(target, marks, mark, re->nfaStart);
+    // An assertion still holds for the ones reached through it (^^a, a$$,
+    // (^)*a), so they are followed until no new state turns up.
+    for (size_t i = 0; i < target.size() && (bol || eol); i++) {
+        const NfaState &ns = re->nfa[target[i]];
+        if ((bol && ns.type == NfaState::Bol) || (eol && ns.type == NfaState::Eol)) {
+            re->closure(target, marks, mark, ns.out);
+        }
+    }
+    std::sort(target.begin(), target.end());
+
+    auto found = index.find(target);
+    if (found != index.end()) {
+        table[state * stride + symbol] = found->second;
+        return found->second;
+    }
+
+    if (cacheBytes > maxCacheBytes) {
+        flush();
+        return addState(std::move(target));
+    }
+
+    int idx = addState(std::move(target));
+    table[state * stride + symbol] = idx;
+    return idx;
+}
+
+bool Regex::Dfa::isMatch(const char *begin, const char *end)
+{
+    if (begin == end) {
+        return accepting[next(start, re->classCount + 2)];
+    }
+
+    int state = next(start, re->classCount);
+    for (const char *p = begin; p != end; p++) {
+        if (accepting[state]) {
+            return true;
+        }
+        state = next(state, re->byteClasses[static_cast<uint8_t>(*p)]);
+    }
+    if (accepting[state]) {
+        return true;
+    }
+    return accepting[next(state, re->classCount + 1)];
+}
+
+bool Regex::Dfa::find(const char *lineBegin, const char *lineEnd, const char *from,
+                      const char **matchBegin, const char **matchEnd)
+{
+    return re->find(lineBegin, lineEnd, from, matchBegin, matchEnd, scratch);
+}
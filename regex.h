@@ -0,0 +1,148 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <QString>
+
+#include "automaton.h"
+
+// Line-oriented regular expression engine. The pattern is parsed into a
+// Thompson NFA over UTF-8 bytes. Lines are tested by a lazily built DFA
+// (Regex::Dfa), and only the lines it accepts are run through an NFA
+// simulation to recover leftmost-longest match spans. Literals that every
+// match must contain are extracted at compile time and exposed as an
+// Aho-Corasick prefilter, so lines without them never reach the DFA.
+//
+// Supported syntax: literals, '.', [...] classes with ranges and negation,
+// \d \w \s \D \W \S, \t \n \r \f \v \xHH \x{H...}, groups (...) and (?:...),
+// '|', '*', '+', '?', {n}, {n,}, {n,m} (a trailing lazy '?' is accepted and
+// ignored) and the line anchors '^' and '$'.
+//
+// With case folding every literal and class is widened to the code points
+// that fold to the same case, before a class is negated. Only simple
+// (one to one) folds apply here; CaseFolding::Full is treated as Simple.
+class Regex
+{
+private:
+    struct Node;
+    struct Parser;
+    struct Literals;
+    typedef std::shared_ptr<Node> NodePtr;
+
+    struct NfaState
+    {
+        enum Type
+        {
+            Range,
+            Split,
+            Bol,
+            Eol,
+            Match
+        };
+
+        Type type;
+        uint8_t lo;
+        uint8_t hi;
+        int out;
+        int out1;
+    };
+
+    struct Fragment
+    {
+        int start;
+        std::vector<std::pair<int, bool>> outs;
+    };
+
+    struct Thread
+    {
+        int state;
+        const char *start;
+    };
+
+public:
+    // Buffers find() reuses from one call to the next; one per thread.
+    struct Scratch
+    {
+        Scratch();
+
+        std::vector<uint32_t> marks;
+        uint32_t mark;
+        std::vector<Thread> current;
+        std::vector<Thread> next;
+        std::vector<int> stack;
+    };
+
+    class Dfa
+    {
+    public:
+        explicit Dfa(const std::shared_ptr<const Regex> &regex);
+
+        bool isMatch(const char *begin, const char *end);
+        bool find(const char *lineBegin, const char *lineEnd, const char *from,
+                  const char **matchBegin, const char **matchEnd);
+        const Regex *regex() const;
+        size_t stateCount() const;
+
+    private:
+        int addState(std::vector<int> &&set);
+        int next(int state, int symbol);
+        void flush();
+
+    private:
+        static const size_t maxCacheBytes = 2 * 1024 * 1024;
+
+        std::shared_ptr<const Regex> re;
+        int stride;
+        int start;
+        size_t cacheBytes;
+        std::vector<std::vector<int>> sets;
+        std::vector<char> accepting;
+        std::vector<int32_t> table;
+        std::map<std::vector<int>, int> index;
+        std::vector<uint32_t> marks;
+        uint32_t mark;
+        Scratch scratch;
+    };
+
+public:
+    explicit Regex(const QString &pattern, Automaton::CaseFolding folding = Automaton::CaseFolding::None);
+
+    bool isValid() const;
+    QString errorString() const;
+    QString pattern() const;
+    bool hasPrefilter() const;
+    const Automaton &prefilter() const;
+    const std::vector<std::string> &requiredLiterals() const;
+    bool find(const char *lineBegin, const char *lineEnd, const char *from,
+              const char **matchBegin, const char **matchEnd, Scratch &scratch) const;
+
+private:
+    Fragment compile(const NodePtr &node);
+    Fragment compileSequence(const std::vector<std::pair<uint8_t, uint8_t>> &bytes);
+    Fragment compileRanges(const std::vector<std::pair<uint32_t, uint32_t>> &ranges);
+    int addNfaState(NfaState::Type type, uint8_t lo = 0, uint8_t hi = 0, int out = -1, int out1 = -1);
+    void patch(const Fragment &fragment, int target);
+    void buildByteClasses();
+    void closure(std::vector<int> &set, std::vector<uint32_t> &marks, uint32_t mark, int state) const;
+    static uint32_t nextMark(std::vector<uint32_t> &marks, uint32_t &mark);
+    static Literals literals(const NodePtr &node);
+
+private:
+    static const size_t maxNfaStates = 200000;
+
+    QString source;
+    QString error;
+    std::vector<NfaState> nfa;
+    int nfaStart;
+    int classCount;
+    uint8_t byteClasses[256];
+    std::vector<uint8_t> classRepresentatives;
+    std::vector<std::string> required;
+    Automaton literalFilter;
+};
+
+#endif // REGEX_H
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <QRegularExpression>
+#include <QtTest>
+
+#include "regex.h"
+#include "regextest.h"
+
+namespace {
+
+const uint seed = 1;
+
+const QString plainAlphabet = QStringLiteral("abc1 _-");
+const QString anchorAlphabet = QStringLiteral("abc");
+const QString prefilterAlphabet = QStringLiteral("abcABC1 ");
+// Letters with a simple folding, some of them folding across scripts or
+// across UTF-8 lengths: K KELVIN SIGN, LONG S and E WITH ACUTE.
+const QString foldingAlphabet = QString::fromUtf8("aAkKKsſSéÉb");
+
+const QStringList plainAtoms = QString("a b c ab 1 _ -").split(' ');
+const QStringList anchorAtoms = QString("a b c ab ^ $").split(' ');
+const QStringList classAtoms = QString(". [ab] [^a] [a-c] [^a-b1] [_-] \\d \\w \\s \\D \\W \\S").split(' ');
+const QStringList repeatedAtoms = QString("a b ab . [ab] [^a] \\d \\w").split(' ');
+// Class escapes are left out: Regex widens them like any class, while
+// the reference matches \w and the like without regard to case.
+const QStringList foldingAtoms = QString::fromUtf8("a k K K s S ſ é É . [a-k] [^s] [kK] [éb]").split(' ');
+const QStringList literalAtoms = QString("ab abc ba c1 a . [ab] \\w").split(' ');
+
+const QStringList noQuantifiers = QStringList() << QString();
+// Mostly none, so that the quantified atoms stand between literals.
+const QStringList quantifiers = QString(",,,*,+,?,{2},{1,2},{0,3},{2,}").split(',');
+
+}
+
+QString RegexTest::randomString(std::mt19937 &rng, const QString &alphabet, int minSize, int maxSize)
+{
+    QString result;
+    int size = minSize + static_cast<int>(rng() % static_cast<uint>(maxSize - minSize + 1));
+    for (int i = 0; i < size; i++) {
+        result += alphabet.at(static_cast<int>(rng() % static_cast<uint>(alphabet.size())));
+    }
+    return result;
+}
+
+// One to three atoms, each with one of 'quantifiers', or while 'depth'
+// allows, an alternation of two shorter patterns. A group only takes '?',
+// since nested repetition makes the reference backtrack for too long.
+QString RegexTest::randomPattern(std::mt19937 &rng, const QStringList &atoms, const QStringList &quantifiers,
+                                 int depth)
+{
+    QString pattern;
+    int count = 1 + static_cast<int>(rng() % 3);
+    for (int i = 0; i < count; i++) {
+        if (depth > 0 && rng() % 5 == 0) {
+            pattern += "(" + randomPattern(rng, atoms, quantifiers, depth - 1) + "|"
+                    + randomPattern(rng, atoms, quantifiers, depth - 1) + ")";
+            if (quantifiers.size() > 1 && rng() % 4 == 0) {
+                pattern += "?";
+            }
+            continue;
+        }
+        pattern += atoms.at(static_cast<int>(rng() % static_cast<uint>(atoms.size())));
+        pattern += quantifiers.at(static_cast<int>(rng() % static_cast<uint>(quantifiers.size())));
+    }
+    return pattern;
+}
+
+// Describes the first disagreement with the reference, if any: whether the
+// DFA accepts the line, whether the prefilter lets it through and the span
+// found from every character on.
+QString RegexTest::compare(const QString &pattern, Automaton::CaseFolding folding, const QString &text)
+{
+    auto regex = std::make_shared<Regex>(pattern, folding);
+    QString context = QString("pattern \"%1\", text \"%2\"").arg(pattern, text);
+    if (!regex->isValid()) {
+        return context + ": " + regex->errorString();
+    }
+
+    // The end of the longest match starting at each character, -1 where
+    // none does. Ends are tried from the last one down.
+    QRegularExpression::PatternOptions options = folding == Automaton::CaseFolding::None
+            ? QRegularExpression::NoPatternOption : QRegularExpression::CaseInsensitiveOption;
+    std::vector<int> longest(static_cast<size_t>(text.size()) + 1, -1);
+    for (int end = text.size(); end >= 0; end--) {
+        QRegularExpression ending(QString("(?:%1)(?<=^.{%2})").arg(pattern).arg(end), options);
+        for (int start = 0; start <= end; start++) {
+            if (longest[start] == -1
+                    && ending.match(text, start, QRegularExpression::NormalMatch,
+                                    QRegularExpression::AnchoredMatchOption).hasMatch()) {
+                longest[start] = end;
+            }
+        }
+    }
+
+    QByteArray line = text.toUtf8();
+    std::vector<int> offsets;
+    for (int i = 0; i <= text.size(); i++) {
+        offsets.push_back(text.left(i).toUtf8().size());
+    }
+
+    const char *begin = line.constData();
+    const char *end = begin + line.size();
+    Regex::Dfa dfa(regex);
+    bool matched = std::any_of(longest.begin(), longest.end(), [](int matchEnd)
+    {
+        return matchEnd != -1;
+    });
+    if (dfa.isMatch(begin, end) != matched) {
+        return context + (matched ? ": rejected by the DFA" : ": accepted by the DFA");
+    }
+
+    if (matched && regex->hasPrefilter()) {
+        Automaton filter = regex->prefilter();
+        filter.reset();
+        bool hit = false;
+        for (char byte : line) {
+            hit = filter.stepByte(static_cast<uint8_t>(byte)) || hit;
+        }
+        if (!hit) {
+            return context + ": dropped by the prefilter";
+        }
+    }
+
+    for (int from = 0; from <= text.size(); from++) {
+        int start = from;
+        while (start <= text.size() && longest[start] == -1) {
+            start++;
+        }
+        bool expected = start <= text.size();
+        const char *matchBegin = nullptr;
+        const char *matchEnd = nullptr;
+        bool found = dfa.find(begin, end, begin + offsets[from], &matchBegin, &matchEnd);
+        if (found != expected || (found && (matchBegin - begin != offsets[start]
+                                            || matchEnd - begin != offsets[longest[start]]))) {
+            return context + QString(", from byte %1: found %2, expected %3")
+                    .arg(offsets[from])
+                    .arg(found ? QString("%1-%2").arg(matchBegin - begin).arg(matchEnd - begin) : "none")
+                    .arg(expected ? QString("%1-%2").arg(offsets[start]).arg(offsets[longest[start]]) : "none");
+        }
+    }
+    return QString();
+}
+
+void RegexTest::literals()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QString pattern = randomPattern(rng, plainAtoms, noQuantifiers, 1);
+        QString text = randomString(rng, plainAlphabet, 0, maxTextSize);
+        QString mismatch = compare(pattern, Automaton::CaseFolding::None, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void RegexTest::anchors()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QString pattern = randomPattern(rng, anchorAtoms, noQuantifiers, 1);
+        if (rng() % 2 == 0) {
+            pattern.prepend('^');
+        }
+        if (rng() % 2 == 0) {
+            pattern.append('$');
+        }
+        QString text = randomString(rng, anchorAlphabet, 0, maxTextSize / 2);
+        QString mismatch = compare(pattern, Automaton::CaseFolding::None, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void RegexTest::classes()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QString pattern = randomPattern(rng, classAtoms, noQuantifiers, 1);
+        QString text = randomString(rng, plainAlphabet, 0, maxTextSize);
+        QString mismatch = compare(pattern, Automaton::CaseFolding::None, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void RegexTest::repetition()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QString pattern = randomPattern(rng, repeatedAtoms, quantifiers, 2);
+        QString text = randomString(rng, plainAlphabet, 0, maxTextSize);
+        QString mismatch = compare(pattern, Automaton::CaseFolding::None, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void RegexTest::caseFolding()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QString pattern = randomPattern(rng, foldingAtoms, quantifiers, 1);
+        QString text = randomString(rng, foldingAlphabet, 0, maxTextSize);
+        QString mismatch = compare(pattern, Automaton::CaseFolding::Simple, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
+
+void RegexTest::prefilter()
+{
+    std::mt19937 rng(seed);
+    for (int it = 0; it < iterations; it++) {
+        QString pattern = randomPattern(rng, literalAtoms, quantifiers, 2);
+        QString text = randomString(rng, prefilterAlphabet, 0, maxTextSize);
+        Automaton::CaseFolding folding = it % 2 == 0 ? Automaton::CaseFolding::None : Automaton::CaseFolding::Simple;
+        QString mismatch = compare(pattern, folding, text);
+        QVERIFY2(mismatch.isEmpty(), qPrintable(mismatch));
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef REGEXTEST_H
+#define REGEXTEST_H
+
+#include <random>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include "automaton.h"
+
+// Differential tests of Regex against QRegularExpression over random
+// patterns and lines. Regex reports the leftmost-longest match, so the
+// reference tries every start and end of the line with a lookbehind that
+// pins the end. Every start a search may resume from has to give the same
+// span, the DFA has to accept exactly the lines with a match, and the
+// literal prefilter has to hit every such line.
+class RegexTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static QString randomString(std::mt19937 &rng, const QString &alphabet, int minSize, int maxSize);
+    static QString randomPattern(std::mt19937 &rng, const QStringList &atoms, const QStringList &quantifiers,
+                                 int depth);
+    static QString compare(const QString &pattern, Automaton::CaseFolding folding, const QString &text);
+
+private slots:
+    void literals();
+    void anchors();
+    void classes();
+    void repetition();
+    void caseFolding();
+    void prefilter();
+
+private:
+    static const int iterations = 500;
+    static const int maxTextSize = 16;
+};
+
+#endif // REGEXTEST_H
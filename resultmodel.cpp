@@ -0,0 +1,141 @@
+#include <climits>
+#include <QColor>
+#include <QFont>
+
+#include "resultmodel.h"
+
+ResultModel::ResultModel(QObject *parent)
+    : QAbstractTableModel(parent)
+{}
+
+void ResultModel::apply(const Finder::EntryList &result)
+{
+    if (result.first || !result.removed.isEmpty()) {
+        beginResetModel();
+        if (result.first) {
+            store.reset(result.paths, result.scanMode);
+        }
+        store.remove(result.removed);
+        cache.clear();
+        endResetModel();
+    }
+
+    int first = rowCount();
+    int last = static_cast<int>(std::min<size_t>(store.size() + result.list.size(), INT_MAX)) - 1;
+    if (last < first) {
+        store.append(result.list);
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), first, last);
+    store.append(result.list);
+    endInsertRows();
+}
+
+size_t ResultModel::size() const
+{
+    return store.size();
+}
+
+Finder::Entry ResultModel::entry(size_t row)
+{
+    return store.entry(row);
+}
+
+Finder::EntryList ResultModel::snapshot() const
+{
+    return store.snapshot();
+}
+
+int ResultModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return static_cast<int>(std::min<size_t>(store.size(), INT_MAX));
+}
+
+int ResultModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant ResultModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rowCount()) {
+        return QVariant();
+    }
+
+    switch (role) {
+    case Qt::DisplayRole:
+    case Qt::ToolTipRole: {
+        const Finder::Entry &item = cachedEntry(index.row());
+        switch (index.column()) {
+        case FileColumn:
+            return item.filePath;
+        case LineColumn:
+            return static_cast<qulonglong>(item.line);
+        case BeforeColumn:
+            return item.before;
+        case MatchColumn:
+            return item.entry;
+        case AfterColumn:
+            return item.after;
+        }
+        break;
+    }
+    case Qt::TextAlignmentRole:
+        if (index.column() == LineColumn || index.column() == BeforeColumn) {
+            return static_cast<int>(Qt::AlignRight | Qt::AlignVCenter);
+        }
+        break;
+    case Qt::ForegroundRole:
+        if (index.column() == FileColumn) {
+            return QColor("purple");
+        }
+        if (index.column() == MatchColumn) {
+            return QColor("blue");
+        }
+        break;
+    case Qt::FontRole:
+        if (index.column() == MatchColumn) {
+            QFont font;
+            font.setBold(true);
+            return font;
+        }
+        break;
+    }
+    return QVariant();
+}
+
+QVariant ResultModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+
+    switch (section) {
+    case FileColumn:
+        return QString("File");
+    case LineColumn:
+        return QString("Line");
+    case BeforeColumn:
+        return QString("Before");
+    case MatchColumn:
+        return QString("Match");
+    case AfterColumn:
+        return QString("After");
+    }
+    return QVariant();
+}
+
+const Finder::Entry &ResultModel::cachedEntry(int row) const
+{
+    if (!cache.contains(row)) {
+        if (cache.size() >= ResultModel::cacheSize) {
+            cache.clear();
+        }
+        cache.insert(row, store.entry(row));
+    }
+    return cache[row];
+}
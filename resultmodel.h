@@ -0,0 +1,50 @@
+#ifndef RESULTMODEL_H
+#define RESULTMODEL_H
+
+#include <QAbstractTableModel>
+#include <QHash>
+
+#include "finder.h"
+#include "matchstore.h"
+
+// Table of all matches of the current search, backed by a MatchStore. Rows
+// are only turned into text when the view asks for them, and the entries
+// of recently shown rows are cached, so the cost of the model does not
+// depend on how many matches there are beyond the store itself.
+class ResultModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    enum Column
+    {
+        FileColumn,
+        LineColumn,
+        BeforeColumn,
+        MatchColumn,
+        AfterColumn,
+        ColumnCount
+    };
+
+    explicit ResultModel(QObject *parent = nullptr);
+
+    void apply(const Finder::EntryList &result);
+    size_t size() const;
+    Finder::Entry entry(size_t row);
+    Finder::EntryList snapshot() const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    const Finder::Entry &cachedEntry(int row) const;
+
+private:
+    static const int cacheSize = 1024;
+
+    mutable MatchStore store;
+    mutable QHash<int, Finder::Entry> cache;
+};
+
+#endif // RESULTMODEL_H
@@ -0,0 +1,370 @@
+#include <algorithm>
+#include <cstring>
+
+#include "helpers.h"
+#include "scanner.h"
+
+const size_t Scanner::maxCharSize;
+
+namespace {
+
+size_t utf8SequenceSize(char lead)
+{
+    uint8_t byte = static_cast<uint8_t>(lead);
+    return byte < 0xc0 ? 1 : byte < 0xe0 ? 2 : byte < 0xf0 ? 3 : 4;
+}
+
+uint decodeUtf8(const char *data, size_t size)
+{
+    uint8_t lead = static_cast<uint8_t>(data[0]);
+    if (lead < 0x80) {
+        return lead;
+    }
+    size_t expected = utf8SequenceSize(data[0]);
+    if (lead < 0xc0 || size < expected) {
+        return QChar::ReplacementCharacter;
+    }
+
+    uint c = lead & (0x7f >> expected);
+    for (size_t i = 1; i != expected; i++) {
+        if (!isUtf8Continuation(data[i])) {
+            return QChar::ReplacementCharacter;
+        }
+        c = c << 6 | (static_cast<uint8_t>(data[i]) & 0x3f);
+    }
+    return c;
+}
+
+bool isWordChar(uint c)
+{
+    return c == '_' || QChar::isLetterOrNumber(c) || QChar::isMark(c);
+}
+
+}
+
+Scanner::Scanner(const QString &filePath, const Finder::Search &search, Regex::Dfa *dfa)
+    : filePath(filePath)
+    , paths(search.paths.get())
+    , file(0)
+    , interned(false)
+    , maxPatternSize(search.automaton.maxMatchLength())
+    , wholeWords(search.wholeWords)
+    , limit(search.fileLimit())
+    , counting(search.reportMode == Finder::ReportMode::Count)
+    , automaton(search.automaton)
+    , dfa(dfa)
+    , regex(search.regex.get())
+    , lineOffset(0)
+    , prefilterOffset(0)
+    , lineNo(1)
+    , countedOffset(0)
+    , bufferOffset(0)
+    , total(0)
+{
+    automaton.reset();
+    if (regex != nullptr) {
+        prefilter = regex->prefilter();
+    }
+}
+
+void Scanner::scanMapped(const char *data, size_t size, size_t from, size_t to)
+{
+    process(data, 0, size, from, to, true);
+}
+
+uint64_t Scanner::scanChunk(const char *data, size_t size, size_t from, size_t to)
+{
+    if (regex != nullptr) {
+        size_t start = lineStart(data, size, from);
+        size_t end = std::max(start, lineStart(data, size, to));
+        lineOffset = prefilterOffset = countedOffset = start;
+        lineNo = 1;
+        process(data, 0, size, start, end, true);
+        return lineNo - 1;
+    }
+
+    // Lines are counted from 'from', so a match that starts on an earlier
+    // line gets a wrapped around number that the shift brings back in range.
+    size_t start = from - std::min(from, maxPatternSize - std::min<size_t>(maxPatternSize, 1));
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+    automaton.reset();
+    for (size_t i = start; i < from; i++) {
+        automaton.stepByte(bytes[i]);
+    }
+    countedOffset = start;
+    lineNo = 1 - static_cast<uint64_t>(std::count(data + start, data + from, '\n'));
+    process(data, 0, size, from, to, true);
+    return lineNo - 1;
+}
+
+size_t Scanner::lookBehind() const
+{
+    return maxPatternSize + (wholeWords ? Scanner::maxCharSize : 0);
+}
+
+size_t Scanner::lookAhead() const
+{
+    return wholeWords && regex == nullptr ? Scanner::maxCharSize : 0;
+}
+
+void Scanner::feed(const char *data, size_t size)
+{
+    size_t from = buffer.size();
+    buffer.append(data, static_cast<int>(size));
+    size_t to = buffer.size();
+
+    process(buffer.constData(), bufferOffset, to, from, to, false);
+
+    size_t keep = to < lookBehind() ? 0 : to - lookBehind();
+    if (regex != nullptr) {
+        keep = std::min<size_t>(keep, lineOffset - bufferOffset);
+    }
+
+    buffer.remove(0, static_cast<int>(keep));
+    bufferOffset += keep;
+}
+
+void Scanner::finish()
+{
+    size_t size = buffer.size();
+    process(buffer.constData(), bufferOffset, size, size, size, true);
+    buffer.clear();
+    if (counting && total != 0) {
+        matches.push_back({total, 0, 0, fileId(), 0});
+    }
+}
+
+uint64_t Scanner::matchCount() const
+{
+    return total;
+}
+
+bool Scanner::isFull() const
+{
+    return limit != 0 && total >= limit;
+}
+
+std::vector<Finder::Match> Scanner::takeMatches()
+{
+    std::vector<Finder::Match> tmp;
+    tmp.swap(matches);
+    return tmp;
+}
+
+void Scanner::process(const char *base, uint64_t baseOffset, size_t available, size_t from, size_t to, bool eof)
+{
+    if (isFull()) {
+        return;
+    }
+
+    size_t counted = countedOffset - baseOffset;
+    if (regex != nullptr) {
+        processLines(base, baseOffset, available, to, eof, counted);
+        if (counted < to) {
+            lineNo += std::count(base + counted, base + to, '\n');
+            counted = to;
+        }
+        countedOffset = baseOffset + counted;
+        return;
+    }
+
+    if (!heldWords.empty()) {
+        resolveWords(base, baseOffset, available, eof);
+    }
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(base);
+    for (size_t i = from; i < to; i++) {
+        if (!automaton.stepByte(bytes[i])) {
+            continue;
+        }
+
+        size_t matchEnd = i + 1;
+        automaton.forEachMatch([&](int output)
+        {
+            size_t length = automaton.matchLength(output, base, matchEnd);
+            size_t matchBegin = matchEnd - length;
+            if (counted < matchBegin) {
+                lineNo += std::count(base + counted, base + matchBegin, '\n');
+                counted = matchBegin;
+            }
+
+            int pattern = automaton.pattern(output);
+            if (wholeWords) {
+                Finder::Match match = {lineNo, static_cast<uint64_t>(pattern), baseOffset + matchBegin, 0,
+                                       static_cast<uint32_t>(length)};
+                pushWord(base, baseOffset, available, eof, match);
+            } else {
+                pushMatch(baseOffset + matchBegin, length, lineNo, pattern);
+            }
+        });
+        if (isFull()) {
+            return;
+        }
+    }
+
+    // A match ending in the next block may start in this one.
+    size_t safe = eof ? to : to - std::min(to, maxPatternSize - std::min<size_t>(maxPatternSize, 1));
+    if (counted < safe) {
+        lineNo += std::count(base + counted, base + safe, '\n');
+        counted = safe;
+    }
+    countedOffset = baseOffset + counted;
+}
+
+void Scanner::processLines(const char *base, uint64_t baseOffset, size_t available, size_t to, bool eof, size_t &counted)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(base);
+    size_t line = lineOffset - baseOffset;
+    size_t pos = prefilterOffset - baseOffset;
+
+    while (line < to && !isFull()) {
+        size_t lineBegin = line;
+        size_t hit = line;
+        if (regex->hasPrefilter()) {
+            while (pos < to && !prefilter.stepByte(bytes[pos])) {
+                pos++;
+            }
+            if (pos == to) {
+                for (size_t i = to; i != line; i--) {
+                    if (base[i - 1] == '\n') {
+                        line = i;
+                        break;
+                    }
+                }
+                break;
+            }
+            hit = pos++;
+            for (lineBegin = hit; lineBegin != line && base[lineBegin - 1] != '\n'; lineBegin--) {
+            }
+        }
+
+        const char *newline = static_cast<const char *>(std::memchr(base + hit, '\n', available - hit));
+        size_t lineEnd = newline != nullptr ? newline - base : available;
+        if (newline == nullptr && !eof) {
+            line = pos = lineBegin;
+            prefilter.reset();
+            break;
+        }
+
+        matchLine(base, baseOffset, lineBegin, lineEnd, counted);
+        line = pos = lineEnd + 1;
+        prefilter.reset();
+    }
+
+    lineOffset = baseOffset + line;
+    prefilterOffset = baseOffset + std::max(pos, line);
+}
+
+void Scanner::matchLine(const char *base, uint64_t baseOffset, size_t lineBegin, size_t lineEnd, size_t &counted)
+{
+    const char *begin = base + lineBegin;
+    const char *end = base + lineEnd;
+    if (!dfa->isMatch(begin, end)) {
+        return;
+    }
+
+    if (counted < lineBegin) {
+        lineNo += std::count(base + counted, begin, '\n');
+        counted = lineBegin;
+    }
+
+    const char *matchBegin;
+    const char *matchEnd;
+    for (const char *from = begin; from <= end && !isFull() && dfa->find(begin, end, from, &matchBegin, &matchEnd);) {
+        if (matchBegin != matchEnd
+                && (!wholeWords || wordBoundary(base, lineEnd, matchBegin - base, matchEnd - base, true) > 0)) {
+            pushMatch(baseOffset + (matchBegin - base), matchEnd - matchBegin, lineNo, 0);
+            from = matchEnd;
+        } else {
+            from = matchBegin + 1;
+        }
+    }
+}
+
+void Scanner::pushMatch(uint64_t offset, size_t length, uint64_t line, int pattern)
+{
+    if (isFull()) {
+        return;
+    }
+    total++;
+    if (!counting) {
+        matches.push_back({line, static_cast<uint64_t>(pattern), offset, fileId(), static_cast<uint32_t>(length)});
+    }
+}
+
+// The path is interned with the first match, so that the table's lock is
+// only taken for files that have one.
+uint32_t Scanner::fileId()
+{
+    if (!interned && paths != nullptr) {
+        file = paths->intern(filePath);
+    }
+    interned = true;
+    return file;
+}
+
+void Scanner::pushWord(const char *base, uint64_t baseOffset, size_t available, bool eof, const Finder::Match &match)
+{
+    if (!heldWords.empty()) {
+        heldWords.push_back(match);
+        return;
+    }
+
+    size_t begin = match.offset - baseOffset;
+    int boundary = wordBoundary(base, available, begin, begin + match.length, eof);
+    if (boundary < 0) {
+        heldWords.push_back(match);
+    } else if (boundary > 0) {
+        pushMatch(match.offset, match.length, match.line, match.pattern);
+    }
+}
+
+void Scanner::resolveWords(const char *base, uint64_t baseOffset, size_t available, bool eof)
+{
+    size_t resolved = 0;
+    for (; resolved != heldWords.size(); resolved++) {
+        const Finder::Match &match = heldWords[resolved];
+        size_t begin = match.offset - baseOffset;
+        int boundary = wordBoundary(base, available, begin, begin + match.length, eof);
+        if (boundary < 0) {
+            break;
+        }
+        if (boundary > 0) {
+            pushMatch(match.offset, match.length, match.line, match.pattern);
+        }
+    }
+    heldWords.erase(heldWords.begin(), heldWords.begin() + resolved);
+}
+
+// 1 when [begin, end) of base stands as a whole word, 0 when it does not and
+// -1 when the character after it is not available yet.
+int Scanner::wordBoundary(const char *base, size_t available, size_t begin, size_t end, bool eof)
+{
+    if (begin != 0) {
+        size_t lead = begin - 1;
+        while (lead != 0 && begin - lead < Scanner::maxCharSize && isUtf8Continuation(base[lead])) {
+            lead--;
+        }
+        if (isWordChar(decodeUtf8(base + lead, begin - lead))) {
+            return 0;
+        }
+    }
+
+    if (end == available) {
+        return eof ? 1 : -1;
+    }
+    size_t size = utf8SequenceSize(base[end]);
+    if (end + size > available && !eof) {
+        return -1;
+    }
+    return isWordChar(decodeUtf8(base + end, std::min(size, available - end))) ? 0 : 1;
+}
+
+size_t Scanner::lineStart(const char *data, size_t size, size_t offset)
+{
+    if (offset == 0 || offset >= size) {
+        return std::min(offset, size);
+    }
+    const char *newline = static_cast<const char *>(std::memchr(data + offset - 1, '\n', size - offset + 1));
+    return newline != nullptr ? newline - data + 1 : size;
+}
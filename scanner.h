@@ -0,0 +1,86 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <vector>
+#include <QByteArray>
+#include <QString>
+
+#include "automaton.h"
+#include "finder.h"
+#include "regex.h"
+
+// Matches UTF-8 encoded patterns against the raw bytes of one file and
+// records each hit as a Finder::Match; no text is decoded while scanning.
+// Input arrives either as a complete mapping (scanMapped) or as consecutive
+// blocks (feed); in the latter case only the tail a pattern may still end in
+// is kept. Regular expressions are evaluated a whole line at a time, so
+// their carry is the unfinished last line.
+//
+// scanChunk handles one byte range of a file that is split between several
+// scanners. Literal matches belong to the chunk in which they end, regular
+// expression matches to the chunk in which their line starts, so adjacent
+// chunks never report the same match. Match lines are relative to the chunk
+// and have to be shifted by the total returned by the preceding chunks, match
+// offsets by the file offset of 'data'.
+//
+// For whole-word searches a match is dropped when a letter, digit, mark or
+// underscore touches either end. A literal match ending with a block is held
+// back until the next block (or finish) shows the character after it.
+//
+// Matches beyond the file's limit (Finder::Search::fileLimit) are dropped,
+// and once it is reached isFull() tells the caller to stop reading. In
+// Finder::ReportMode::Count no match is kept; finish() records their number
+// instead.
+class Scanner
+{
+public:
+    Scanner(const QString &filePath, const Finder::Search &search, Regex::Dfa *dfa = nullptr);
+
+    void scanMapped(const char *data, size_t size, size_t from, size_t to);
+    uint64_t scanChunk(const char *data, size_t size, size_t from, size_t to);
+    size_t lookBehind() const;
+    size_t lookAhead() const;
+    void feed(const char *data, size_t size);
+    void finish();
+    uint64_t matchCount() const;
+    bool isFull() const;
+    std::vector<Finder::Match> takeMatches();
+
+private:
+    void process(const char *base, uint64_t baseOffset, size_t available, size_t from, size_t to, bool eof);
+    void processLines(const char *base, uint64_t baseOffset, size_t available, size_t to, bool eof, size_t &counted);
+    void matchLine(const char *base, uint64_t baseOffset, size_t lineBegin, size_t lineEnd, size_t &counted);
+    uint32_t fileId();
+    void pushMatch(uint64_t offset, size_t length, uint64_t line, int pattern);
+    void pushWord(const char *base, uint64_t baseOffset, size_t available, bool eof, const Finder::Match &match);
+    void resolveWords(const char *base, uint64_t baseOffset, size_t available, bool eof);
+    static int wordBoundary(const char *base, size_t available, size_t begin, size_t end, bool eof);
+    static size_t lineStart(const char *data, size_t size, size_t offset);
+
+private:
+    static const size_t maxCharSize = 4;
+
+    QString filePath;
+    PathTable *paths;
+    uint32_t file;
+    bool interned;
+    size_t maxPatternSize;
+    bool wholeWords;
+    uint64_t limit;
+    bool counting;
+    Automaton automaton;
+    Regex::Dfa *dfa;
+    const Regex *regex;
+    Automaton prefilter;
+    uint64_t lineOffset;
+    uint64_t prefilterOffset;
+    uint64_t lineNo;
+    uint64_t countedOffset;
+    QByteArray buffer;
+    uint64_t bufferOffset;
+    std::vector<Finder::Match> matches;
+    std::vector<Finder::Match> heldWords;
+    uint64_t total;
+};
+
+#endif // SCANNER_H
@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <chrono>
+
+#include "crawler.h"
+#include "exportsink.h"
+#include "scanner.h"
+#include "sessionpool.h"
+
+const int SessionPool::maxCrawlThreadsCount;
+const qint64 SessionPool::binaryProbeSize;
+const int SessionPool::bufferedBlockSize;
+const qint64 SessionPool::mappingThreshold;
+const qint64 SessionPool::mappedBlockSize;
+const size_t SessionPool::maxCachedDfas;
+
+namespace {
+
+uint64_t elapsedNs(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+int poolSize(int threadsCount)
+{
+    return threadsCount > 0 ? threadsCount : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+}
+
+SessionPool::Session::Session(const QString &directory, Finder::Search &&search, int threadsCount)
+    : directory(directory)
+    , search(std::move(search))
+    , threadsCount(threadsCount)
+    , statusCode(1)
+    , cancelled(false)
+    , crawlFinished(false)
+    , entryCount(0)
+    , scannedCount(0)
+    , scannedSize(0)
+    , totalCount(0)
+    , totalSize(0)
+    , binaryCount(0)
+    , crawlNs(0)
+    , readNs(0)
+    , matchNs(0)
+{
+    result.paths = this->search.paths;
+    result.scanMode = this->search.scanMode;
+}
+
+Finder::EntryList SessionPool::Session::getResult()
+{
+    std::lock_guard<std::mutex> resultLg(resultM);
+    Finder::EntryList tmp(std::move(result));
+    result.first = false;
+    result.removed.clear();
+    result.list.clear();
+    result.paths = tmp.paths;
+    result.scanMode = tmp.scanMode;
+    return tmp;
+}
+
+// Same codes as Finder::getStatus().
+int SessionPool::Session::getStatus() const
+{
+    return statusCode.load();
+}
+
+Finder::Metrics SessionPool::Session::getMetrics() const
+{
+    Finder::Metrics metrics;
+    metrics.scannedCount = scannedCount.load();
+    metrics.scannedSize = scannedSize.load();
+    metrics.totalCount = totalCount.load();
+    metrics.totalSize = totalSize.load();
+    metrics.binaryCount = binaryCount.load();
+    metrics.threadsCount = threadsCount;
+    metrics.threadsReason = "shared";
+    metrics.scanOrder = Finder::ScanOrder::Crawl;
+    metrics.crawlNs = crawlNs.load();
+    metrics.readNs = readNs.load();
+    metrics.decodeNs = 0;
+    metrics.matchNs = matchNs.load();
+    metrics.idleNs = 0;
+    return metrics;
+}
+
+// Stops the crawl and drops the session from every task, queued or being
+// read; the results found so far stay.
+void SessionPool::Session::cancel()
+{
+    settle(3);
+}
+
+// Counts matches against the limit of the session, drops the ones beyond
+// it and stops the session once it is reached.
+void SessionPool::Session::publish(std::vector<Finder::Match> &&matches)
+{
+    if (matches.empty()) {
+        return;
+    }
+
+    bool reached = false;
+    if (search.maxCount != 0) {
+        uint64_t before = entryCount.fetch_add(matches.size());
+        reached = before + matches.size() >= search.maxCount;
+        matches.resize(before < search.maxCount ? std::min<uint64_t>(matches.size(), search.maxCount - before) : 0);
+    }
+
+    if (!matches.empty()) {
+        if (search.sink) {
+            search.sink->write(matches);
+        }
+        std::lock_guard<std::mutex> resultLg(resultM);
+        result.list.insert(result.list.end(), matches.begin(), matches.end());
+    }
+    if (reached) {
+        settle(6);
+    }
+}
+
+// Moves a working session to its final status; the first one wins.
+void SessionPool::Session::settle(int status)
+{
+    int working = 1;
+    if (!statusCode.compare_exchange_strong(working, status)) {
+        return;
+    }
+
+    if (status != 2) {
+        cancelled.store(true);
+    }
+    if (search.sink) {
+        search.sink->close();
+    }
+}
+
+void SessionPool::Session::finishIfDone()
+{
+    if (crawlFinished.load() && scannedCount.load() == totalCount.load()) {
+        settle(2);
+    }
+}
+
+SessionPool::SessionPool(int threadsCount)
+    : threadsCount(poolSize(threadsCount))
+    , quit(false)
+    , idleScanners(0)
+    , bytesRead(0)
+    , sharedReads(0)
+    , fileQueue(static_cast<size_t>(poolSize(threadsCount)))
+{
+    for (int i = 0; i != this->threadsCount; i++)
+    {
+        scanThreads.emplace_back([this, i]
+        {
+            scanLoop(i);
+        });
+    }
+}
+
+SessionPool::~SessionPool()
+{
+    {
+        std::lock_guard<std::mutex> crawlsLg(crawlsM);
+        for (const std::weak_ptr<Session> &weak : sessions) {
+            if (std::shared_ptr<Session> session = weak.lock()) {
+                session->cancel();
+            }
+        }
+        for (const std::unique_ptr<Crawl> &crawl : crawls) {
+            crawl->thread.join();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> queueLg(queueM);
+        quit = true;
+        scannerHasWorkCv.notify_all();
+    }
+    for (size_t i = 0; i != scanThreads.size(); i++)
+    {
+        scanThreads[i].join();
+    }
+}
+
+// Starts a search compiled by Finder::compileSearch in 'directory'. The
+// session runs until everything found is scanned, it is cancelled, its
+// match limit is reached or the pool is destroyed.
+std::shared_ptr<SessionPool::Session> SessionPool::start(const QString &directory, Finder::Search search)
+{
+    std::shared_ptr<Session> session(new Session(directory, std::move(search), threadsCount));
+    if (session->search.sink) {
+        session->search.sink->start(session->search.paths, session->search.scanMode, session->search.reportMode);
+    }
+    if (session->search.patterns.isEmpty()) {
+        session->settle(0);
+        return session;
+    }
+    if (session->search.regex && !session->search.regex->isValid()) {
+        session->settle(4);
+        return session;
+    }
+    // The offsets of text mode and the other orders are Finder's alone.
+    if (session->search.scanMode != Finder::ScanMode::Mapped
+            || session->search.scanOrder != Finder::ScanOrder::Crawl) {
+        session->settle(4);
+        return session;
+    }
+
+    std::lock_guard<std::mutex> crawlsLg(crawlsM);
+    auto end = std::remove_if(crawls.begin(), crawls.end(), [](const std::unique_ptr<Crawl> &crawl)
+    {
+        if (!crawl->done.load()) {
+            return false;
+        }
+        crawl->thread.join();
+        return true;
+    });
+    crawls.erase(end, crawls.end());
+    auto expired = std::remove_if(sessions.begin(), sessions.end(), [](const std::weak_ptr<Session> &weak)
+    {
+        return weak.expired();
+    });
+    sessions.erase(expired, sessions.end());
+
+    sessions.push_back(session);
+    crawls.emplace_back(new Crawl());
+    Crawl *record = crawls.back().get();
+    record->done.store(false);
+    record->thread = std::thread([this, session, record]
+    {
+        crawl(session);
+        record->done.store(true);
+    });
+    return session;
+}
+
+// Bytes read from files by all sessions; a file shared by several sessions
+// counts once.
+uint64_t SessionPool::readSize() const
+{
+    return bytesRead.load();
+}
+
+// Files read once for more than one session.
+uint64_t SessionPool::sharedCount() const
+{
+    return sharedReads.load();
+}
+
+void SessionPool::crawl(const std::shared_ptr<Session> &session)
+{
+    int threadsCount = std::min<int>(std::thread::hardware_concurrency(), SessionPool::maxCrawlThreadsCount);
+    Crawler crawler(session->cancelled, [&](const QString &filePath, qint64 size, qint64, uint64_t)
+    {
+        offer(session, filePath, size);
+    }, Crawler::DirectoryCallback(), session->search.filter);
+
+    auto started = std::chrono::steady_clock::now();
+    if (crawler.crawl(session->directory, std::max(threadsCount, 1))) {
+        session->crawlFinished.store(true);
+    }
+    session->crawlNs.store(elapsedNs(started));
+    session->finishIfDone();
+}
+
+void SessionPool::offer(const std::shared_ptr<Session> &session, const QString &filePath, qint64 size)
+{
+    session->totalCount++;
+    session->totalSize += size;
+
+    {
+        std::lock_guard<std::mutex> pendingLg(pendingM);
+        auto found = pending.constFind(filePath);
+        if (found != pending.constEnd()) {
+            found.value()->sessions.push_back(session);
+            return;
+        }
+
+        std::shared_ptr<Task> task(new Task());
+        task->path = filePath;
+        task->sessions.push_back(session);
+        pending.insert(filePath, task);
+        fileQueue.push(std::move(task));
+    }
+
+    if (idleScanners.load() != 0) {
+        std::lock_guard<std::mutex> queueLg(queueM);
+        scannerHasWorkCv.notify_one();
+    }
+}
+
+void SessionPool::scanLoop(int worker)
+{
+    std::vector<std::unique_ptr<Regex::Dfa>> dfas;
+    std::shared_ptr<Task> task;
+    for (;;)
+    {
+        if (!fileQueue.pop(worker, task)) {
+            std::unique_lock<std::mutex> queueLg(queueM);
+            idleScanners++;
+            scannerHasWorkCv.wait(queueLg, [this]
+            {
+                return !fileQueue.empty() || quit;
+            });
+            idleScanners--;
+
+            if (quit) {
+                return;
+            }
+            continue;
+        }
+
+        // From here on no session joins the task.
+        std::vector<std::shared_ptr<Session>> sessions;
+        {
+            std::lock_guard<std::mutex> pendingLg(pendingM);
+            pending.remove(task->path);
+            sessions = std::move(task->sessions);
+        }
+        auto end = std::remove_if(sessions.begin(), sessions.end(), [](const std::shared_ptr<Session> &session)
+        {
+            return session->cancelled.load();
+        });
+        sessions.erase(end, sessions.end());
+        if (dfas.size() > SessionPool::maxCachedDfas) {
+            dfas.erase(dfas.begin(), dfas.end() - SessionPool::maxCachedDfas);
+        }
+        if (!sessions.empty()) {
+            scan(task->path, std::move(sessions), dfas);
+        }
+        task.reset();
+    }
+}
+
+// Reads a file once and hands every block to the scanner of each session
+// that still wants more of it.
+void SessionPool::scan(const QString &path, std::vector<std::shared_ptr<Session>> &&sessions,
+                       std::vector<std::unique_ptr<Regex::Dfa>> &dfas)
+{
+    QFile fileObj(path);
+    bool opened = fileObj.open(QIODevice::ReadOnly);
+    qint64 size = opened ? fileObj.size() : 0;
+    uchar *mapped = nullptr;
+    if (opened && !fileObj.isSequential() && size >= SessionPool::mappingThreshold) {
+        mapped = fileObj.map(0, size);
+    }
+    const char *data = reinterpret_cast<const char *>(mapped);
+
+    bool binary = false;
+    if (mapped != nullptr) {
+        binary = Finder::isBinary(data, size);
+    } else if (opened) {
+        QByteArray head = fileObj.peek(SessionPool::binaryProbeSize);
+        binary = Finder::isBinary(head.constData(), head.size());
+    }
+
+    std::vector<std::unique_ptr<Scanner>> scanners(sessions.size());
+    for (size_t i = 0; i != sessions.size(); i++) {
+        const Finder::Search &search = sessions[i]->search;
+        if (binary && search.skipBinary) {
+            sessions[i]->binaryCount++;
+        } else if (opened) {
+            scanners[i].reset(new Scanner(path, search, dfaFor(search, dfas)));
+        }
+    }
+
+    auto wanted = [&](size_t i)
+    {
+        return scanners[i] && !sessions[i]->cancelled.load() && !scanners[i]->isFull();
+    };
+    auto anyWanted = [&]
+    {
+        for (size_t i = 0; i != scanners.size(); i++) {
+            if (wanted(i)) {
+                return true;
+            }
+        }
+        return false;
+    };
+    if (sessions.size() > 1 && anyWanted()) {
+        sharedReads++;
+    }
+
+    if (mapped != nullptr) {
+        for (qint64 from = 0; from < size && anyWanted(); from += SessionPool::mappedBlockSize) {
+            qint64 to = std::min(size, from + SessionPool::mappedBlockSize);
+            bytesRead += to - from;
+            for (size_t i = 0; i != scanners.size(); i++) {
+                if (!wanted(i)) {
+                    continue;
+                }
+                auto matching = std::chrono::steady_clock::now();
+                scanners[i]->scanMapped(data, size, from, to);
+                sessions[i]->matchNs += elapsedNs(matching);
+                sessions[i]->publish(scanners[i]->takeMatches());
+            }
+        }
+    } else if (anyWanted()) {
+        QByteArray block(SessionPool::bufferedBlockSize, Qt::Uninitialized);
+        qint64 read;
+        for (;;) {
+            auto reading = std::chrono::steady_clock::now();
+            if (!anyWanted() || (read = fileObj.read(block.data(), block.size())) <= 0) {
+                break;
+            }
+            uint64_t readTime = elapsedNs(reading);
+            bytesRead += read;
+            for (size_t i = 0; i != scanners.size(); i++) {
+                if (!wanted(i)) {
+                    continue;
+                }
+                sessions[i]->readNs += readTime;
+                auto matching = std::chrono::steady_clock::now();
+                scanners[i]->feed(block.constData(), read);
+                sessions[i]->matchNs += elapsedNs(matching);
+                sessions[i]->publish(scanners[i]->takeMatches());
+            }
+        }
+    }
+
+    for (size_t i = 0; i != sessions.size(); i++) {
+        Session &session = *sessions[i];
+        if (session.cancelled.load()) {
+            continue;
+        }
+        if (scanners[i]) {
+            scanners[i]->finish();
+            session.publish(scanners[i]->takeMatches());
+        }
+        session.scannedCount++;
+        session.scannedSize += size;
+        session.finishIfDone();
+    }
+
+    if (mapped != nullptr) {
+        fileObj.unmap(mapped);
+    }
+}
+
+// Each scanning thread keeps the automata of the regular expressions it met
+// last, trimmed to maxCachedDfas between files; a Dfa holds on to its Regex,
+// so an address never comes back for a different one.
+Regex::Dfa *SessionPool::dfaFor(const Finder::Search &search, std::vector<std::unique_ptr<Regex::Dfa>> &dfas)
+{
+    if (!search.regex) {
+        return nullptr;
+    }
+
+    for (const std::unique_ptr<Regex::Dfa> &dfa : dfas) {
+        if (dfa->regex() == search.regex.get()) {
+            return dfa.get();
+        }
+    }
+    dfas.emplace_back(new Regex::Dfa(search.regex));
+    return dfas.back().get();
+}
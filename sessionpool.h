@@ -0,0 +1,129 @@
+#ifndef SESSIONPOOL_H
+#define SESSIONPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <QHash>
+#include <QString>
+
+#include "finder.h"
+#include "regex.h"
+#include "workstealingqueue.h"
+
+// Runs any number of independent searches at once on one pool of scanning
+// threads. Every session crawls its own directory, while the files found
+// wait in one shared queue. A file that another session finds while it is
+// still queued is not queued again, so that session joins the file's task
+// instead. The file is then read once and every block goes to one Scanner
+// per session. Several tools searching the same tree thus share the reads
+// of every file still waiting when the later search reaches it. When
+// reading is the bottleneck, that is most of the tree.
+//
+// Each session has its own result stream, metrics, match limit and
+// cancellation, reported like Finder reports its single search. Sessions
+// match the raw bytes of every file in crawl order and do not open
+// archives; start() ends a search compiled for ScanMode::Text or another
+// ScanOrder at once with status 4, like an invalid one.
+class SessionPool
+{
+public:
+    class Session
+    {
+    public:
+        Finder::EntryList getResult();
+        int getStatus() const;
+        Finder::Metrics getMetrics() const;
+        void cancel();
+
+    private:
+        friend class SessionPool;
+
+        Session(const QString &directory, Finder::Search &&search, int threadsCount);
+
+        void publish(std::vector<Finder::Match> &&matches);
+        void settle(int status);
+        void finishIfDone();
+
+    private:
+        const QString directory;
+        const Finder::Search search;
+        const int threadsCount;
+
+        std::atomic<int> statusCode;
+        std::atomic<bool> cancelled;
+        std::atomic<bool> crawlFinished;
+        std::atomic<uint64_t> entryCount;
+        std::atomic<uint64_t> scannedCount;
+        std::atomic<uint64_t> scannedSize;
+        std::atomic<uint64_t> totalCount;
+        std::atomic<uint64_t> totalSize;
+        std::atomic<uint64_t> binaryCount;
+        std::atomic<uint64_t> crawlNs;
+        std::atomic<uint64_t> readNs;
+        std::atomic<uint64_t> matchNs;
+
+        mutable std::mutex resultM;
+        Finder::EntryList result;
+    };
+
+    explicit SessionPool(int threadsCount = 0);
+    ~SessionPool();
+
+    std::shared_ptr<Session> start(const QString &directory, Finder::Search search);
+    uint64_t readSize() const;
+    uint64_t sharedCount() const;
+
+private:
+    // A queued file and the sessions that want it; sessions join under
+    // pendingM until a scanner takes the task out of 'pending'.
+    struct Task
+    {
+        QString path;
+        std::vector<std::shared_ptr<Session>> sessions;
+    };
+
+    struct Crawl
+    {
+        std::thread thread;
+        std::atomic<bool> done;
+    };
+
+    void crawl(const std::shared_ptr<Session> &session);
+    void offer(const std::shared_ptr<Session> &session, const QString &filePath, qint64 size);
+    void scanLoop(int worker);
+    void scan(const QString &path, std::vector<std::shared_ptr<Session>> &&sessions,
+              std::vector<std::unique_ptr<Regex::Dfa>> &dfas);
+    static Regex::Dfa *dfaFor(const Finder::Search &search, std::vector<std::unique_ptr<Regex::Dfa>> &dfas);
+
+private:
+    static const int maxCrawlThreadsCount = 8;
+    static const qint64 binaryProbeSize = 8 * 1024;
+    static const int bufferedBlockSize = 64 * 1024;
+    static const qint64 mappingThreshold = 64 * 1024;
+    static const qint64 mappedBlockSize = 1024 * 1024;
+    static const size_t maxCachedDfas = 8;
+
+    const int threadsCount;
+    bool quit;
+    std::atomic<int> idleScanners;
+    std::atomic<uint64_t> bytesRead;
+    std::atomic<uint64_t> sharedReads;
+    WorkStealingQueue<std::shared_ptr<Task>> fileQueue;
+
+    std::mutex pendingM;
+    QHash<QString, std::shared_ptr<Task>> pending;
+
+    std::mutex crawlsM;
+    std::vector<std::unique_ptr<Crawl>> crawls;
+    std::vector<std::weak_ptr<Session>> sessions;
+
+    std::mutex queueM;
+    std::condition_variable scannerHasWorkCv;
+    std::vector<std::thread> scanThreads;
+};
+
+#endif // SESSIONPOOL_H
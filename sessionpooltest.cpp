@@ -0,0 +1,158 @@
+#include <random>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtTest>
+
+#include "sessionpooltest.h"
+
+namespace {
+
+const uint seed = 1;
+
+const char *const words[] = {"needle", "needles", "haystack", "hay", "stack", "straw"};
+const int smallFileWords = 200;
+// Every so often a file large enough to be mapped rather than read.
+const int largeFileWords = 20000;
+const int largeFileEvery = 16;
+
+}
+
+// directoryCount directories of fileCount files of random words; returns
+// the size of the whole tree.
+qint64 SessionPoolTest::writeTree(const QString &directory)
+{
+    std::mt19937 rng(seed);
+    qint64 treeSize = 0;
+    for (int d = 0; d < directoryCount; d++) {
+        QString subdirectory = QString("dir%1").arg(d);
+        if (!QDir(directory).mkpath(subdirectory)) {
+            return -1;
+        }
+        for (int f = 0; f < fileCount; f++) {
+            QByteArray text;
+            int count = f % largeFileEvery == 0 ? largeFileWords : smallFileWords;
+            for (int i = 0; i < count; i++) {
+                text += words[rng() % (sizeof(words) / sizeof(words[0]))];
+                text += rng() % 8 == 0 ? '\n' : ' ';
+            }
+            QFile file(QString("%1/%2/file%3.txt").arg(directory, subdirectory).arg(f));
+            if (!file.open(QIODevice::WriteOnly) || file.write(text) != text.size()) {
+                return -1;
+            }
+            treeSize += text.size();
+        }
+    }
+    return treeSize;
+}
+
+// Every occurrence of 'pattern' in the tree, as path:offset with the path
+// relative to 'directory'.
+QStringList SessionPoolTest::expectedMatches(const QString &directory, const QByteArray &pattern)
+{
+    QStringList matches;
+    QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QFile file(it.next());
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        QByteArray text = file.readAll();
+        QString path = QDir(directory).relativeFilePath(file.fileName());
+        for (int at = text.indexOf(pattern); at != -1; at = text.indexOf(pattern, at + 1)) {
+            matches << QString("%1:%2").arg(path).arg(at);
+        }
+    }
+    matches.sort();
+    return matches;
+}
+
+// Every match of a session, in the form of expectedMatches, once it has
+// settled; 'status' is left with the status it settled with.
+QStringList SessionPoolTest::collect(const QString &directory, const std::shared_ptr<SessionPool::Session> &session,
+                                     int &status)
+{
+    QStringList matches;
+    QElapsedTimer timer;
+    timer.start();
+    for (;;) {
+        status = session->getStatus();
+        Finder::EntryList result = session->getResult();
+        for (const Finder::Match &match : result.list) {
+            QString path = QDir(directory).relativeFilePath(result.paths->path(match.file));
+            matches << QString("%1:%2").arg(path).arg(match.offset);
+        }
+        if (status != 1 || timer.elapsed() > SessionPoolTest::timeout) {
+            matches.sort();
+            return matches;
+        }
+        QThread::msleep(10);
+    }
+}
+
+// Whether the second session finds a file while it still waits for the
+// first one's depends on timing, so the pool is started afresh a few times
+// until some file is shared. The matches have to be right every time.
+void SessionPoolTest::sharedReads()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    qint64 treeSize = writeTree(directory.path());
+    QVERIFY(treeSize > 0);
+    QStringList expectedNeedles = expectedMatches(directory.path(), "needle");
+    QStringList expectedHaystacks = expectedMatches(directory.path(), "haystack");
+
+    uint64_t shared = 0;
+    for (int attempt = 0; attempt < attempts && shared == 0; attempt++) {
+        SessionPool pool(1);
+        QStringList needle = QStringList() << "needle";
+        QStringList haystack = QStringList() << "haystack";
+        auto needles = pool.start(directory.path(), Finder::compileSearch(needle, Finder::PatternSyntax::Literal,
+                                                                          Finder::ScanMode::Mapped));
+        auto haystacks = pool.start(directory.path(), Finder::compileSearch(haystack, Finder::PatternSyntax::Literal,
+                                                                            Finder::ScanMode::Mapped));
+
+        int needlesStatus = 0;
+        int haystacksStatus = 0;
+        QStringList foundNeedles = collect(directory.path(), needles, needlesStatus);
+        QStringList foundHaystacks = collect(directory.path(), haystacks, haystacksStatus);
+        QCOMPARE(needlesStatus, 2);
+        QCOMPARE(haystacksStatus, 2);
+        QCOMPARE(foundNeedles, expectedNeedles);
+        QCOMPARE(foundHaystacks, expectedHaystacks);
+
+        // A shared file is read once for both sessions.
+        shared = pool.sharedCount();
+        QVERIFY(pool.readSize() >= static_cast<uint64_t>(treeSize));
+        QVERIFY(shared == 0 || pool.readSize() < 2 * static_cast<uint64_t>(treeSize));
+    }
+    QVERIFY2(shared != 0, "no file read once for both sessions");
+}
+
+// Text mode offsets and the other scan orders are Finder's alone; an
+// invalid expression ends the session like it ends Finder's search.
+void SessionPoolTest::unsupportedSearches()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    SessionPool pool(1);
+    QStringList patterns = QStringList() << "needle";
+
+    Finder::Search text = Finder::compileSearch(patterns, Finder::PatternSyntax::Literal, Finder::ScanMode::Text);
+    QCOMPARE(pool.start(directory.path(), text)->getStatus(), 4);
+
+    Finder::Search ordered = Finder::compileSearch(patterns, Finder::PatternSyntax::Literal, Finder::ScanMode::Mapped);
+    ordered.scanOrder = Finder::ScanOrder::SmallestFirst;
+    QCOMPARE(pool.start(directory.path(), ordered)->getStatus(), 4);
+
+    Finder::Search invalid = Finder::compileSearch(QStringList() << "(", Finder::PatternSyntax::RegularExpression,
+                                                   Finder::ScanMode::Mapped);
+    QCOMPARE(pool.start(directory.path(), invalid)->getStatus(), 4);
+
+    Finder::Search empty = Finder::compileSearch(QStringList(), Finder::PatternSyntax::Literal,
+                                                 Finder::ScanMode::Mapped);
+    QCOMPARE(pool.start(directory.path(), empty)->getStatus(), 0);
+}
@@ -0,0 +1,37 @@
+#ifndef SESSIONPOOLTEST_H
+#define SESSIONPOOLTEST_H
+
+#include <memory>
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include "sessionpool.h"
+
+// Runs several sessions of one SessionPool over a tree written to a
+// temporary directory. Sessions started together on the same tree have to
+// share the reads of the files both find, while each still gets every match
+// of its own pattern; searches the pool cannot run have to end at once.
+class SessionPoolTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    static qint64 writeTree(const QString &directory);
+    static QStringList expectedMatches(const QString &directory, const QByteArray &pattern);
+    static QStringList collect(const QString &directory, const std::shared_ptr<SessionPool::Session> &session,
+                               int &status);
+
+private slots:
+    void sharedReads();
+    void unsupportedSearches();
+
+private:
+    static const int directoryCount = 4;
+    static const int fileCount = 50;
+    static const int attempts = 5;
+    static const int timeout = 10000;
+};
+
+#endif // SESSIONPOOLTEST_H
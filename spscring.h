@@ -0,0 +1,73 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <memory>
+
+// Bounded single-producer/single-consumer ring. The producer only writes
+// 'tail' and the consumer only writes 'head', so neither side ever waits
+// for the other; push fails when the ring is full and pop when it is
+// empty. The two indices live on separate cache lines.
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity);
+
+    bool push(T &&item);
+    bool pop(T &item);
+    bool empty() const;
+
+private:
+    std::unique_ptr<T[]> items;
+    const size_t capacity;
+    char headPadding[64];
+    std::atomic<size_t> head;
+    char tailPadding[64];
+    std::atomic<size_t> tail;
+    char padding[64];
+};
+
+template <typename T>
+SpscRing<T>::SpscRing(size_t capacity)
+    : items(new T[capacity + 1])
+    , capacity(capacity + 1)
+    , head(0)
+    , tail(0)
+{}
+
+template <typename T>
+bool SpscRing<T>::push(T &&item)
+{
+    size_t position = tail.load(std::memory_order_relaxed);
+    size_t next = (position + 1) % capacity;
+    if (next == head.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    items[position] = std::move(item);
+    tail.store(next, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SpscRing<T>::pop(T &item)
+{
+    size_t position = head.load(std::memory_order_relaxed);
+    if (position == tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    item = std::move(items[position]);
+    items[position] = T();
+    head.store((position + 1) % capacity, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SpscRing<T>::empty() const
+{
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
+
+#endif // SPSCRING_H
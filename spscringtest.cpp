@@ -0,0 +1,92 @@
+#include <thread>
+#include <vector>
+#include <QtTest>
+
+#include "spscring.h"
+#include "spscringtest.h"
+
+void SpscRingTest::fillAndDrain()
+{
+    SpscRing<std::vector<int>> ring(capacity);
+    QVERIFY(ring.empty());
+    for (int i = 0; i < static_cast<int>(capacity); i++) {
+        QVERIFY(ring.push(std::vector<int>(1, i)));
+    }
+    QVERIFY(!ring.empty());
+
+    // A refused item stays with the caller, who publishes it another way.
+    std::vector<int> refused(1, -1);
+    QVERIFY(!ring.push(std::move(refused)));
+    QCOMPARE(refused, std::vector<int>(1, -1));
+
+    std::vector<int> item;
+    for (int i = 0; i < static_cast<int>(capacity); i++) {
+        QVERIFY(ring.pop(item));
+        QCOMPARE(item, std::vector<int>(1, i));
+    }
+    QVERIFY(ring.empty());
+    QVERIFY(!ring.pop(item));
+}
+
+// Items keep their order while the indices wrap around many times, with
+// the ring anywhere between empty and full.
+void SpscRingTest::wrapAround()
+{
+    SpscRing<int> ring(capacity);
+    int pushed = 0;
+    int popped = 0;
+    for (int round = 0; round < rounds; round++) {
+        int pushes = 1 + round % static_cast<int>(capacity);
+        for (int i = 0; i < pushes; i++) {
+            int item = pushed;
+            if (ring.push(std::move(item))) {
+                pushed++;
+            }
+        }
+        int pops = 1 + (round * 3) % static_cast<int>(capacity);
+        int item = -1;
+        for (int i = 0; i < pops && ring.pop(item); i++) {
+            QCOMPARE(item, popped);
+            popped++;
+        }
+    }
+    int item = -1;
+    while (ring.pop(item)) {
+        QCOMPARE(item, popped);
+        popped++;
+    }
+    QCOMPARE(popped, pushed);
+    QVERIFY(pushed > rounds);
+}
+
+// The producer retries while the ring is full and the consumer while it
+// is empty, so that both ends keep meeting.
+void SpscRingTest::producerAndConsumer()
+{
+    SpscRing<std::vector<int>> ring(capacity);
+    std::thread producer([&ring]
+    {
+        for (int i = 0; i < itemCount; i++) {
+            std::vector<int> item(1, i);
+            while (!ring.push(std::move(item))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    int expected = 0;
+    bool inOrder = true;
+    std::vector<int> item;
+    while (expected < itemCount) {
+        if (!ring.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        inOrder = inOrder && item.size() == 1 && item.front() == expected;
+        expected++;
+    }
+    producer.join();
+
+    QVERIFY(inOrder);
+    QVERIFY(ring.empty());
+}
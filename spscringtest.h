@@ -0,0 +1,24 @@
+#ifndef SPSCRINGTEST_H
+#define SPSCRINGTEST_H
+
+#include <QObject>
+
+// Tests of SpscRing on one thread, where a full ring has to refuse a push
+// without taking the item, and across a producer and a consumer thread,
+// where every item has to arrive once and in order.
+class SpscRingTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void fillAndDrain();
+    void wrapAround();
+    void producerAndConsumer();
+
+private:
+    static const size_t capacity = 4;
+    static const int rounds = 100;
+    static const int itemCount = 200000;
+};
+
+#endif // SPSCRINGTEST_H
@@ -0,0 +1,25 @@
+#include <QtTest>
+
+#include "automatontest.h"
+#include "findertest.h"
+#include "regextest.h"
+#include "sessionpooltest.h"
+#include "spscringtest.h"
+
+// Runs every test class in turn; the exit code counts the failed tests of
+// all of them.
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+    AutomatonTest automatonTest;
+    failed += QTest::qExec(&automatonTest, argc, argv);
+    RegexTest regexTest;
+    failed += QTest::qExec(&regexTest, argc, argv);
+    SpscRingTest spscRingTest;
+    failed += QTest::qExec(&spscRingTest, argc, argv);
+    FinderTest finderTest;
+    failed += QTest::qExec(&finderTest, argc, argv);
+    SessionPoolTest sessionPoolTest;
+    failed += QTest::qExec(&sessionPoolTest, argc, argv);
+    return failed;
+}
@@ -0,0 +1,414 @@
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "archive.h"
+#include "trigramindex.h"
+
+namespace {
+
+const uint32_t notFound = UINT32_MAX;
+
+void appendVarint(QByteArray &out, uint32_t value)
+{
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+bool readVarint(const uchar *&pos, const uchar *end, uint32_t &value)
+{
+    value = 0;
+    for (int shift = 0; pos != end && shift < 35; shift += 7) {
+        uchar byte = *pos++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void intersect(std::vector<uint32_t> &lhs, const std::vector<uint32_t> &rhs)
+{
+    auto end = std::set_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), lhs.begin());
+    lhs.erase(end, lhs.end());
+}
+
+}
+
+const uint32_t TrigramIndex::version;
+const qint64 TrigramIndex::maxIndexedFileSize;
+
+TrigramIndex::Collector::Collector()
+    : window(0)
+    , total(0)
+{}
+
+void TrigramIndex::Collector::add(const char *data, size_t size)
+{
+    if (bits.empty()) {
+        bits.assign((1 << 24) / 64, 0);
+    }
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+        window = (window << 8 | bytes[i]) & 0xffffff;
+        if (++total < 3) {
+            continue;
+        }
+        uint64_t &word = bits[window >> 6];
+        uint64_t bit = uint64_t(1) << (window & 63);
+        if ((word & bit) == 0) {
+            word |= bit;
+            found.push_back(window);
+        }
+    }
+}
+
+// Bytes added since the last take().
+qint64 TrigramIndex::Collector::size() const
+{
+    return total;
+}
+
+std::vector<uint32_t> TrigramIndex::Collector::take()
+{
+    std::vector<uint32_t> result;
+    result.swap(found);
+    for (uint32_t trigram : result) {
+        bits[trigram >> 6] = 0;
+    }
+    window = 0;
+    total = 0;
+    return result;
+}
+
+void TrigramIndex::Collector::clear()
+{
+    take();
+}
+
+TrigramIndex::TrigramIndex(const QString &rootDirectory)
+    : root(QDir::cleanPath(QDir(rootDirectory).absolutePath()))
+    , data(nullptr)
+    , dataSize(0)
+    , header(nullptr)
+    , files(nullptr)
+    , trigrams(nullptr)
+    , selectAll(true)
+{}
+
+TrigramIndex::~TrigramIndex()
+{
+    unload();
+}
+
+QString TrigramIndex::indexPath() const
+{
+    QByteArray key = QCryptographicHash::hash(root.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + "/trigram-index/" + QString::fromLatin1(key) + ".idx";
+}
+
+bool TrigramIndex::load()
+{
+    unload();
+    file.setFileName(indexPath());
+    if (!file.open(QIODevice::ReadOnly) || file.size() < static_cast<qint64>(sizeof(Header))) {
+        file.close();
+        return false;
+    }
+
+    dataSize = file.size();
+    data = file.map(0, dataSize);
+    if (data == nullptr) {
+        file.close();
+        return false;
+    }
+
+    const Header *candidate = reinterpret_cast<const Header *>(data);
+    uint64_t tables = sizeof(Header) + uint64_t(candidate->fileCount) * sizeof(FileRecord)
+            + uint64_t(candidate->trigramCount) * sizeof(TrigramRecord);
+    QByteArray rootPath = root.toUtf8();
+    if (std::memcmp(candidate->magic, "QFTI", 4) != 0 || candidate->version != version
+            || tables > candidate->pathsOffset || candidate->pathsOffset > candidate->postingsOffset
+            || candidate->postingsOffset > static_cast<uint64_t>(dataSize)
+            || candidate->pathsOffset + candidate->rootSize > candidate->postingsOffset
+            || candidate->rootSize != static_cast<uint32_t>(rootPath.size())
+            || std::memcmp(data + candidate->pathsOffset, rootPath.constData(), rootPath.size()) != 0) {
+        unload();
+        return false;
+    }
+
+    header = candidate;
+    files = reinterpret_cast<const FileRecord *>(data + sizeof(Header));
+    trigrams = reinterpret_cast<const TrigramRecord *>(files + header->fileCount);
+
+    uint64_t pathsSize = header->postingsOffset - header->pathsOffset;
+    const char *paths = reinterpret_cast<const char *>(data + header->pathsOffset);
+    for (uint32_t id = 0; id != header->fileCount; id++) {
+        const FileRecord &record = files[id];
+        if (record.pathOffset + record.pathSize > pathsSize) {
+            unload();
+            return false;
+        }
+        ids.insert(QString::fromUtf8(paths + record.pathOffset, static_cast<int>(record.pathSize)), id);
+    }
+    return true;
+}
+
+void TrigramIndex::unload()
+{
+    if (data != nullptr) {
+        file.unmap(const_cast<uchar *>(data));
+    }
+    file.close();
+    data = nullptr;
+    dataSize = 0;
+    header = nullptr;
+    files = nullptr;
+    trigrams = nullptr;
+    ids.clear();
+}
+
+void TrigramIndex::select(const std::vector<std::string> &literals)
+{
+    selectAll = header == nullptr || literals.empty();
+    for (const std::string &literal : literals) {
+        selectAll = selectAll || literal.size() < 3;
+    }
+    if (selectAll) {
+        return;
+    }
+
+    candidates.assign(header->fileCount, 0);
+    for (uint32_t id = 0; id != header->fileCount; id++) {
+        if (files[id].flags & NotIndexed) {
+            candidates[id] = 1;
+        }
+    }
+
+    for (const std::string &literal : literals) {
+        std::vector<uint32_t> wanted;
+        for (size_t i = 0; i + 2 < literal.size(); i++) {
+            const uint8_t *bytes = reinterpret_cast<const uint8_t *>(literal.data() + i);
+            wanted.push_back(uint32_t(bytes[0]) << 16 | uint32_t(bytes[1]) << 8 | bytes[2]);
+        }
+        std::sort(wanted.begin(), wanted.end());
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+
+        std::vector<std::vector<uint32_t>> lists;
+        for (uint32_t trigram : wanted) {
+            lists.push_back(postings(trigram));
+        }
+        std::sort(lists.begin(), lists.end(), [](const std::vector<uint32_t> &lhs, const std::vector<uint32_t> &rhs)
+        {
+            return lhs.size() < rhs.size();
+        });
+
+        std::vector<uint32_t> matching = lists.front();
+        for (size_t i = 1; i < lists.size() && !matching.empty(); i++) {
+            intersect(matching, lists[i]);
+        }
+        for (uint32_t id : matching) {
+            candidates[id] = 1;
+        }
+    }
+}
+
+std::vector<uint32_t> TrigramIndex::postings(uint32_t trigram) const
+{
+    std::vector<uint32_t> result;
+    const TrigramRecord *end = trigrams + header->trigramCount;
+    const TrigramRecord *record = std::lower_bound(trigrams, end, trigram, [](const TrigramRecord &lhs, uint32_t rhs)
+    {
+        return lhs.trigram < rhs;
+    });
+    if (record == end || record->trigram != trigram
+            || record->offset > static_cast<uint64_t>(dataSize) - header->postingsOffset) {
+        return result;
+    }
+
+    const uchar *pos = data + header->postingsOffset + record->offset;
+    const uchar *limit = data + dataSize;
+    uint32_t id = 0;
+    uint32_t gap;
+    for (uint32_t i = 0; i != record->count && readVarint(pos, limit, gap); i++) {
+        id += gap;
+        if (id >= header->fileCount) {
+            break;
+        }
+        result.push_back(id);
+    }
+    return result;
+}
+
+// 'slot' tells a scanner reading the file whole where to record() its
+// trigrams, or is -1 when the index has them already or won't take them.
+bool TrigramIndex::isCandidate(const QString &filePath, qint64 size, qint64 mtime, int64_t &slot)
+{
+    int64_t id = -1;
+    if (header != nullptr) {
+        uint32_t found = ids.value(filePath, notFound);
+        if (found != notFound && files[found].size == size && files[found].mtime == mtime) {
+            id = found;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> seenLg(seenM);
+        slot = id < 0 && size <= maxIndexedFileSize ? static_cast<int64_t>(seen.size()) : -1;
+        seen.push_back({filePath, size, mtime, id, false, std::vector<uint32_t>()});
+    }
+    return id < 0 || selectAll || candidates[id];
+}
+
+void TrigramIndex::record(int64_t slot, std::vector<uint32_t> &&trigrams)
+{
+    std::lock_guard<std::mutex> seenLg(seenM);
+    SeenFile &seenFile = seen[static_cast<size_t>(slot)];
+    seenFile.collected = true;
+    seenFile.trigrams = std::move(trigrams);
+}
+
+bool TrigramIndex::extract(const QString &filePath, std::vector<uint32_t> &found)
+{
+    QFile input(filePath);
+    if (!input.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    // The scanners look inside compressed files and archives, the index
+    // doesn't; left unindexed, they stay candidates for every search.
+    QByteArray head = input.peek(TarReader::blockSize);
+    Decompressor::Format format;
+    if (Decompressor::isArchive(head.constData(), head.size(), format)) {
+        return false;
+    }
+
+    QByteArray block(readingBlockSize, Qt::Uninitialized);
+    qint64 read;
+    while ((read = input.read(block.data(), block.size())) > 0) {
+        collector.add(block.constData(), static_cast<size_t>(read));
+    }
+    found = collector.take();
+    return read == 0;
+}
+
+bool TrigramIndex::update(const std::atomic<bool> &cancel)
+{
+    std::vector<const SeenFile *> kept;
+    std::vector<const SeenFile *> fresh;
+    for (const SeenFile &seenFile : seen) {
+        (seenFile.id >= 0 ? kept : fresh).push_back(&seenFile);
+    }
+    if (header != nullptr && fresh.empty() && kept.size() == header->fileCount) {
+        return true;
+    }
+    std::sort(kept.begin(), kept.end(), [](const SeenFile *lhs, const SeenFile *rhs)
+    {
+        return lhs->id < rhs->id;
+    });
+
+    std::vector<FileRecord> records;
+    QByteArray paths = root.toUtf8();
+    std::vector<const SeenFile *> order(kept);
+    order.insert(order.end(), fresh.begin(), fresh.end());
+    for (const SeenFile *seenFile : order) {
+        QByteArray path = seenFile->path.toUtf8();
+        uint32_t flags = seenFile->id >= 0 ? files[seenFile->id].flags : 0;
+        records.push_back({seenFile->size, seenFile->mtime, static_cast<uint64_t>(paths.size()),
+                           static_cast<uint32_t>(path.size()), flags});
+        paths.append(path);
+    }
+
+    std::unordered_map<uint32_t, std::vector<uint32_t>> lists;
+    if (header != nullptr) {
+        std::vector<uint32_t> remap(header->fileCount, notFound);
+        for (size_t i = 0; i != kept.size(); i++) {
+            remap[kept[i]->id] = static_cast<uint32_t>(i);
+        }
+        for (uint32_t i = 0; i != header->trigramCount; i++) {
+            if (cancel.load()) {
+                return false;
+            }
+            std::vector<uint32_t> &list = lists[trigrams[i].trigram];
+            for (uint32_t id : postings(trigrams[i].trigram)) {
+                if (remap[id] != notFound) {
+                    list.push_back(remap[id]);
+                }
+            }
+        }
+    }
+
+    std::vector<uint32_t> found;
+    for (size_t i = kept.size(); i != order.size(); i++) {
+        if (cancel.load()) {
+            return false;
+        }
+        const std::vector<uint32_t> *fileTrigrams = &order[i]->trigrams;
+        if (!order[i]->collected) {
+            found.clear();
+            if (order[i]->size > maxIndexedFileSize || !extract(order[i]->path, found)) {
+                records[i].flags |= NotIndexed;
+                continue;
+            }
+            fileTrigrams = &found;
+        }
+        for (uint32_t trigram : *fileTrigrams) {
+            lists[trigram].push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    std::vector<uint32_t> keys;
+    for (const auto &list : lists) {
+        if (!list.second.empty()) {
+            keys.push_back(list.first);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<TrigramRecord> table;
+    QByteArray encoded;
+    for (uint32_t trigram : keys) {
+        const std::vector<uint32_t> &list = lists[trigram];
+        table.push_back({trigram, static_cast<uint32_t>(list.size()), static_cast<uint64_t>(encoded.size())});
+        uint32_t previous = 0;
+        for (uint32_t id : list) {
+            appendVarint(encoded, id - previous);
+            previous = id;
+        }
+    }
+
+    Header out;
+    std::memcpy(out.magic, "QFTI", 4);
+    out.version = version;
+    out.fileCount = static_cast<uint32_t>(records.size());
+    out.trigramCount = static_cast<uint32_t>(table.size());
+    out.pathsOffset = sizeof(Header) + records.size() * sizeof(FileRecord) + table.size() * sizeof(TrigramRecord);
+    out.postingsOffset = out.pathsOffset + paths.size();
+    out.rootSize = static_cast<uint32_t>(root.toUtf8().size());
+    out.reserved = 0;
+
+    QString path = indexPath();
+    unload();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile output(path);
+    if (!output.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    output.write(reinterpret_cast<const char *>(&out), sizeof(out));
+    output.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(FileRecord));
+    output.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(TrigramRecord));
+    output.write(paths);
+    output.write(encoded);
+    return output.commit();
+}
@@ -0,0 +1,130 @@
+#ifndef TRIGRAMINDEX_H
+#define TRIGRAMINDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+// Persistent trigram -> file posting index of one directory tree, kept in
+// the user's cache directory and memory-mapped for queries. select() turns
+// the literals a search needs into the set of files whose posting lists
+// contain all trigrams of at least one literal; the crawler then asks
+// isCandidate() for every file it finds, which also records what the tree
+// looks like now. Files whose size or modification time differ from the
+// index are always candidates. update() writes a refreshed index, reusing
+// the postings of unchanged files and the trigrams record()ed for new and
+// changed ones while they were scanned; only those a scan did not read
+// whole are read again.
+//
+// Layout: Header, FileRecord[fileCount], TrigramRecord[trigramCount]
+// sorted by trigram, the root and file paths (UTF-8), and the postings as
+// varint-encoded gaps between ascending file ids.
+class TrigramIndex
+{
+private:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t fileCount;
+        uint32_t trigramCount;
+        uint64_t pathsOffset;
+        uint64_t postingsOffset;
+        uint32_t rootSize;
+        uint32_t reserved;
+    };
+
+    struct FileRecord
+    {
+        int64_t size;
+        int64_t mtime;
+        uint64_t pathOffset;
+        uint32_t pathSize;
+        uint32_t flags;
+    };
+
+    struct TrigramRecord
+    {
+        uint32_t trigram;
+        uint32_t count;
+        uint64_t offset;
+    };
+
+    struct SeenFile
+    {
+        QString path;
+        qint64 size;
+        qint64 mtime;
+        int64_t id;
+        bool collected;
+        std::vector<uint32_t> trigrams;
+    };
+
+    enum FileFlags
+    {
+        NotIndexed = 1
+    };
+
+public:
+    // The distinct trigrams of the blocks of one file, added in order.
+    class Collector
+    {
+    public:
+        Collector();
+        void add(const char *data, size_t size);
+        qint64 size() const;
+        std::vector<uint32_t> take();
+        void clear();
+
+    private:
+        std::vector<uint64_t> bits;
+        std::vector<uint32_t> found;
+        uint32_t window;
+        qint64 total;
+    };
+
+    explicit TrigramIndex(const QString &rootDirectory);
+    ~TrigramIndex();
+
+    bool load();
+    void select(const std::vector<std::string> &literals);
+    bool isCandidate(const QString &filePath, qint64 size, qint64 mtime, int64_t &slot);
+    void record(int64_t slot, std::vector<uint32_t> &&trigrams);
+    bool update(const std::atomic<bool> &cancel);
+    QString indexPath() const;
+
+private:
+    void unload();
+    std::vector<uint32_t> postings(uint32_t trigram) const;
+    bool extract(const QString &filePath, std::vector<uint32_t> &trigrams);
+
+private:
+    static const uint32_t version = 1;
+    static const qint64 maxIndexedFileSize = 256 * 1024 * 1024;
+    static const int readingBlockSize = 64 * 1024;
+
+    QString root;
+    QFile file;
+    const uchar *data;
+    qint64 dataSize;
+    const Header *header;
+    const FileRecord *files;
+    const TrigramRecord *trigrams;
+    QHash<QString, uint32_t> ids;
+
+    bool selectAll;
+    std::vector<char> candidates;
+
+    std::mutex seenM;
+    std::vector<SeenFile> seen;
+
+    Collector collector;
+};
+
+#endif // TRIGRAMINDEX_H
@@ -0,0 +1,148 @@
+#include <QFile>
+
+#include "watcher.h"
+
+#ifdef Q_OS_LINUX
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t watchMask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+        | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+}
+#endif
+
+Watcher::Changes::Changes()
+    : overflow(false)
+{}
+
+Watcher::Watcher()
+    : fd(-1)
+    , wakeFd(-1)
+{
+#ifdef Q_OS_LINUX
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+}
+
+Watcher::~Watcher()
+{
+#ifdef Q_OS_LINUX
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (wakeFd >= 0) {
+        close(wakeFd);
+    }
+#endif
+}
+
+bool Watcher::isValid() const
+{
+    return fd >= 0 && wakeFd >= 0;
+}
+
+void Watcher::addDirectory(const QString &directory)
+{
+#ifdef Q_OS_LINUX
+    if (!isValid()) {
+        return;
+    }
+
+    int wd = inotify_add_watch(fd, QFile::encodeName(directory).constData(), watchMask);
+    if (wd >= 0) {
+        std::lock_guard<std::mutex> lg(m);
+        directories.insert(wd, directory);
+    }
+#else
+    Q_UNUSED(directory);
+#endif
+}
+
+void Watcher::clear()
+{
+    std::lock_guard<std::mutex> lg(m);
+#ifdef Q_OS_LINUX
+    for (int wd : directories.keys()) {
+        inotify_rm_watch(fd, wd);
+    }
+#endif
+    directories.clear();
+}
+
+bool Watcher::wait(Changes &changes, int timeout)
+{
+#ifdef Q_OS_LINUX
+    if (!isValid()) {
+        return false;
+    }
+
+    pollfd fds[2] = {{fd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+    if (poll(fds, 2, timeout) <= 0) {
+        return true;
+    }
+    if (fds[1].revents & POLLIN) {
+        uint64_t value;
+        ssize_t ignored = read(wakeFd, &value, sizeof(value));
+        Q_UNUSED(ignored);
+        return false;
+    }
+
+    alignas(inotify_event) char buffer[Watcher::eventBufferSize];
+    ssize_t size;
+    while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t pos = 0; pos < size;) {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + pos);
+            pos += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                changes.overflow = true;
+                continue;
+            }
+
+            QString directory;
+            {
+                std::lock_guard<std::mutex> lg(m);
+                if (event->mask & IN_IGNORED) {
+                    directories.remove(event->wd);
+                    continue;
+                }
+                directory = directories.value(event->wd);
+            }
+            if (directory.isEmpty() || event->len == 0) {
+                continue;
+            }
+
+            QString path = directory + '/' + QFile::decodeName(event->name);
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changes.removed.append(event->mask & IN_ISDIR ? path + '/' : path);
+            } else if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    changes.directories.append(path);
+                }
+            } else {
+                changes.changed.append(path);
+            }
+        }
+    }
+    return true;
+#else
+    Q_UNUSED(changes);
+    Q_UNUSED(timeout);
+    return false;
+#endif
+}
+
+void Watcher::wake()
+{
+#ifdef Q_OS_LINUX
+    uint64_t value = 1;
+    ssize_t ignored = write(wakeFd, &value, sizeof(value));
+    Q_UNUSED(ignored);
+#endif
+}
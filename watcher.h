@@ -0,0 +1,48 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include <mutex>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+// Thin wrapper around inotify that watches a set of directories (not
+// recursively; the crawler registers every directory it enters). wait()
+// blocks until events arrive, the timeout expires or wake() is called, and
+// sorts the events into changed files, removed paths and new directories.
+// A queue overflow means events were lost and the caller has to rescan
+// everything. On platforms without inotify the watcher is invalid and
+// never reports anything.
+class Watcher
+{
+public:
+    struct Changes
+    {
+        Changes();
+
+        QStringList changed;
+        QStringList removed;
+        QStringList directories;
+        bool overflow;
+    };
+
+    Watcher();
+    ~Watcher();
+
+    bool isValid() const;
+    void addDirectory(const QString &directory);
+    void clear();
+    bool wait(Changes &changes, int timeout);
+    void wake();
+
+private:
+    static const int eventBufferSize = 64 * 1024;
+
+    int fd;
+    int wakeFd;
+
+    std::mutex m;
+    QHash<int, QString> directories;
+};
+
+#endif // WATCHER_H
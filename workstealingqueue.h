@@ -0,0 +1,185 @@
+#ifndef WORKSTEALINGQUEUE_H
+#define WORKSTEALINGQUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Set of per-worker queues. Producers spread items round-robin; a worker
+// pops the item with the lowest key from its own queue (the oldest among
+// equal keys, so all keys 0 is first in, first out) and, once that is empty,
+// steals half of another worker's queue in one go, taking the entries with
+// the lowest keys, so the most urgent items move first. Every queue has
+// its own lock, so workers only meet each other while stealing. Producers
+// may limit the spread to the first workers when the others are parked.
+template <typename T>
+class WorkStealingQueue
+{
+private:
+    struct Entry
+    {
+        uint64_t key;
+        uint64_t sequence;
+        T item;
+
+        bool operator<(const Entry &other) const
+        {
+            return key != other.key ? key > other.key : sequence > other.sequence;
+        }
+    };
+
+    struct Slot
+    {
+        std::mutex m;
+        std::vector<Entry> heap;
+        char padding[64];
+    };
+
+public:
+    explicit WorkStealingQueue(size_t workerCount);
+
+    void push(T &&item);
+    void push(T &&item, size_t workers, uint64_t key);
+    bool pop(size_t worker, T &item);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    size_t workerCount() const;
+
+private:
+    bool steal(size_t worker, T &item);
+
+private:
+    static T take(std::vector<Entry> &heap);
+
+private:
+    std::vector<std::unique_ptr<Slot>> deques;
+    std::atomic<size_t> nextSlot;
+    std::atomic<uint64_t> nextSequence;
+    std::atomic<size_t> count;
+};
+
+template <typename T>
+WorkStealingQueue<T>::WorkStealingQueue(size_t workerCount)
+    : nextSlot(0)
+    , nextSequence(0)
+    , count(0)
+{
+    for (size_t i = 0; i < workerCount; i++) {
+        deques.emplace_back(new Slot);
+    }
+}
+
+template <typename T>
+void WorkStealingQueue<T>::push(T &&item)
+{
+    push(std::move(item), deques.size(), 0);
+}
+
+template <typename T>
+void WorkStealingQueue<T>::push(T &&item, size_t workers, uint64_t key)
+{
+    size_t spread = std::max<size_t>(1, std::min(workers, deques.size()));
+    Slot &slot = *deques[nextSlot.fetch_add(1, std::memory_order_relaxed) % spread];
+    uint64_t sequence = nextSequence.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> slotLg(slot.m);
+    slot.heap.push_back({key, sequence, std::move(item)});
+    std::push_heap(slot.heap.begin(), slot.heap.end());
+    count.fetch_add(1);
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::pop(size_t worker, T &item)
+{
+    Slot &own = *deques[worker];
+    {
+        std::lock_guard<std::mutex> ownLg(own.m);
+        if (!own.heap.empty()) {
+            item = take(own.heap);
+            count.fetch_sub(1);
+            return true;
+        }
+    }
+
+    return steal(worker, item);
+}
+
+template <typename T>
+T WorkStealingQueue<T>::take(std::vector<Entry> &heap)
+{
+    std::pop_heap(heap.begin(), heap.end());
+    T item = std::move(heap.back().item);
+    heap.pop_back();
+    return item;
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::steal(size_t worker, T &item)
+{
+    for (size_t i = 1; i < deques.size() && count.load() != 0; i++) {
+        Slot &victim = *deques[(worker + i) % deques.size()];
+        std::vector<Entry> batch;
+        {
+            // Popped in key order, so the batch is sorted and its first
+            // entry the most urgent one.
+            std::lock_guard<std::mutex> victimLg(victim.m);
+            size_t stolen = victim.heap.size() - victim.heap.size() / 2;
+            batch.reserve(stolen);
+            for (size_t j = 0; j < stolen; j++) {
+                std::pop_heap(victim.heap.begin(), victim.heap.end());
+                batch.push_back(std::move(victim.heap.back()));
+                victim.heap.pop_back();
+            }
+        }
+        if (batch.empty()) {
+            continue;
+        }
+
+        item = std::move(batch.front().item);
+        batch.erase(batch.begin());
+        count.fetch_sub(1);
+
+        if (!batch.empty()) {
+            Slot &own = *deques[worker];
+            std::lock_guard<std::mutex> ownLg(own.m);
+            for (Entry &stolen : batch) {
+                own.heap.push_back(std::move(stolen));
+                std::push_heap(own.heap.begin(), own.heap.end());
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+void WorkStealingQueue<T>::clear()
+{
+    for (auto &slot : deques) {
+        std::lock_guard<std::mutex> slotLg(slot->m);
+        count.fetch_sub(slot->heap.size());
+        slot->heap.clear();
+    }
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::empty() const
+{
+    return count.load() == 0;
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::size() const
+{
+    return count.load();
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::workerCount() const
+{
+    return deques.size();
+}
+
+#endif // WORKSTEALINGQUEUE_H